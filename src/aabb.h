@@ -0,0 +1,74 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "rtweekend.h"
+
+#include <utility>
+
+// Axis aligned bounding box
+class aabb {
+  public:
+    interval x, y, z;
+
+    aabb() {} // Default box is empty
+
+    aabb(const interval& ix, const interval& iy, const interval& iz) : x(ix), y(iy), z(iz) {}
+
+    // Box with the two points as opposite corners
+    aabb(const point3d& a, const point3d& b) {
+        x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
+        y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
+        z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+    }
+
+    // Smallest box enclosing both
+    aabb(const aabb& a, const aabb& b) : x(a.x, b.x), y(a.y, b.y), z(a.z, b.z) {}
+
+    const interval& axis(int n) const {
+        if (n == 1) return y;
+        if (n == 2) return z;
+        return x;
+    }
+
+    bool is_empty() const {
+        return x.min > x.max || y.min > y.max || z.min > z.max;
+    }
+
+    bool is_bounded() const {
+        return std::isfinite(x.size()) && std::isfinite(y.size()) && std::isfinite(z.size());
+    }
+
+    point3d centroid() const {
+        return point3d(0.5 * (x.min + x.max), 0.5 * (y.min + y.max), 0.5 * (z.min + z.max));
+    }
+
+    // Slab test against the ray segment ray_t
+    bool hit(const ray& r, interval ray_t) const {
+        for (int a = 0; a < 3; a++) {
+            double inverse = 1 / r.direction()[a];
+            double origin = r.origin()[a];
+
+            double t0 = (axis(a).min - origin) * inverse;
+            double t1 = (axis(a).max - origin) * inverse;
+            if (inverse < 0) {
+                std::swap(t0, t1);
+            }
+
+            if (t0 > ray_t.min) ray_t.min = t0;
+            if (t1 < ray_t.max) ray_t.max = t1;
+
+            if (ray_t.max <= ray_t.min) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static const aabb empty;
+    static const aabb universe;
+};
+
+const aabb aabb::empty    = aabb(interval::empty,    interval::empty,    interval::empty);
+const aabb aabb::universe = aabb(interval::universe, interval::universe, interval::universe);
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef ALIAS_TABLE_H
+#define ALIAS_TABLE_H
+
+#include <vector>
+
+// Discrete distribution sampled in constant time (Vose's alias method)
+class alias_table {
+  private:
+    std::vector<double> probability; // Chance of keeping bin i rather than taking its alias
+    std::vector<int> alias;
+    std::vector<double> pmfs;
+
+  public:
+    alias_table() {}
+
+    // Distribution proportional to non-negative weights, uniform if they are all zero
+    explicit alias_table(const std::vector<double>& weights) {
+        int n = static_cast<int>(weights.size());
+        probability.assign(n, 1.0);
+        alias.assign(n, 0);
+        pmfs.assign(n, n > 0 ? 1.0 / n : 0.0);
+
+        double total = 0;
+        for (double weight : weights) {
+            total += weight;
+        }
+        if (n == 0 || total <= 0) {
+            for (int i = 0; i < n; i++) {
+                alias[i] = i;
+            }
+            return;
+        }
+
+        // Split bins into those below and above the average, then pair them up
+        std::vector<int> small, large;
+        std::vector<double> scaled(n);
+        for (int i = 0; i < n; i++) {
+            pmfs[i] = weights[i] / total;
+            scaled[i] = pmfs[i] * n;
+            (scaled[i] < 1.0 ? small : large).push_back(i);
+        }
+
+        while (!small.empty() && !large.empty()) {
+            int s = small.back();
+            int l = large.back();
+            small.pop_back();
+
+            probability[s] = scaled[s];
+            alias[s] = l;
+
+            scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+            if (scaled[l] < 1.0) {
+                large.pop_back();
+                small.push_back(l);
+            }
+        }
+
+        // Leftovers are full bins up to rounding
+        for (int i : small) {
+            probability[i] = 1.0;
+            alias[i] = i;
+        }
+        for (int i : large) {
+            probability[i] = 1.0;
+            alias[i] = i;
+        }
+    }
+
+    int size() const {
+        return static_cast<int>(pmfs.size());
+    }
+
+    double pmf(int i) const {
+        return pmfs[i];
+    }
+
+    // Bin for a uniform number u in [0, 1)
+    int sample(double u) const {
+        int n = size();
+        double x = u * n;
+        int i = static_cast<int>(x);
+        i = i < n ? i : n - 1;
+        return (x - i) < probability[i] ? i : alias[i];
+    }
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef ASYNC_RENDER_H
+#define ASYNC_RENDER_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+#include "tile.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Handle to a render running in the background, returned by render_async().
+// The scene must outlive the render. Destroying an unfinished handle cancels it.
+class render_handle {
+  private:
+    struct render_state {
+        camera cam;
+        std::thread runner;
+        std::atomic<bool> cancel_requested;
+        std::atomic<long long> pixels_done;
+        long long total_pixels = 0;
+
+        std::mutex mutex;
+        std::condition_variable finished_cv;
+        bool finished = false;
+        framebuffer partial; // Mean radiance of every finished tile, black elsewhere
+    };
+
+    std::unique_ptr<render_state> state;
+
+  public:
+    render_handle() {}
+    render_handle(render_handle&&) = default;
+
+    render_handle& operator=(render_handle&& other) {
+        if (this != &other) {
+            cancel();
+            wait();
+            state = std::move(other.state);
+        }
+        return *this;
+    }
+
+    ~render_handle() {
+        cancel();
+        wait();
+    }
+
+    // Start rendering a copy of the camera over the scene in the background
+    static render_handle start(const hittable& world, const camera& cam) {
+        render_handle handle;
+        handle.state.reset(new render_state());
+        render_state* s = handle.state.get();
+
+        s->cam = cam;
+        s->cancel_requested = false;
+        s->pixels_done = 0;
+        s->total_pixels = static_cast<long long>(cam.image_width) * cam.image_height;
+        s->partial.resize(cam.image_width, cam.image_height);
+        for (size_t p = 0; p < s->partial.size(); p++) {
+            s->partial[p] = color(0, 0, 0);
+        }
+
+        // Cancellation is checked by the render threads between tiles
+        s->cam.cancel_flag = &s->cancel_requested;
+
+        // A finished tile is no longer written to, so it can be copied out for partial results
+        std::function<void(const tile&)> user_callback = cam.on_tile_complete;
+        s->cam.on_tile_complete = [s, user_callback](const tile& t) {
+            const framebuffer& image = s->cam.get_image();
+            double scale = 1.0 / s->cam.samples_per_pixel;
+            {
+                std::lock_guard<std::mutex> lock(s->mutex);
+                for (int j = t.y0; j < t.y1; j++) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        size_t p = static_cast<size_t>(j) * s->cam.image_width + i;
+                        s->partial[p] = scale * image[p];
+                    }
+                }
+            }
+            s->pixels_done += t.pixel_count();
+
+            if (user_callback) {
+                user_callback(t);
+            }
+        };
+
+        const hittable* scene = &world;
+        s->runner = std::thread([s, scene]() {
+            s->cam.render(*scene);
+
+            std::lock_guard<std::mutex> lock(s->mutex);
+            s->finished = true;
+            s->finished_cv.notify_all();
+        });
+
+        return handle;
+    }
+
+    // Block until the render finished or was cancelled
+    void wait() {
+        if (state && state->runner.joinable()) {
+            state->runner.join();
+        }
+    }
+
+    // Wait up to the given number of seconds. Returns true if the render has finished.
+    bool wait_for(double seconds) {
+        if (!state) {
+            return true;
+        }
+
+        std::unique_lock<std::mutex> lock(state->mutex);
+        return state->finished_cv.wait_for(lock, std::chrono::duration<double>(seconds), [this] { return state->finished; });
+    }
+
+    // Fraction of the image finished so far, at tile granularity
+    double progress() const {
+        if (!state || state->total_pixels == 0) {
+            return 1.0;
+        }
+        return static_cast<double>(state->pixels_done.load(std::memory_order_relaxed)) / state->total_pixels;
+    }
+
+    // Ask the render to stop, its threads finish the tile they are on and exit
+    void cancel() {
+        if (state) {
+            state->cancel_requested = true;
+        }
+    }
+
+    bool cancelled() const {
+        return state && state->cancel_requested.load();
+    }
+
+    // Mean radiance of the tiles finished so far, black where nothing is finished yet
+    framebuffer partial_image() {
+        if (!state) {
+            return framebuffer();
+        }
+
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->partial;
+    }
+
+    // The rendering camera, its image is complete once the render finished without cancellation.
+    // A handle that never started a render returns an unrendered default camera.
+    camera& result() {
+        if (!state) {
+            state.reset(new render_state());
+            state->cancel_requested = false;
+            state->pixels_done = 0;
+            state->finished = true;
+        }
+
+        wait();
+        return state->cam;
+    }
+};
+
+// Start a non-blocking render, see render_handle
+inline render_handle render_async(const hittable& world, const camera& cam) {
+    return render_handle::start(world, cam);
+}
+
+#endif
@@ -0,0 +1,84 @@
+// Noise versus time of light selection strategies on a scene with many lights.
+// Renders with a uniformly sampled light list and with a light_bvh at increasing
+// sample counts and reports the error against a reference image.
+//
+//     make bench && ./bench_lights [light_count]
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "light_bvh.h"
+#include "material.h"
+#include "sphere.h"
+
+#include "scene05.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Mean squared error of the displayed (clamped) pixel values
+static double image_error(const camera& cam, const camera& reference) {
+    const framebuffer& image = cam.get_image();
+    const framebuffer& expected = reference.get_image();
+    double error = 0;
+
+    for (size_t p = 0; p < image.size(); p++) {
+        color a = image[p] / cam.samples_per_pixel;
+        color b = expected[p] / reference.samples_per_pixel;
+        for (int c = 0; c < 3; c++) {
+            double d = fmin(a[c], 1.0) - fmin(b[c], 1.0);
+            error += d * d;
+        }
+    }
+    return error / (3.0 * image.size());
+}
+
+static double render_seconds(camera& cam, const hittable& world) {
+    auto start = std::chrono::steady_clock::now();
+    cam.render(world);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    int light_count = argc > 1 ? atoi(argv[1]) : 1000;
+    hittable_list world = get_scene_05(light_count);
+    shared_ptr<hittable_list> light_list = scene_lights(world);
+    shared_ptr<light_bvh> light_tree = make_shared<light_bvh>(*light_list);
+
+    camera cam;
+    cam.image_width = 160;
+    cam.image_height = 90;
+    cam.max_depth = 4;
+    cam.vfov = 50;
+    cam.lookfrom = point3d(0, 4, 14);
+    cam.lookat = point3d(0, 1, -2);
+    cam.sky = false;
+    cam.max_threads = std::thread::hardware_concurrency();
+    cam.progress = progress_mode::quiet;
+
+    printf("%zu lights, %dx%d pixels, %d threads\n", light_tree->size(), cam.image_width, cam.image_height, cam.max_threads);
+
+    camera reference = cam;
+    reference.samples_per_pixel = 256;
+    reference.lights = light_tree;
+    double reference_seconds = render_seconds(reference, world);
+    printf("reference: light_bvh, %d spp, %.2f s\n\n", reference.samples_per_pixel, reference_seconds);
+
+    printf("%-10s %6s %10s %12s\n", "lights", "spp", "seconds", "mse");
+    const char* names[] = { "uniform", "light_bvh" };
+    shared_ptr<hittable> strategies[] = { light_list, light_tree };
+
+    for (int s = 0; s < 2; s++) {
+        for (int spp = 1; spp <= 16; spp *= 2) {
+            camera test = cam;
+            test.samples_per_pixel = spp;
+            test.seed = 1;
+            test.lights = strategies[s];
+            double seconds = render_seconds(test, world);
+            printf("%-10s %6d %10.3f %12.6f\n", names[s], spp, seconds, image_error(test, reference));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,213 @@
+// Load throughput of the mesh loaders. Writes a grid of n x n vertices as OBJ, ASCII PLY
+// and binary PLY (positions only, which load in place, and with normals and texture
+// coordinates, which are decoded), then loads each on one thread and on all of them. An
+// iostream OBJ parser gives the baseline. A binary PLY starting with a few quads checks
+// that faces of mixed sizes load the same on any number of threads.
+//
+//     make bench && ./bench_meshes [n]
+
+#include "rtweekend.h"
+#include "mesh_io.h"
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static mesh_buffers make_grid(int n) {
+    std::vector<float> positions, normals, texcoords;
+    for (int j = 0; j < n; j++) {
+        for (int i = 0; i < n; i++) {
+            double u = i / (n - 1.0), v = j / (n - 1.0);
+            double height = 0.1 * sin(12 * u) * cos(9 * v);
+            positions.insert(positions.end(), { float(u), float(height), float(v) });
+            normals.insert(normals.end(), { 0.0f, 1.0f, 0.0f });
+            texcoords.insert(texcoords.end(), { float(u), float(v) });
+        }
+    }
+
+    std::vector<uint32_t> indices;
+    for (int j = 0; j + 1 < n; j++) {
+        for (int i = 0; i + 1 < n; i++) {
+            uint32_t a = j * n + i, b = a + 1, c = a + n, d = c + 1;
+            indices.insert(indices.end(), { a, c, b, b, c, d });
+        }
+    }
+
+    mesh_buffers mesh;
+    mesh.positions = std::move(positions);
+    mesh.normals = std::move(normals);
+    mesh.texcoords = std::move(texcoords);
+    mesh.indices = std::move(indices);
+    return mesh;
+}
+
+static void write_obj(const mesh_buffers& m, const std::string& path) {
+    FILE* f = fopen(path.c_str(), "w");
+    size_t vertices = m.positions.size() / 3;
+    for (size_t k = 0; k < vertices; k++) fprintf(f, "v %.9g %.9g %.9g\n", m.positions[3 * k], m.positions[3 * k + 1], m.positions[3 * k + 2]);
+    for (size_t k = 0; k < vertices; k++) fprintf(f, "vt %.9g %.9g\n", m.texcoords[2 * k], m.texcoords[2 * k + 1]);
+    for (size_t k = 0; k < vertices; k++) fprintf(f, "vn %.9g %.9g %.9g\n", m.normals[3 * k], m.normals[3 * k + 1], m.normals[3 * k + 2]);
+    for (size_t t = 0; t < m.triangle_count(); t++) {
+        uint32_t a = m.indices[3 * t] + 1, b = m.indices[3 * t + 1] + 1, c = m.indices[3 * t + 2] + 1;
+        fprintf(f, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a, a, a, b, b, b, c, c, c);
+    }
+    fclose(f);
+}
+
+// The grid with its first quads triangulated as the loaders split a quad a c d b, into
+// a c d and a d b, instead of the grid's a c b and b c d
+static mesh_buffers with_leading_quads(const mesh_buffers& grid, int quads) {
+    std::vector<uint32_t> indices(grid.indices.data(), grid.indices.data() + grid.indices.size());
+    for (int q = 0; q < quads; q++) {
+        uint32_t* t = &indices[6 * q];
+        uint32_t a = t[0], c = t[1], b = t[2], d = t[5];
+        uint32_t fan[6] = { a, c, d, a, d, b };
+        std::copy(fan, fan + 6, t);
+    }
+    mesh_buffers mesh;
+    mesh.positions = std::vector<float>(grid.positions.data(), grid.positions.data() + grid.positions.size());
+    mesh.normals = std::vector<float>(grid.normals.data(), grid.normals.data() + grid.normals.size());
+    mesh.texcoords = std::vector<float>(grid.texcoords.data(), grid.texcoords.data() + grid.texcoords.size());
+    mesh.indices = std::move(indices);
+    return mesh;
+}
+
+// The first quads pairs of triangles are written as one quad each
+static void write_ply(const mesh_buffers& m, const std::string& path, bool binary, bool attributes, int quads = 0) {
+    FILE* f = fopen(path.c_str(), "wb");
+    size_t vertices = m.positions.size() / 3;
+    std::string header = std::string("ply\nformat ") + (binary ? "binary_little_endian" : "ascii") + " 1.0\n" +
+                         "element vertex " + std::to_string(vertices) + "\n" +
+                         "property float x\nproperty float y\nproperty float z\n" +
+                         (attributes ? "property float nx\nproperty float ny\nproperty float nz\n"
+                                       "property float u\nproperty float v\n" : "") +
+                         "element face " + std::to_string(m.triangle_count() - quads) + "\n" +
+                         "property list uchar uint vertex_indices\n";
+    // Pad the header so the binary records start 4 byte aligned
+    std::string comment = "comment ";
+    while ((header.size() + comment.size() + 1 + 11) % 4 != 0) comment += ' ';
+    header += comment + "\nend_header\n";
+    fwrite(header.data(), 1, header.size(), f);
+
+    for (size_t k = 0; k < vertices; k++) {
+        float v[8] = { m.positions[3 * k], m.positions[3 * k + 1], m.positions[3 * k + 2],
+                       m.normals[3 * k],   m.normals[3 * k + 1],   m.normals[3 * k + 2],
+                       m.texcoords[2 * k], m.texcoords[2 * k + 1] };
+        int count = attributes ? 8 : 3;
+        if (binary) {
+            fwrite(v, sizeof(float), count, f);
+        }
+        else {
+            for (int c = 0; c < count; c++) fprintf(f, c ? " %.9g" : "%.9g", v[c]);
+            fprintf(f, "\n");
+        }
+    }
+    for (int q = 0; q < quads; q++) {
+        const uint32_t* t = &m.indices[6 * q];
+        uint32_t quad[4] = { t[0], t[1], t[5], t[2] };
+        if (binary) {
+            unsigned char four = 4;
+            fwrite(&four, 1, 1, f);
+            fwrite(quad, sizeof(uint32_t), 4, f);
+        }
+        else {
+            fprintf(f, "4 %u %u %u %u\n", quad[0], quad[1], quad[2], quad[3]);
+        }
+    }
+    for (size_t t = 2 * quads; t < m.triangle_count(); t++) {
+        if (binary) {
+            unsigned char three = 3;
+            fwrite(&three, 1, 1, f);
+            fwrite(&m.indices[3 * t], sizeof(uint32_t), 3, f);
+        }
+        else {
+            fprintf(f, "3 %u %u %u\n", m.indices[3 * t], m.indices[3 * t + 1], m.indices[3 * t + 2]);
+        }
+    }
+    fclose(f);
+}
+
+// The usual getline and stringstream parser, positions and faces only
+static double load_obj_iostream(const std::string& path, size_t& triangles) {
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(path);
+    std::string line, word;
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    while (std::getline(in, line)) {
+        std::istringstream words(line);
+        words >> word;
+        if (word == "v") {
+            float x, y, z;
+            words >> x >> y >> z;
+            positions.insert(positions.end(), { x, y, z });
+        }
+        else if (word == "f") {
+            std::string corner;
+            while (words >> corner) indices.push_back(static_cast<uint32_t>(std::stoul(corner) - 1));
+        }
+    }
+    triangles = indices.size() / 3;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool same(const mesh_buffers& a, const mesh_buffers& b, bool attributes) {
+    auto equal = [](const mesh_array<float>& x, const mesh_array<float>& y) {
+        return x.size() == y.size() && memcmp(x.data(), y.data(), x.size() * sizeof(float)) == 0;
+    };
+    return equal(a.positions, b.positions) && a.indices.size() == b.indices.size() &&
+           memcmp(a.indices.data(), b.indices.data(), a.indices.size() * sizeof(uint32_t)) == 0 &&
+           (!attributes || (equal(a.normals, b.normals) && equal(a.texcoords, b.texcoords)));
+}
+
+static void measure(const char* name, const std::string& path, const mesh_buffers& expected, bool attributes) {
+    int cores = static_cast<int>(std::thread::hardware_concurrency());
+    for (int threads : { 1, cores }) {
+        mesh_buffers mesh;
+        mesh_load_stats stats;
+        std::string error;
+        if (!load_mesh(path, mesh, error, threads, &stats)) {
+            printf("%s: %s\n", name, error.c_str());
+            return;
+        }
+        printf("%-30s %8.1f %8d %10.1f %6s %6s\n", name, stats.bytes / 1e6, stats.threads,
+               stats.megabytes_per_second(), stats.zero_copy ? "yes" : "no", same(mesh, expected, attributes) ? "yes" : "NO");
+        if (cores == 1) break;
+    }
+}
+
+int main(int argc, char** argv) {
+    int n = argc > 1 ? atoi(argv[1]) : 700;
+    const char* tmp = getenv("TMPDIR");
+    std::string dir = tmp ? tmp : "/tmp";
+
+    mesh_buffers grid = make_grid(n);
+    printf("%zu vertices, %zu triangles\n\n", grid.positions.size() / 3, grid.triangle_count());
+    write_obj(grid, dir + "/bench_mesh.obj");
+    write_ply(grid, dir + "/bench_mesh_ascii.ply", false, true);
+    write_ply(grid, dir + "/bench_mesh_positions.ply", true, false);
+    write_ply(grid, dir + "/bench_mesh_attributes.ply", true, true);
+    write_ply(grid, dir + "/bench_mesh_quads.ply", true, false, 3);
+
+    printf("%-30s %8s %8s %10s %6s %6s\n", "file", "MB", "threads", "MB/s", "mapped", "exact");
+    size_t triangles;
+    std::ifstream size_probe(dir + "/bench_mesh.obj", std::ios::ate | std::ios::binary);
+    double bytes = static_cast<double>(size_probe.tellg());
+    double seconds = load_obj_iostream(dir + "/bench_mesh.obj", triangles);
+    printf("%-30s %8.1f %8d %10.1f %6s %6s\n", "OBJ, iostream", bytes / 1e6, 1, bytes / seconds / 1e6, "no",
+           triangles == grid.triangle_count() ? "yes" : "NO");
+    measure("OBJ", dir + "/bench_mesh.obj", grid, true);
+    measure("PLY, ASCII", dir + "/bench_mesh_ascii.ply", grid, true);
+    measure("PLY, binary positions", dir + "/bench_mesh_positions.ply", grid, false);
+    measure("PLY, binary with attributes", dir + "/bench_mesh_attributes.ply", grid, true);
+    measure("PLY, binary, leading quads", dir + "/bench_mesh_quads.ply", with_leading_quads(grid, 3), false);
+
+    for (const char* file : { "/bench_mesh.obj", "/bench_mesh_ascii.ply", "/bench_mesh_positions.ply",
+                              "/bench_mesh_attributes.ply", "/bench_mesh_quads.ply" }) {
+        remove((dir + file).c_str());
+    }
+    return 0;
+}
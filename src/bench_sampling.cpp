@@ -0,0 +1,186 @@
+// Micro-benchmarks of the sampling routines in sampling.h against the rejection loops
+// and libm based mappings they replace, and of the batch versions. Also shows that the
+// closed-form mappings keep the stratification of low-discrepancy points.
+//
+//     make bench && ./bench_sampling
+
+#include "rtweekend.h"
+#include "sampling.h"
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+// Previous rejection sampling implementations, for reference
+static vector3d rejection_unit_disk() {
+    while (true) {
+        vector3d p = vector3d(random_double(-1, 1), random_double(-1, 1), 0);
+        if (p.length_squared() < 1) {
+            return p;
+        }
+    }
+}
+
+static vector3d rejection_unit_vector() {
+    while (true) {
+        vector3d p = vector3d::random(-1, 1);
+        if (p.length_squared() < 1) {
+            return unit_vector(p);
+        }
+    }
+}
+
+// Spherical coordinates through libm
+static vector3d libm_unit_vector(double u1, double u2) {
+    double z = 1 - 2 * u1;
+    double r = sqrt(fmax(0.0, 1 - z * z));
+    double phi = 2 * pi * u2;
+    return vector3d(r * cos(phi), r * sin(phi), z);
+}
+
+static volatile double sink;
+
+template<typename F>
+static double nanoseconds_per_sample(int n, F&& run) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / n;
+}
+
+// Integral of max(0, z)^2 over the sphere divided by 4 pi, exactly 1/6, from n uniform sphere samples
+static double sphere_estimate(const std::vector<double>& u1, const std::vector<double>& u2) {
+    double sum = 0;
+    for (size_t i = 0; i < u1.size(); i++) {
+        double x, y, z;
+        sample_unit_sphere(u1[i], u2[i], x, y, z);
+        sum += z > 0 ? z * z : 0;
+    }
+    return sum / u1.size();
+}
+
+int main() {
+    const int n = 1 << 22;
+    std::vector<double> u1(n), u2(n), x(n), y(n), z(n);
+    for (int i = 0; i < n; i++) {
+        u1[i] = random_double();
+        u2[i] = random_double();
+    }
+
+    printf("%-34s %10s\n", "routine", "ns/sample");
+
+    // Unit disk
+    double t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += rejection_unit_disk().x();
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "disk, rejection (with RNG)", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += random_in_unit_disk().x();
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "disk, concentric (with RNG)", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) {
+            double px, py;
+            sample_unit_disk(u1[i], u2[i], px, py);
+            s += px;
+        }
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "disk, concentric scalar", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        sample_unit_disk_batch(n, u1.data(), u2.data(), x.data(), y.data());
+        sink = x[n / 2];
+    });
+    printf("%-34s %10.2f\n\n", "disk, concentric batch", t);
+
+    // Unit sphere
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += rejection_unit_vector().x();
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "sphere, rejection (with RNG)", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += random_unit_vector().x();
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "sphere, closed form (with RNG)", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += libm_unit_vector(u1[i], u2[i]).x();
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "sphere, libm sin/cos scalar", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) {
+            double px, py, pz;
+            sample_unit_sphere(u1[i], u2[i], px, py, pz);
+            s += px;
+        }
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "sphere, closed form scalar", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        sample_unit_sphere_batch(n, u1.data(), u2.data(), x.data(), y.data(), z.data());
+        sink = x[n / 2];
+    });
+    printf("%-34s %10.2f\n", "sphere, closed form batch", t);
+
+    // Accuracy of the polynomial angles
+    double worst = 0;
+    for (int i = 0; i < n; i++) {
+        double length = sqrt(x[i] * x[i] + y[i] * y[i] + z[i] * z[i]);
+        worst = fmax(worst, fabs(length - 1));
+    }
+    printf("%-34s %10.2e\n\n", "sphere, largest |length - 1|", worst);
+
+    // Cosine weighted hemisphere
+    t = nanoseconds_per_sample(n, [&]() {
+        double s = 0;
+        for (int i = 0; i < n; i++) s += (vector3d(0, 0, 1) + rejection_unit_vector()).x();
+        sink = s;
+    });
+    printf("%-34s %10.2f\n", "cosine, normal + rejection", t);
+
+    t = nanoseconds_per_sample(n, [&]() {
+        sample_cosine_hemisphere_batch(n, u1.data(), u2.data(), x.data(), y.data(), z.data());
+        sink = x[n / 2];
+    });
+    printf("%-34s %10.2f\n\n", "cosine, Malley batch", t);
+
+    // Stratification: estimate a known integral with random and low-discrepancy points
+    const int m = 4096;
+    std::vector<double> a(m), b(m);
+    for (int i = 0; i < m; i++) {
+        a[i] = random_double();
+        b[i] = random_double();
+    }
+    double random_error = fabs(sphere_estimate(a, b) - 1.0 / 6);
+
+    // R2 sequence (Roberts), the plastic number generalization of the golden ratio
+    const double g = 1.32471795724474602596;
+    for (int i = 0; i < m; i++) {
+        a[i] = fmod(0.5 + (i + 1) / g, 1.0);
+        b[i] = fmod(0.5 + (i + 1) / (g * g), 1.0);
+    }
+    double r2_error = fabs(sphere_estimate(a, b) - 1.0 / 6);
+
+    printf("integral of max(0, z)^2 over the sphere, %d samples\n", m);
+    printf("  random points:  error %.2e\n", random_error);
+    printf("  R2 sequence:    error %.2e\n", r2_error);
+
+    return 0;
+}
@@ -0,0 +1,87 @@
+// Open time of scene files. Writes n random spheres and a few mesh instances, then opens
+// the file with and without checking it and traces some rays through the mapping.
+//
+//     make bench && ./bench_scenes [n]
+
+#include "rtweekend.h"
+#include "scene_file.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+static double seconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+static shared_ptr<mesh_buffers> make_box() {
+    auto box = make_shared<mesh_buffers>();
+    std::vector<float> positions;
+    for (int corner = 0; corner < 8; corner++) {
+        positions.insert(positions.end(), { float(corner & 1), float(corner >> 1 & 1), float(corner >> 2 & 1) });
+    }
+    box->positions = std::move(positions);
+    box->indices = { 0, 2, 1, 1, 2, 3, 4, 5, 6, 5, 7, 6, 0, 1, 4, 1, 5, 4,
+                     2, 6, 3, 3, 6, 7, 0, 4, 2, 2, 4, 6, 1, 3, 5, 3, 7, 5 };
+    return box;
+}
+
+int main(int argc, char** argv) {
+    long n = argc > 1 ? atol(argv[1]) : 1000000;
+    const char* tmp = getenv("TMPDIR");
+    std::string path = std::string(tmp ? tmp : "/tmp") + "/bench_scene.mrs";
+    std::string error;
+
+    scene_builder scene;
+    uint32_t materials[4] = { scene.add_lambertian(color(.7, .3, .3)), scene.add_metal(color(.8, .8, .8), 0.1),
+                              scene.add_dielectric(1.5), scene.add_lambertian(color(.3, .3, .7)) };
+    double extent = cbrt(static_cast<double>(n)) * 2;
+    for (long k = 0; k < n; k++) {
+        point3d center(random_double(-extent, extent), random_double(-extent, extent), random_double(-extent, extent));
+        scene.add_sphere(center, random_double(0.1, 0.5), materials[k & 3]);
+    }
+    uint32_t box = scene.add_mesh(make_box(), materials[0]);
+    for (int k = 0; k < 1000; k++) {
+        scene.add_instance(box, affine_transform::rotation(vector3d(0, 1, 0), k)
+                                    .then(affine_transform::translation(vector3d(random_double(-extent, extent), 0,
+                                                                                 random_double(-extent, extent)))));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!scene.write(path, error)) {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+    double write_seconds = seconds_since(start);
+    FILE* f = fopen(path.c_str(), "rb");
+    fseek(f, 0, SEEK_END);
+    long bytes = ftell(f);
+    fclose(f);
+    printf("%zu objects, %.1f MB, written in %.3f s\n\n", scene.object_count(), bytes / 1e6, write_seconds);
+
+    printf("%-12s %10s %12s\n", "open", "ms", "Mrays/s");
+    for (bool check : { true, false }) {
+        hittable_list world;
+        start = std::chrono::steady_clock::now();
+        if (!load_scene_file(path, world, error, check)) {
+            printf("%s\n", error.c_str());
+            return 1;
+        }
+        double open_seconds = seconds_since(start);
+
+        const int rays = 200000;
+        int hits = 0;
+        start = std::chrono::steady_clock::now();
+        for (int k = 0; k < rays; k++) {
+            hit_record rec;
+            ray r(point3d(0, 0, 0), random_unit_vector());
+            hits += world.hit(r, interval(0.001, infinity), rec);
+        }
+        double trace_seconds = seconds_since(start);
+        printf("%-12s %10.2f %12.2f   (%d hits)\n", check ? "checked" : "unchecked", open_seconds * 1e3,
+               rays / trace_seconds / 1e6, hits);
+    }
+
+    remove(path.c_str());
+    return 0;
+}
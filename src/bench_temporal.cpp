@@ -0,0 +1,94 @@
+// Error of temporal reprojection on a turntable of scene 1. Renders the frames with full
+// sampling and with temporal accumulation, with and without clipping the history, and
+// reports each against a reference of the same frame. The metal and glass spheres change
+// with the view, which is where an unclipped history leaves ghosts.
+//
+//     make bench && ./bench_temporal [frames]
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+#include "scene01.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// Mean squared error of the displayed (clamped) pixel values
+static double image_error(const camera& cam, const camera& reference) {
+    const framebuffer& image = cam.get_image();
+    const framebuffer& expected = reference.get_image();
+    double error = 0;
+
+    for (size_t p = 0; p < image.size(); p++) {
+        color a = image[p] / cam.samples_per_pixel;
+        color b = expected[p] / reference.samples_per_pixel;
+        for (int c = 0; c < 3; c++) {
+            double d = fmin(a[c], 1.0) - fmin(b[c], 1.0);
+            error += d * d;
+        }
+    }
+    return error / (3.0 * image.size());
+}
+
+static double render_seconds(camera& cam, const hittable& world) {
+    auto start = std::chrono::steady_clock::now();
+    cam.render(world);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char** argv) {
+    int frames = argc > 1 ? atoi(argv[1]) : 24;
+    hittable_list world = get_scene_01();
+
+    camera cam;
+    cam.image_width = 160;
+    cam.image_height = 90;
+    cam.samples_per_pixel = 16;
+    cam.max_depth = 8;
+    cam.vfov = 20;
+    cam.lookat = point3d(0, 0, 0);
+    cam.max_threads = std::thread::hardware_concurrency();
+    cam.progress = progress_mode::quiet;
+
+    // Two degrees per frame around the vertical axis
+    auto orbit = [](int frame, camera& frame_cam) {
+        double theta = atan2(3.0, 13.0) + frame * 0.0349066;
+        frame_cam.lookfrom = point3d(13.2 * cos(theta), 2, 13.2 * sin(theta));
+    };
+
+    const char* names[] = { "full", "temporal", "clipped" };
+    camera modes[3] = { cam, cam, cam };
+    modes[1].temporal = true;
+    modes[1].temporal_clip = 0;
+    modes[2].temporal = true;
+    double seconds[3] = { 0, 0, 0 };
+
+    printf("%d frames, %dx%d pixels, %d spp, %d threads\n\n", frames, cam.image_width, cam.image_height,
+           cam.samples_per_pixel, cam.max_threads);
+    printf("%6s %12s %12s %12s\n", "frame", names[0], names[1], names[2]);
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int m = 0; m < 3; m++) {
+            orbit(frame, modes[m]);
+            seconds[m] += render_seconds(modes[m], world);
+        }
+        if (frame % 4 != 3 && frame != frames - 1) {
+            continue;
+        }
+
+        camera reference = cam;
+        reference.samples_per_pixel = 256;
+        reference.seed = 1;
+        orbit(frame, reference);
+        reference.render(world);
+        printf("%6d %12.6f %12.6f %12.6f\n", frame, image_error(modes[0], reference), image_error(modes[1], reference),
+               image_error(modes[2], reference));
+    }
+
+    printf("%6s %11.2fs %11.2fs %11.2fs\n", "time", seconds[0], seconds[1], seconds[2]);
+    return 0;
+}
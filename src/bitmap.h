@@ -0,0 +1,100 @@
+#ifndef BITMAP_H
+#define BITMAP_H
+
+#include "color.h"
+#include "framebuffer.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Gamma correct an accumulated image into a bitmap friendly format [b,g,r, b,g,r, ... ,b,g,r]
+inline std::vector<unsigned char> to_bitmap_data(const framebuffer& image, int samples_per_pixel)
+{
+    std::vector<unsigned char> bitmap_data;
+    bitmap_data.reserve(3 * image.size());
+
+    for (size_t i = 0; i < image.size(); i++)
+    {
+        // Get ith pixel from image
+        color pixel_color = image[i];
+
+        // Apply gamma correction
+        pixel_color = gamma_correction(pixel_color, samples_per_pixel);
+
+        // Push pixel into bitmap data
+        bitmap_data.push_back((unsigned char)(pixel_color.z() * 255)); // Blue
+        bitmap_data.push_back((unsigned char)(pixel_color.y() * 255)); // Green
+        bitmap_data.push_back((unsigned char)(pixel_color.x() * 255)); // Red
+    }
+
+    return bitmap_data;
+}
+
+// Encode bitmap data as a 24 bit BMP file held in memory
+inline std::vector<unsigned char> encode_bmp(const std::vector<unsigned char>& bitmap_data, int image_width, int image_height)
+{
+    // Define file size and row padding
+    int row_padding = (4 - (image_width * 3) % 4) % 4;
+    int file_size = 54 + (3 * image_width + row_padding) * image_height;
+
+    // Define bitmap headers and info
+    unsigned char bmp_header[14] = {
+        'B','M',  // Mime type
+        0,0,0,0,  // Size in bytes
+        0,0,0,0,  // App data
+        54,0,0,0  // Data offset start
+    };
+    unsigned char bmp_info[40] = {
+        40,0,0,0, // Info HD size
+        0,0,0,0,  // Width
+        0,0,0,0,  // Height
+        1,0,      // # color planes
+        24,0      // Bits per pixel
+    };
+
+    // Set headers and info
+    bmp_header[2] = (unsigned char)(file_size);
+    bmp_header[3] = (unsigned char)(file_size >> 8);
+    bmp_header[4] = (unsigned char)(file_size >> 16);
+    bmp_header[5] = (unsigned char)(file_size >> 24);
+
+    bmp_info[4] = (unsigned char)(image_width);
+    bmp_info[5] = (unsigned char)(image_width >> 8);
+    bmp_info[6] = (unsigned char)(image_width >> 16);
+    bmp_info[7] = (unsigned char)(image_width >> 24);
+
+    bmp_info[8] = (unsigned char)(image_height);
+    bmp_info[9] = (unsigned char)(image_height >> 8);
+    bmp_info[10] = (unsigned char)(image_height >> 16);
+    bmp_info[11] = (unsigned char)(image_height >> 24);
+
+    std::vector<unsigned char> encoded;
+    encoded.reserve(file_size);
+    encoded.insert(encoded.end(), bmp_header, bmp_header + 14);
+    encoded.insert(encoded.end(), bmp_info, bmp_info + 40);
+
+    // Rows are stored bottom to top, each padded to a multiple of 4 bytes
+    for (int i = 0; i < image_height; i++)
+    {
+        const unsigned char* row = &bitmap_data[0] + (image_width * (image_height - i - 1) * 3);
+        encoded.insert(encoded.end(), row, row + 3 * image_width);
+        encoded.insert(encoded.end(), row_padding, 0);
+    }
+
+    return encoded;
+}
+
+// Write an encoded file to disk, returns false on failure
+inline bool write_file(const std::string& filename, const std::vector<unsigned char>& data)
+{
+    FILE* f = fopen(filename.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    size_t written = fwrite(data.data(), 1, data.size(), f);
+    return fclose(f) == 0 && written == data.size();
+}
+
+#endif
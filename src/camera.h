@@ -2,14 +2,28 @@
 #define CAMERA_H
 
 #include "rtweekend.h"
+#include "bitmap.h"
+#include "checkpoint.h"
 #include "color.h"
+#include "environment.h"
+#include "framebuffer.h"
 #include "hittable.h"
+#include "hittable_list.h"
 #include "material.h"
+#include "progress.h"
+#include "tile.h"
+#include "topology.h"
 
+#include <atomic>
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 class camera {
   private:
@@ -17,11 +31,32 @@ class camera {
     point3d pixel00_loc;    // Location of pixel 0, 0
     vector3d pixel_delta_u; // Offset to pixel to the right
     vector3d pixel_delta_v; // Offset to pixel below
+    double pixel_spread;    // Angle covered by a pixel, the spread of camera ray cones
     vector3d u, v, w;       // Camera frame basis vectors
     vector3d defocus_disk_u; // Defocus disk horizontal radius
     vector3d defocus_disk_v; // Defocus disk vertical radius
-    std::vector<color> image;// Image result
-    std::vector<int> render_progress; // Vector to keep track of the number of rows rendered by each thread
+    framebuffer image;       // Image result
+
+    std::vector<tile> tiles;                 // Tiles of the image, row by row
+    std::vector<uint64_t> tile_random_state; // Random generator state of each tile between passes
+    std::vector<uint32_t> sample_counts;     // Samples accumulated in each pixel
+    bool complete = false;                   // Whether the last render reached samples_per_pixel
+
+    // Previous frame, kept for temporal reprojection
+    struct frame_history {
+        bool valid = false;
+        uint64_t frames = 0;         // Frames rendered so far, decorrelates the fresh samples of each frame
+        point3d center;
+        point3d pixel00_loc;
+        vector3d pixel_delta_u;
+        vector3d pixel_delta_v;
+        vector3d w;
+        framebuffer radiance;        // Mean radiance per pixel
+        std::vector<double> depth;   // Distance from the camera center to the primary hit, infinity for the sky
+        std::vector<uint32_t> weight;// Samples behind each pixel's radiance
+    };
+    frame_history history;
+    std::vector<double> primary_depth; // Primary hit distance of the current frame
 
     void initialize() {
         // Setup viewport
@@ -43,6 +78,7 @@ class camera {
         // Calculate the horizontal and vertical delta vectors from pixel to pixel
         pixel_delta_u = viewport_u / image_width;
         pixel_delta_v = viewport_v / image_height;
+        pixel_spread = pixel_delta_u.length() / focus_dist;
 
         // Calculate the location of the upper left pixel
         point3d viewport_upper_left = center - (focus_dist * w) -  viewport_u / 2 -  viewport_v / 2;
@@ -53,19 +89,155 @@ class camera {
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
 
-        // Initialize output image
-        image.resize(image_height * image_width);
-        std::fill(image.begin(), image.end(), color(0, 0, 0));
-
-        // Initialize render progress vector
-        render_progress.resize(max_threads);
-        std::fill(render_progress.begin(), render_progress.end(), 0);
+        // Allocate output image, every pixel is written by the thread whose tile covers it
+        image.resize(image_width, image_height);
 
         // Ensure there is at least one thread for rendering the scene
         max_threads = max_threads > 0 ? max_threads : 1;
+        tile_size = tile_size > 0 ? tile_size : 1;
+
+        // Split the image into tiles, each one with its own random sequence
+        tiles = split_into_tiles(image_width, 0, image_height, tile_size);
+        tile_random_state.resize(tiles.size());
+        for (size_t k = 0; k < tiles.size(); k++) {
+            tile_random_state[k] = mix_bits(seed ^ mix_bits(k + 1));
+        }
+
+        sample_counts.assign(image.size(), 0);
+        complete = false;
+    }
+
+    bool cancelled() const {
+        return cancel_flag && cancel_flag->load(std::memory_order_relaxed);
+    }
+
+    int tile_samples(const tile& t) const {
+        return sample_counts[static_cast<size_t>(t.y0) * image_width + t.x0];
+    }
+
+    // Describes this render, a checkpoint is only resumed if everything matches
+    checkpoint_header make_checkpoint_header() const {
+        checkpoint_header header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "MRAYCKPT", 8);
+        header.version = checkpoint_header::current_version;
+        header.image_width = image_width;
+        header.image_height = image_height;
+        header.samples_per_pixel = samples_per_pixel;
+        header.samples_per_pass = samples_per_pass;
+        header.tile_size = tile_size;
+        header.seed = seed;
+        header.tile_count = static_cast<uint32_t>(tiles.size());
+
+        double settings[] = {
+            vfov, defocus_angle, focus_dist, static_cast<double>(max_depth), deterministic ? 1.0 : 0.0,
+            lights ? 1.0 : 0.0, sky ? 1.0 : 0.0, background.x(), background.y(), background.z(),
+            environment ? environment->scale : 0.0,
+            lookfrom.x(), lookfrom.y(), lookfrom.z(),
+            lookat.x(), lookat.y(), lookat.z(),
+            vup.x(), vup.y(), vup.z()
+        };
+        uint64_t hash = 0;
+        for (double value : settings) {
+            uint64_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            hash = mix_bits(hash ^ bits);
+        }
+
+        // A different map at the same scale lights the scene differently
+        if (environment) {
+            for (unsigned char c : environment->path()) {
+                hash = mix_bits(hash ^ c);
+            }
+        }
+        hash = mix_bits(hash ^ scene_hash);
+        header.settings_hash = hash;
+
+        return header;
+    }
+
+    bool save_checkpoint() const {
+        return write_checkpoint(checkpoint_file, make_checkpoint_header(), tile_random_state, sample_counts,
+                                reinterpret_cast<const double*>(image.data()));
+    }
+
+    bool load_checkpoint() {
+        return read_checkpoint(checkpoint_file, make_checkpoint_header(), tile_random_state, sample_counts,
+                               reinterpret_cast<double*>(image.data()));
+    }
+
+    // Multiple importance sampling weight of a strategy with density pdf against one with other_pdf
+    static double power_heuristic(double pdf, double other_pdf) {
+        double a = pdf * pdf;
+        double b = other_pdf * other_pdf;
+        return a / (a + b);
+    }
+
+    color background_color(const ray& r) const {
+        if (environment) {
+            return environment->value(r.direction());
+        }
+        if (!sky) {
+            return background;
+        }
+
+        vector3d unit_direction = unit_vector(r.direction());
+        double a = 0.5 * (unit_direction.y() + 1.0);
+        return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
+    }
+
+    // Light arriving at a non-specular hit straight from a sampled point on the lights,
+    // weighted against finding the same light by scattering
+    color direct_light(const ray& r_in, const hit_record& rec, const hittable& world, bool can_scatter, long long& rays) const {
+        vector3d direction = lights->random(rec.p);
+        if (direction.length_squared() == 0) {
+            return color(0, 0, 0); // Nothing to sample from here
+        }
+
+        ray shadow(rec.p, direction);
+        double light_pdf = lights->pdf_value(shadow.origin(), shadow.direction());
+        color bsdf = rec.mat->scattering(r_in, rec, shadow);
+        if (light_pdf <= 0 || (bsdf[0] <= 0 && bsdf[1] <= 0 && bsdf[2] <= 0)) {
+            return color(0, 0, 0);
+        }
+
+        rays++;
+        hit_record light_rec;
+        if (!world.hit_surface(shadow, interval(0.001, infinity), light_rec)) {
+            return color(0, 0, 0);
+        }
+        double visible = world.transmittance(shadow, interval(0.001, light_rec.t));
+
+        // The last bounce has no scattered ray to share the light with
+        double weight = can_scatter ? power_heuristic(light_pdf, rec.mat->scattering_pdf(r_in, rec, shadow)) : 1.0;
+        return (visible * weight / light_pdf) * bsdf * light_rec.mat->emitted(shadow, light_rec);
+    }
+
+    // Light arriving at a non-specular hit from a direction sampled on the environment map
+    color direct_environment(const ray& r_in, const hit_record& rec, const hittable& world, bool can_scatter, long long& rays) const {
+        ray shadow(rec.p, environment->random());
+        double environment_pdf = environment->pdf_value(shadow.direction());
+        color bsdf = rec.mat->scattering(r_in, rec, shadow);
+        if (environment_pdf <= 0 || (bsdf[0] <= 0 && bsdf[1] <= 0 && bsdf[2] <= 0)) {
+            return color(0, 0, 0);
+        }
+
+        rays++;
+        hit_record blocker;
+        if (world.hit_surface(shadow, interval(0.001, infinity), blocker)) {
+            return color(0, 0, 0);
+        }
+        double visible = world.transmittance(shadow, interval(0.001, infinity));
+
+        double weight = can_scatter ? power_heuristic(environment_pdf, rec.mat->scattering_pdf(r_in, rec, shadow)) : 1.0;
+        return (visible * weight / environment_pdf) * bsdf * environment->value(shadow.direction());
     }
 
-    color ray_color(const ray& r, int depth, const hittable& world) const {
+    // Radiance along r. first_hit, if given, holds every object r can hit first and
+    // replaces the world for the first intersection only. scatter_pdf is the density
+    // with which the previous hit scattered into r, zero for camera rays and specular bounces.
+    color ray_color(const ray& r, int depth, const hittable& world, long long& rays, const hittable* first_hit = nullptr,
+                    double scatter_pdf = 0.0) const {
         hit_record rec;
 
         // Return early if no more light bounces are allowed
@@ -73,19 +245,44 @@ class camera {
             return color(0, 0, 0);
         }
 
-        if (world.hit(r, interval(0.001, infinity), rec)) {
+        rays++;
+        const hittable& scene = first_hit ? *first_hit : world;
+        if (scene.hit(r, interval(0.001, infinity), rec)) {
+            color emitted = rec.mat->emitted(r, rec);
+
+            // Lights found by scattering share their contribution with direct_light()
+            if (scatter_pdf > 0 && lights && rec.mat->is_emissive()) {
+                emitted = power_heuristic(scatter_pdf, lights->pdf_value(r.origin(), r.direction())) * emitted;
+            }
+
             ray scattered;
             color attenuation;
 
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_color(scattered, depth-1, world);
-            
-            return color(0,0,0);
+            if (!rec.mat->scatter(r, rec, attenuation, scattered))
+                return emitted;
+
+            // Carry the ray cone on. Diffuse bounces widen it to roughly the lobe's
+            // width, so textures seen through them are read from coarse mip levels.
+            const double diffuse_spread = 0.2;
+            double pdf = rec.mat->scattering_pdf(r, rec, scattered);
+            scattered = ray(scattered.origin(), scattered.direction(), r.footprint(rec.t),
+                            pdf > 0 ? fmax(r.spread(), diffuse_spread) : r.spread());
+            if (lights && pdf > 0) {
+                emitted += direct_light(r, rec, world, depth > 1, rays);
+            }
+            if (environment && pdf > 0) {
+                emitted += direct_environment(r, rec, world, depth > 1, rays);
+            }
+
+            return emitted + attenuation * ray_color(scattered, depth-1, world, rays, nullptr, pdf);
         }
 
-        vector3d unit_direction = unit_vector(r.direction());
-        double a = 0.5 * (unit_direction.y() + 1.0);
-        return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
+        // The environment found by scattering shares its contribution with direct_environment()
+        color radiance = background_color(r);
+        if (environment && scatter_pdf > 0) {
+            radiance = power_heuristic(scatter_pdf, environment->pdf_value(r.direction())) * radiance;
+        }
+        return radiance;
     }
 
     // Get a randomly sampled camera ray for the pixel location i, j
@@ -97,7 +294,42 @@ class camera {
         vector3d ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
         vector3d ray_direction = pixel_sample - ray_origin;
 
-        return ray(ray_origin, ray_direction);
+        return ray(ray_origin, ray_direction, 0.0, pixel_spread);
+    }
+
+    // Get a randomly sampled camera ray for the scale x scale block of pixels
+    // whose top left pixel is (i * scale, j * scale)
+    ray get_block_ray(int i, int j, int scale) const {
+        double px = i * scale + 0.5 + scale * random_double();
+        double py = j * scale + 0.5 + scale * random_double();
+        point3d pixel_sample = pixel00_loc + (px * pixel_delta_u) + (py * pixel_delta_v);
+
+        vector3d ray_origin = (defocus_angle <= 0) ? center : defocus_disk_sample();
+        return ray(ray_origin, pixel_sample - ray_origin, 0.0, scale * pixel_spread);
+    }
+
+    // Bilinearly upsample a low resolution preview to the full image size
+    void upsample_preview(const framebuffer& low, int scale, framebuffer& out) const {
+        out.resize(image_width, image_height);
+        for (int y = 0; y < image_height; y++) {
+            double fy = (y + 0.5) / scale - 0.5;
+            fy = fy < 0 ? 0 : (fy > low.height() - 1 ? low.height() - 1 : fy);
+            int y0 = static_cast<int>(fy);
+            int y1 = y0 + 1 < low.height() ? y0 + 1 : y0;
+            double ty = fy - y0;
+
+            for (int x = 0; x < image_width; x++) {
+                double fx = (x + 0.5) / scale - 0.5;
+                fx = fx < 0 ? 0 : (fx > low.width() - 1 ? low.width() - 1 : fx);
+                int x0 = static_cast<int>(fx);
+                int x1 = x0 + 1 < low.width() ? x0 + 1 : x0;
+                double tx = fx - x0;
+
+                color top    = (1 - tx) * low[static_cast<size_t>(y0) * low.width() + x0] + tx * low[static_cast<size_t>(y0) * low.width() + x1];
+                color bottom = (1 - tx) * low[static_cast<size_t>(y1) * low.width() + x0] + tx * low[static_cast<size_t>(y1) * low.width() + x1];
+                out[static_cast<size_t>(y) * image_width + x] = (1 - ty) * top + ty * bottom;
+            }
+        }
     }
 
     // Returns a random point in the camera defocus disk
@@ -112,41 +344,419 @@ class camera {
         return (px * pixel_delta_u) + (py * pixel_delta_v);
     }
 
-    void render_thread(const hittable& world, int threadId, int minRow, int maxRow) {
-        for (int j = minRow; j < maxRow; j++) {
-            for (int i = 0; i < image_width; i++) {
-                // Take random samples for each pixel
-                for (int sample = 0; sample < samples_per_pixel; sample++) {
-                    ray r = get_ray(i, j);
-                    image[j * image_width + i] += ray_color(r, max_depth, world);
+    // Objects a camera ray through tile t may hit first: those whose bounds overlap the
+    // frustum from the camera center through the tile. Only a pinhole camera has a single
+    // origin for all rays, returns false if the cache does not apply.
+    bool primary_candidates(const hittable& world, const tile& t, hittable_list& candidates) const {
+        const hittable_list* list = dynamic_cast<const hittable_list*>(&world);
+        if (!primary_hit_cache || defocus_angle > 0 || !list) {
+            return false;
+        }
+
+        // Corners of the area sampled by the tile's pixels, see pixel_sample_square()
+        point3d corners[4] = {
+            pixel00_loc + (t.x0 + 0.5) * pixel_delta_u + (t.y0 + 0.5) * pixel_delta_v,
+            pixel00_loc + (t.x1 + 0.5) * pixel_delta_u + (t.y0 + 0.5) * pixel_delta_v,
+            pixel00_loc + (t.x1 + 0.5) * pixel_delta_u + (t.y1 + 0.5) * pixel_delta_v,
+            pixel00_loc + (t.x0 + 0.5) * pixel_delta_u + (t.y1 + 0.5) * pixel_delta_v,
+        };
+        point3d middle = 0.25 * (corners[0] + corners[1] + corners[2] + corners[3]);
+
+        // Side planes of the frustum, normals pointing inwards
+        vector3d normals[4];
+        for (int e = 0; e < 4; e++) {
+            vector3d n = unit_vector(cross(corners[e] - center, corners[(e + 1) % 4] - center));
+            normals[e] = dot(n, middle - center) < 0 ? -n : n;
+        }
+
+        candidates.clear();
+        for (const auto& object : list->objects) {
+            aabb box = object->bounding_box();
+            bool inside = true;
+
+            if (box.is_bounded()) {
+                // Test the sphere around the box against each side plane
+                point3d box_center = box.centroid();
+                double radius = 0.5 * sqrt(box.x.size() * box.x.size() + box.y.size() * box.y.size() + box.z.size() * box.z.size());
+                double margin = 1e-9 * (radius + (box_center - center).length());
+                for (int e = 0; e < 4 && inside; e++) {
+                    inside = dot(normals[e], box_center - center) >= -(radius + margin);
                 }
             }
-            render_progress[threadId] += 1;
+
+            if (inside && !box.is_empty()) {
+                candidates.add(object);
+            }
+        }
+        return true;
+    }
+
+    // Sum of samples [first_sample, first_sample + sample_count) of pixel i, j.
+    // first_hit optionally narrows the first intersection, see primary_candidates().
+    color sample_pixel(const hittable& world, int i, int j, int first_sample, int sample_count, long long& rays,
+                       const hittable* first_hit = nullptr) const {
+        color pixel_color(0, 0, 0);
+        uint64_t pixel_seed = mix_bits(seed ^ mix_bits(static_cast<uint64_t>(j) * image_width + i + 1));
+
+        // Take random samples for each pixel
+        for (int sample = first_sample; sample < first_sample + sample_count; sample++) {
+            // Every dimension of the sample draws hash(seed, pixel, sample, dimension)
+            if (deterministic) {
+                random_state() = mix_bits(pixel_seed + static_cast<uint64_t>(sample));
+            }
+
+            ray r = get_ray(i, j);
+            pixel_color += ray_color(r, max_depth, world, rays, first_hit);
         }
+
+        return pixel_color;
     }
 
-    void print_render_progress() {
-        std::clog << "\nRendering scene with " << max_threads << " threads at " << image_width << "x" << image_height << " pixels\n\n" << std::flush;
-        int percent = 0;
-        int lastPercent = -1;
-        int rawProgress = 0;
-        while (percent < 100) {
-            for (int& n : render_progress) {
-                rawProgress += n;
+    // Add samples [first_sample, first_sample + sample_count) to every pixel of a tile
+    long long trace_tile(const hittable& world, const tile& t, int first_sample, int sample_count, std::vector<color>& accumulator) const {
+        long long rays = 0;
+
+        hittable_list candidates;
+        const hittable* first_hit = primary_candidates(world, t, candidates) ? &candidates : nullptr;
+
+        for (int j = t.y0; j < t.y1; j++) {
+            for (int i = t.x0; i < t.x1; i++) {
+                accumulator[(j - t.y0) * t.width() + (i - t.x0)] += sample_pixel(world, i, j, first_sample, sample_count, rays, first_hit);
             }
+        }
 
-            percent = (double)(rawProgress) / image_height * 100;
+        return rays;
+    }
 
-            // Print progress only if it has changed
-            if (percent != lastPercent) {
-                lastPercent = percent;
-                std::clog << "\rRendering: " << percent << "% " << std::flush;
+    // Add a tile's samples to those already in the image
+    void accumulate_tile(const tile& t, const std::vector<color>& accumulator, int sample_count) {
+        for (int j = t.y0; j < t.y1; j++) {
+            size_t row = static_cast<size_t>(j) * image_width;
+            for (int i = t.x0; i < t.x1; i++) {
+                image[row + i] += accumulator[(j - t.y0) * t.width() + (i - t.x0)];
+                sample_counts[row + i] += sample_count;
             }
+        }
+    }
+
+    // Distance from the camera center to the surface seen through the middle of pixel i, j
+    double primary_hit_depth(const hittable& world, int i, int j) const {
+        point3d pixel_middle = pixel00_loc + ((i + 1.0) * pixel_delta_u) + ((j + 1.0) * pixel_delta_v);
+        vector3d direction = unit_vector(pixel_middle - center);
 
-            rawProgress = 0;
+        hit_record rec;
+        if (world.hit(ray(center, direction), interval(0.001, infinity), rec)) {
+            return rec.t;
+        }
+        return infinity;
+    }
+
+    // Find the previous frame pixel that saw the surface at depth along the middle ray of pixel i, j.
+    // Returns its index, or -1 if it was off screen or hidden behind something else. x and y
+    // receive the exact position in the previous frame, pixel middles at whole numbers.
+    long long reproject(int i, int j, double depth, double& x, double& y) const {
+        point3d pixel_middle = pixel00_loc + ((i + 1.0) * pixel_delta_u) + ((j + 1.0) * pixel_delta_v);
+        vector3d direction = unit_vector(pixel_middle - center);
+
+        // Points at infinity (the sky) reproject by direction alone
+        bool sky = depth == infinity;
+        vector3d to_point = sky ? direction : (center + depth * direction) - history.center;
+
+        // Intersect the line from the previous center with its viewport plane
+        double along = dot(to_point, -history.w);
+        if (along <= 0) {
+            return -1;
+        }
+        double plane_distance = dot(history.pixel00_loc - history.center, -history.w);
+        point3d on_plane = history.center + (plane_distance / along) * to_point;
+
+        x = dot(on_plane - history.pixel00_loc, history.pixel_delta_u) / history.pixel_delta_u.length_squared() - 1;
+        y = dot(on_plane - history.pixel00_loc, history.pixel_delta_v) / history.pixel_delta_v.length_squared() - 1;
+        int pi = static_cast<int>(std::floor(x + 0.5));
+        int pj = static_cast<int>(std::floor(y + 0.5));
+        if (pi < 0 || pj < 0 || pi >= image_width || pj >= image_height) {
+            return -1;
+        }
+
+        // The previous frame must have seen this same surface, not an occluder or the sky
+        long long index = static_cast<long long>(pj) * image_width + pi;
+        double previous_depth = history.depth[index];
+        if (sky || previous_depth == infinity) {
+            return (sky && previous_depth == infinity) ? index : -1;
+        }
+
+        double expected_depth = to_point.length();
+        if (std::fabs(previous_depth - expected_depth) > temporal_depth_tolerance * expected_depth) {
+            return -1;
+        }
+        return index;
+    }
+
+    // History radiance at x, y, interpolated between the four nearest pixels that saw the
+    // same surface as source. Taking the nearest pixel alone shifts the image by up to half a
+    // pixel each frame, which adds up to a smear over a long history.
+    color resample_history(long long source, double x, double y) const {
+        int x0 = static_cast<int>(std::floor(x));
+        int y0 = static_cast<int>(std::floor(y));
+        double tx = x - x0;
+        double ty = y - y0;
+        double source_depth = history.depth[source];
+
+        color sum(0, 0, 0);
+        double total = 0;
+        for (int dy = 0; dy < 2; dy++) {
+            for (int dx = 0; dx < 2; dx++) {
+                int px = x0 + dx;
+                int py = y0 + dy;
+                if (px < 0 || py < 0 || px >= image_width || py >= image_height) {
+                    continue;
+                }
+                size_t q = static_cast<size_t>(py) * image_width + px;
+                double depth = history.depth[q];
+                bool same = depth == infinity || source_depth == infinity
+                                ? depth == source_depth
+                                : std::fabs(depth - source_depth) <= temporal_depth_tolerance * source_depth;
+                if (same) {
+                    double weight = (dx ? tx : 1 - tx) * (dy ? ty : 1 - ty);
+                    sum += weight * history.radiance[q];
+                    total += weight;
+                }
+            }
+        }
+        return total > 0 ? sum / total : history.radiance[source];
+    }
+
+    // Clip a history radiance to the mean plus or minus temporal_clip standard deviations of
+    // the fresh radiance in the 3x3 pixels around i, j (variance clipping, Salvi 2016)
+    color clip_history(color previous, const framebuffer& fresh_radiance, int i, int j) const {
+        if (temporal_clip <= 0) {
+            return previous;
+        }
+
+        color mean(0, 0, 0);
+        color square(0, 0, 0);
+        int n = 0;
+        for (int y = std::max(j - 1, 0); y <= std::min(j + 1, image_height - 1); y++) {
+            for (int x = std::max(i - 1, 0); x <= std::min(i + 1, image_width - 1); x++) {
+                color c = fresh_radiance[static_cast<size_t>(y) * image_width + x];
+                mean += c;
+                square += c * c;
+                n++;
+            }
+        }
+        mean /= n;
+        square /= n;
+
+        for (int a = 0; a < 3; a++) {
+            double spread = temporal_clip * std::sqrt(std::max(0.0, square[a] - mean[a] * mean[a]));
+            previous[a] = std::min(std::max(previous[a], mean[a] - spread), mean[a] + spread);
+        }
+        return previous;
+    }
+
+    // Temporal accumulation. Each pixel reuses the reprojected radiance of the previous frame,
+    // capped at temporal_max_history samples, and adds fresh samples: temporal_samples where the
+    // history is valid and confident, enough to reach samples_per_pixel elsewhere.
+    void render_temporal(const hittable& world) {
+        bool have_history = history.valid && history.radiance.width() == image_width && history.radiance.height() == image_height;
+        primary_depth.assign(image.size(), infinity);
+        std::vector<long long> source(image.size(), -1);
+        std::vector<double> source_x(image.size()), source_y(image.size());
+        // Every pixel traces at least one fresh sample, its mean and blend weight divide by them
+        int least_fresh = std::max(temporal_samples, 1);
+        std::vector<int> fresh(image.size(), std::max(samples_per_pixel, least_fresh));
+
+        // First pass: primary depth, reprojection and sample budget of every pixel
+        std::atomic<size_t> next_tile(0);
+        std::atomic<long long> total_fresh(0);
+        auto classify = [&]() {
+            for (size_t k = next_tile++; k < tiles.size(); k = next_tile++) {
+                const tile& t = tiles[k];
+                long long tile_fresh = 0;
+                for (int j = t.y0; j < t.y1; j++) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        size_t p = static_cast<size_t>(j) * image_width + i;
+                        primary_depth[p] = primary_hit_depth(world, i, j);
+
+                        if (have_history) {
+                            source[p] = reproject(i, j, primary_depth[p], source_x[p], source_y[p]);
+                        }
+                        if (source[p] >= 0) {
+                            int weight = static_cast<int>(history.weight[source[p]]);
+                            weight = weight < temporal_max_history ? weight : temporal_max_history;
+                            fresh[p] = samples_per_pixel - weight > least_fresh ? samples_per_pixel - weight : least_fresh;
+                        }
+                        tile_fresh += fresh[p];
+                    }
+                }
+                total_fresh += tile_fresh;
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < max_threads; i++) {
+            threads.push_back(std::thread(classify));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+
+        progress_reporter reporter(progress, max_threads, total_fresh, progress_interval);
+        reporter.start();
+
+        // Second pass: the mean of each pixel's fresh samples
+        framebuffer fresh_radiance;
+        fresh_radiance.resize(image_width, image_height);
+        next_tile = 0;
+        auto shade = [&](int threadId) {
+            for (size_t k = next_tile++; k < tiles.size(); k = next_tile++) {
+                const tile& t = tiles[k];
+                long long rays = 0;
+                long long samples = 0;
+                random_state() = mix_bits(tile_random_state[k] + history.frames);
+
+                hittable_list candidates;
+                const hittable* first_hit = primary_candidates(world, t, candidates) ? &candidates : nullptr;
+
+                for (int j = t.y0; j < t.y1; j++) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        size_t p = static_cast<size_t>(j) * image_width + i;
+                        int first_sample = source[p] >= 0 ? static_cast<int>(history.weight[source[p]]) : 0;
+                        first_sample = first_sample < temporal_max_history ? first_sample : temporal_max_history;
+                        fresh_radiance[p] = sample_pixel(world, i, j, first_sample, fresh[p], rays, first_hit) / fresh[p];
+                        samples += fresh[p];
+                    }
+                }
+
+                reporter.add(threadId, samples, rays);
+            }
+        };
+
+        for (int i = 0; i < max_threads; i++) {
+            threads.push_back(std::thread(shade, i));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+
+        // Third pass: fresh samples blended with the history. The history is clipped to the
+        // spread of the fresh samples around the pixel first, so radiance that moved or
+        // changed (moving shadows, reflections, lights) does not linger as a ghost. The image
+        // is stored scaled so that dividing by samples_per_pixel gives the mean, like a
+        // regular render.
+        next_tile = 0;
+        auto blend = [&]() {
+            for (size_t k = next_tile++; k < tiles.size(); k = next_tile++) {
+                const tile& t = tiles[k];
+                for (int j = t.y0; j < t.y1; j++) {
+                    for (int i = t.x0; i < t.x1; i++) {
+                        size_t p = static_cast<size_t>(j) * image_width + i;
+                        int weight = 0;
+                        color sum = fresh[p] * fresh_radiance[p];
+
+                        if (source[p] >= 0) {
+                            weight = static_cast<int>(history.weight[source[p]]);
+                            weight = weight < temporal_max_history ? weight : temporal_max_history;
+                            color previous = resample_history(source[p], source_x[p], source_y[p]);
+                            sum += weight * clip_history(previous, fresh_radiance, i, j);
+                        }
+
+                        image[p] = (static_cast<double>(samples_per_pixel) / (weight + fresh[p])) * sum;
+                        sample_counts[p] = weight + fresh[p];
+                    }
+                }
+
+                if (on_tile_complete) {
+                    on_tile_complete(t);
+                }
+            }
+        };
+
+        for (int i = 0; i < max_threads; i++) {
+            threads.push_back(std::thread(blend));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        reporter.stop();
+
+        // Keep this frame as the history of the next one
+        history.valid = true;
+        history.frames++;
+        history.center = center;
+        history.pixel00_loc = pixel00_loc;
+        history.pixel_delta_u = pixel_delta_u;
+        history.pixel_delta_v = pixel_delta_v;
+        history.w = w;
+        history.radiance.resize(image_width, image_height);
+        for (size_t p = 0; p < image.size(); p++) {
+            history.radiance[p] = image[p] / samples_per_pixel;
+        }
+        history.depth.swap(primary_depth);
+        history.weight = sample_counts;
+
+        complete = true;
+    }
+
+    void render_thread(const hittable& world, progress_reporter& progress, std::vector<int> cpus, int threadId,
+                       size_t first_tile, size_t last_tile, std::atomic<bool>& stop,
+                       std::chrono::steady_clock::time_point checkpoint_due) {
+        // Pin before touching memory so the tiles land on this thread's NUMA node.
+        // Every pixel is first written by the thread that owns its tile.
+        if (!cpus.empty()) {
+            pin_current_thread(cpus);
+        }
+
+        int pass = samples_per_pass > 0 ? samples_per_pass : samples_per_pixel;
+        std::vector<color> accumulator;
+
+        // Add one pass of samples to each unfinished tile until every tile is done
+        bool unfinished = true;
+        while (unfinished) {
+            unfinished = false;
+
+            for (size_t k = first_tile; k < last_tile; k++) {
+                const tile& t = tiles[k];
+                int samples = tile_samples(t);
+                if (samples >= samples_per_pixel) {
+                    continue;
+                }
+
+                // Stop between tiles when cancelled or to write a checkpoint
+                if (cancelled() || (!checkpoint_file.empty() && (checkpoint_signal_received() ||
+                                                                 std::chrono::steady_clock::now() >= checkpoint_due))) {
+                    stop = true;
+                }
+                if (stop.load(std::memory_order_relaxed)) {
+                    return;
+                }
+
+                int sample_count = samples_per_pixel - samples < pass ? samples_per_pixel - samples : pass;
+                accumulator.assign(t.pixel_count(), color(0, 0, 0));
+
+                random_state() = tile_random_state[k];
+                long long rays = trace_tile(world, t, samples, sample_count, accumulator);
+                tile_random_state[k] = random_state();
+
+                if (samples == 0) {
+                    commit_tile(t, accumulator, sample_count);
+                }
+                else {
+                    accumulate_tile(t, accumulator, sample_count);
+                }
+
+                progress.add(threadId, static_cast<long long>(t.pixel_count()) * sample_count, rays);
+                if (samples + sample_count < samples_per_pixel) {
+                    unfinished = true;
+                }
+                else if (on_tile_complete) {
+                    on_tile_complete(t);
+                }
+            }
         }
-        std::clog << "\rRendering: " << percent << "% " << std::flush;
-        std::fill(render_progress.begin(), render_progress.end(), 0);
     }
 
   public:
@@ -166,113 +776,419 @@ class camera {
 
     int max_threads = 1; // Max number of threads available for the render step
 
+    int tile_size = 16; // Width and height of the blocks each thread accumulates locally
+
+    // Called from the render threads each time a tile has been written to the image
+    std::function<void(const tile&)> on_tile_complete;
+
+    // When set, render() stops at the next tile boundary once the flag becomes true
+    const std::atomic<bool>* cancel_flag = nullptr;
+
+    bool pin_threads = false; // Pin each render thread to a single CPU
+    bool numa_aware  = false; // Keep each thread, and the image rows it owns, on one NUMA node
+
+    unsigned long long seed = 0; // Seed of the per tile random sequences
+
+    // Derive the random numbers of every sample from (seed, pixel, sample) alone, so the image is
+    // bit-identical for any thread count, scheduler, tile distribution or machine
+    bool deterministic = false;
+    int samples_per_pass = 0;    // Samples added to a tile at a time, 0 takes all samples in one pass
+
+    // Checkpointing, for long renders that may be preempted. The accumulated image is written
+    // to checkpoint_file every checkpoint_interval seconds and on SIGTERM, and a render with
+    // the same settings resumes from it. The file is removed once the render completes.
+    std::string checkpoint_file;
+    double checkpoint_interval = 300;
+    uint64_t scene_hash = 0; // Identifies the scene in checkpoints, set from the text of a scene description
+
+    // Temporal accumulation for animations, see render_temporal(). Frames must be rendered
+    // in order on the same camera; checkpointing and passes do not apply in this mode.
+    bool temporal = false;
+    int temporal_samples = 4;               // Fresh samples for pixels with a valid history
+    int temporal_max_history = 32;          // Most samples a reused history may count for
+    double temporal_depth_tolerance = 0.02; // Relative depth change still considered the same surface
+    double temporal_clip = 1.0;             // History kept within this many standard deviations of the fresh samples around it, 0 to not clip
+
+    // Light list for next event estimation, typically scene_lights(world). Without it
+    // lights are only found by scattering into them.
+    shared_ptr<hittable> lights;
+
+    bool sky = true;                       // Sky gradient background, otherwise the background color
+    color background = color(0, 0, 0);
+
+    // HDR environment replacing the background, importance sampled at every diffuse hit
+    shared_ptr<environment_map> environment;
+
+    // Per tile list of the objects camera rays can hit first, used for the first
+    // intersection of every sample. Only applies to pinhole cameras (defocus_angle 0).
+    bool primary_hit_cache = true;
+
+    std::vector<int> preview_scales = { 4, 2 }; // Preview levels of render_preview(), 1/16 and 1/4 of the pixels
+    int preview_samples = 1;                    // Samples per pixel of the preview levels
+
+    progress_mode progress = progress_mode::bar; // Render progress output format
+    double progress_interval = 0.5;              // Seconds between progress reports
+
     void render(const hittable& world) {
-        // Start render timer
-        const auto start{std::chrono::steady_clock::now()};
-        
         // Initialize camera
         initialize();
 
-        // Spawn render threads
-        std::vector<std::thread> threads;
-        for (int i = 0; i < max_threads; i++) {
-            int offset = image_height / max_threads;
-            int minRow = i * offset;
-            int maxRow = i < max_threads - 1 ? minRow + offset : image_height;
-            threads.push_back(std::thread(&camera::render_thread, this, std::ref(world), i, minRow, maxRow));
+        if (temporal) {
+            if (progress == progress_mode::bar) {
+                std::clog << "\nRendering scene with temporal reprojection, " << max_threads << " threads at " << image_width << "x" << image_height << " pixels\n\n" << std::flush;
+            }
+            render_temporal(world);
+            return;
+        }
+
+        // Resume from a checkpoint of this same render if there is one
+        std::unique_ptr<checkpoint_signal_guard> signal_guard;
+        long long resumed_samples = 0;
+        if (!checkpoint_file.empty()) {
+            signal_guard.reset(new checkpoint_signal_guard());
+
+            if (load_checkpoint()) {
+                for (uint32_t count : sample_counts) {
+                    resumed_samples += count;
+                }
+                if (progress != progress_mode::quiet) {
+                    std::clog << "\nResuming from " << checkpoint_file << "\n" << std::flush;
+                }
+            }
+            else {
+                sample_counts.assign(image.size(), 0);
+            }
+        }
+
+        if (progress == progress_mode::bar) {
+            std::clog << "\nRendering scene with " << max_threads << " threads at " << image_width << "x" << image_height << " pixels\n\n" << std::flush;
+        }
+
+        // Start progress reporter, it also acts as the render timer
+        long long total_samples = static_cast<long long>(image_width) * image_height * samples_per_pixel - resumed_samples;
+        progress_reporter reporter(progress, max_threads, total_samples, progress_interval);
+        reporter.start();
+
+        // Threads are laid out node by node, so the contiguous tile ranges below
+        // give every NUMA node one contiguous region of the image
+        std::vector<int> thread_cpu, thread_node;
+        const cpu_topology& topology = cpu_topology::host();
+        if (pin_threads || numa_aware) {
+            topology.assign_threads(max_threads, thread_cpu, thread_node);
+        }
+
+        while (true) {
+            std::atomic<bool> stop(false);
+            auto checkpoint_due = std::chrono::steady_clock::now() +
+                std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(checkpoint_interval));
+
+            // Spawn render threads
+            std::vector<std::thread> threads;
+            for (int i = 0; i < max_threads; i++) {
+                size_t first_tile = tiles.size() * i / max_threads;
+                size_t last_tile = tiles.size() * (i + 1) / max_threads;
+
+                std::vector<int> cpus;
+                if (pin_threads) {
+                    cpus.push_back(thread_cpu[i]);
+                }
+                else if (numa_aware) {
+                    cpus = topology.nodes[thread_node[i]].cpus;
+                }
+
+                threads.push_back(std::thread(&camera::render_thread, this, std::ref(world), std::ref(reporter), cpus, i,
+                                              first_tile, last_tile, std::ref(stop), checkpoint_due));
+            }
+
+            // Await for render threads
+            for (int i = 0; i < max_threads; i++) {
+                threads[i].join();
+            }
+
+            if (!stop) {
+                complete = true;
+                break;
+            }
+            if (cancelled()) {
+                break;
+            }
+
+            // Threads stopped between tiles, the image is consistent with the sample counts
+            if (!save_checkpoint()) {
+                std::cerr << "\nCould not write checkpoint " << checkpoint_file << "\n";
+            }
+            if (checkpoint_signal_received()) {
+                break;
+            }
+        }
+
+        // Stop progress reporter and print elapsed time
+        reporter.stop();
+
+        if (!complete) {
+            if (progress != progress_mode::quiet && cancelled()) {
+                std::clog << "\n\nRender cancelled\n" << std::flush;
+            }
+            else if (progress != progress_mode::quiet) {
+                std::clog << "\n\nRender interrupted, progress saved to " << checkpoint_file << "\n" << std::flush;
+            }
+            return;
+        }
+
+        if (!checkpoint_file.empty()) {
+            remove(checkpoint_file.c_str());
+        }
+
+        if (progress == progress_mode::bar) {
+            std::clog << "\n\nRender completed in: " << reporter.elapsed_seconds() << " seconds" << std::flush;
+        }
+    }
+
+    // Forget the previous frame, the next temporal render starts from scratch
+    void reset_history() {
+        history.valid = false;
+    }
+
+    // False if the last render was interrupted or cancelled before reaching samples_per_pixel
+    bool is_complete() const {
+        return complete;
+    }
+
+    // Progressive preview for interactive camera setup. Traces the frame at 1/scale resolution for each
+    // entry of preview_scales, upsampling every level to full size, then renders the full frame on the
+    // same threads. on_level receives each level as soon as it is done, as mean radiance per pixel
+    // (scale 1 being the final image), while the threads already work on the next one.
+    void render_preview(const hittable& world, std::function<void(int scale, const framebuffer& preview)> on_level) {
+        initialize();
+
+        // One entry per level, the last one is the full resolution render
+        struct preview_level {
+            int scale;
+            int samples;
+            framebuffer low;
+            std::vector<tile> tiles;
+            std::atomic<size_t> next_tile;
+            std::atomic<size_t> finished_tiles;
+        };
+
+        std::vector<int> scales = preview_scales;
+        scales.push_back(1);
+        std::unique_ptr<preview_level[]> levels(new preview_level[scales.size()]);
+        long long total_samples = 0;
+        for (size_t l = 0; l < scales.size(); l++) {
+            preview_level& level = levels[l];
+            level.scale = scales[l] > 0 ? scales[l] : 1;
+            level.samples = l + 1 < scales.size() ? preview_samples : samples_per_pixel;
+            level.next_tile = 0;
+            level.finished_tiles = 0;
+
+            if (l + 1 < scales.size()) {
+                level.low.resize((image_width + level.scale - 1) / level.scale, (image_height + level.scale - 1) / level.scale);
+                level.tiles = split_into_tiles(level.low.width(), 0, level.low.height(), tile_size);
+            }
+            else {
+                level.tiles = tiles;
+            }
+            for (const tile& t : level.tiles) {
+                total_samples += static_cast<long long>(t.pixel_count()) * level.samples;
+            }
         }
 
-        // Print render progress
-        print_render_progress();
+        progress_reporter reporter(progress, max_threads, total_samples, progress_interval);
+        reporter.start();
 
-        // Await for render threads
+        // Threads move on to the next level as soon as the current one has no tiles left to
+        // start. The thread finishing a level's last tile delivers it, levels in order.
+        std::mutex mutex;
+        std::condition_variable level_done;
+        int delivered = -1;
+
+        auto deliver = [&](int l) {
+            preview_level& level = levels[l];
+            framebuffer preview;
+            if (level.scale > 1) {
+                upsample_preview(level.low, level.scale, preview);
+            }
+            else {
+                preview = image;
+                for (size_t p = 0; p < preview.size(); p++) {
+                    preview[p] /= samples_per_pixel;
+                }
+            }
+
+            std::unique_lock<std::mutex> lock(mutex);
+            level_done.wait(lock, [&] { return delivered == l - 1; });
+            lock.unlock();
+
+            if (on_level) {
+                on_level(level.scale, preview);
+            }
+
+            lock.lock();
+            delivered = l;
+            level_done.notify_all();
+        };
+
+        auto worker = [&](int threadId) {
+            std::vector<color> accumulator;
+
+            for (size_t l = 0; l < scales.size(); l++) {
+                preview_level& level = levels[l];
+
+                for (size_t k = level.next_tile++; k < level.tiles.size(); k = level.next_tile++) {
+                    const tile& t = level.tiles[k];
+                    accumulator.assign(t.pixel_count(), color(0, 0, 0));
+                    long long rays;
+
+                    if (level.scale > 1) {
+                        random_state() = mix_bits(mix_bits(seed + l + 1) ^ mix_bits(k + 1));
+                        rays = 0;
+                        for (int j = t.y0; j < t.y1; j++) {
+                            for (int i = t.x0; i < t.x1; i++) {
+                                color pixel_color(0, 0, 0);
+                                for (int sample = 0; sample < level.samples; sample++) {
+                                    pixel_color += ray_color(get_block_ray(i, j, level.scale), max_depth, world, rays);
+                                }
+                                level.low[static_cast<size_t>(j) * level.low.width() + i] = pixel_color / level.samples;
+                            }
+                        }
+                    }
+                    else {
+                        random_state() = tile_random_state[k];
+                        rays = trace_tile(world, t, 0, samples_per_pixel, accumulator);
+                        commit_tile(t, accumulator);
+                    }
+
+                    reporter.add(threadId, static_cast<long long>(t.pixel_count()) * level.samples, rays);
+                    if (++level.finished_tiles == level.tiles.size()) {
+                        deliver(static_cast<int>(l));
+                    }
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
         for (int i = 0; i < max_threads; i++) {
-            threads[i].join();
+            threads.push_back(std::thread(worker, i));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
         }
 
-        // Stop render timer and print elapsed time
-        const auto end{std::chrono::steady_clock::now()};
-        const std::chrono::duration<double> elapsed_seconds{end - start};
-        std::clog << "\n\nRender completed in: " << elapsed_seconds.count() << " seconds" << std::flush;
+        reporter.stop();
+        complete = true;
     }
 
-    std::vector<unsigned char> get_bitmap_data()
-    {
-        // Transform screen to a bitmap friendly format [r,g,b, r,g,b, ... ,r,g,b]
-        std::vector<unsigned char> bitmap_data;
+    // Tile level interface, used to render a frame piece by piece outside of render(),
+    // e.g. by distributed workers. Call prepare() after changing the camera parameters.
+    void prepare() {
+        initialize();
+    }
+
+    // Accumulate all samples of a tile in a thread local buffer, then write it to the image once.
+    // The tile's random sequence starts from seed, stream (e.g. the frame) and tile_id, so
+    // tiles rendered at the same time by other threads or processes draw different samples.
+    long long render_tile(const hittable& world, const tile& t, std::vector<color>& accumulator, uint64_t tile_id,
+                          uint64_t stream = 0) const {
+        random_state() = mix_bits(mix_bits(seed + stream) ^ mix_bits(tile_id + 1));
+        accumulator.assign(t.pixel_count(), color(0, 0, 0));
+        return trace_tile(world, t, 0, samples_per_pixel, accumulator);
+    }
+
+    // Write a tile holding sample_count samples per pixel (all of them by default) to the image
+    void commit_tile(const tile& t, const std::vector<color>& accumulator, int sample_count = -1) {
+        sample_count = sample_count >= 0 ? sample_count : samples_per_pixel;
+        for (int j = t.y0; j < t.y1; j++) {
+            size_t row = static_cast<size_t>(j) * image_width;
+            std::copy(accumulator.begin() + (j - t.y0) * t.width(),
+                      accumulator.begin() + (j - t.y0 + 1) * t.width(),
+                      &image[row + t.x0]);
+            std::fill(&sample_counts[row + t.x0], &sample_counts[row + t.x1], sample_count);
+        }
+    }
+
+    // Render several views of one scene in a single job. Tiles of all views are interleaved
+    // in one queue served by max_threads threads, so views share the scene setup and the
+    // threads stay busy until the last tile of the last view. Each camera holds its image afterwards.
+    static void render_batch(const hittable& world, std::vector<camera>& views, int max_threads, progress_mode progress = progress_mode::bar) {
+        max_threads = max_threads > 0 ? max_threads : 1;
+
+        // Interleave tiles of all views: tile 0 of every view, then tile 1 of every view, ...
+        std::vector<std::pair<size_t, size_t>> jobs;
+        size_t max_tiles = 0;
+        long long total_samples = 0;
+        for (camera& view : views) {
+            view.initialize();
+            max_tiles = view.tiles.size() > max_tiles ? view.tiles.size() : max_tiles;
+            total_samples += static_cast<long long>(view.image_width) * view.image_height * view.samples_per_pixel;
+        }
+        for (size_t k = 0; k < max_tiles; k++) {
+            for (size_t v = 0; v < views.size(); v++) {
+                if (k < views[v].tiles.size()) {
+                    jobs.push_back(std::make_pair(v, k));
+                }
+            }
+        }
+
+        if (progress == progress_mode::bar) {
+            std::clog << "\nRendering " << views.size() << " views with " << max_threads << " threads\n\n" << std::flush;
+        }
 
-        for (size_t i = 0; i < image.size(); i++)
-        {
-            // Get ith pixel from image
-            color pixel_color = image[i];
+        progress_reporter reporter(progress, max_threads, total_samples, views.empty() ? 0.5 : views[0].progress_interval);
+        reporter.start();
 
-            // Apply gamma correction
-            pixel_color = gamma_correction(pixel_color, samples_per_pixel);
+        std::atomic<size_t> next_job(0);
+        auto worker = [&](int threadId) {
+            std::vector<color> accumulator;
+            for (size_t n = next_job++; n < jobs.size(); n = next_job++) {
+                camera& view = views[jobs[n].first];
+                size_t k = jobs[n].second;
+                const tile& t = view.tiles[k];
 
-            // Push pixel into bitmap data
-            bitmap_data.push_back((unsigned char)(pixel_color.z() * 255)); // Blue
-            bitmap_data.push_back((unsigned char)(pixel_color.y() * 255)); // Green
-            bitmap_data.push_back((unsigned char)(pixel_color.x() * 255)); // Red
+                accumulator.assign(t.pixel_count(), color(0, 0, 0));
+                random_state() = view.tile_random_state[k];
+                long long rays = view.trace_tile(world, t, 0, view.samples_per_pixel, accumulator);
+                view.commit_tile(t, accumulator);
+
+                reporter.add(threadId, static_cast<long long>(t.pixel_count()) * view.samples_per_pixel, rays);
+                if (view.on_tile_complete) {
+                    view.on_tile_complete(t);
+                }
+            }
+        };
+
+        std::vector<std::thread> threads;
+        for (int i = 0; i < max_threads; i++) {
+            threads.push_back(std::thread(worker, i));
+        }
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+
+        for (camera& view : views) {
+            view.complete = true;
         }
 
-        return bitmap_data;
+        reporter.stop();
+        if (progress == progress_mode::bar) {
+            std::clog << "\n\nBatch completed in: " << reporter.elapsed_seconds() << " seconds" << std::flush;
+        }
+    }
+
+    const framebuffer& get_image() const { return image; }
+
+    std::vector<unsigned char> get_bitmap_data()
+    {
+        // Transform screen to a bitmap friendly format [b,g,r, b,g,r, ... ,b,g,r]
+        return to_bitmap_data(image, samples_per_pixel);
     }
 
     void write_image(std::string filename)
     {
-        // Transform image to a bitmap friendly format [r,g,b, r,g,b, ... ,r,g,b]
-        std::vector<unsigned char> image = this->get_bitmap_data();
-
-        // Define file pointer and size
-        FILE* f;
-        int file_size = 54 + 3 * image_width * image_height;
-
-        // Define bitmap headers, info and padding
-        unsigned char bmp_header[14] = {
-            'B','M',  // Mime type
-            0,0,0,0,  // Size in bytes
-            0,0,0,0,  // App data 
-            54,0,0,0  // Data offset start
-        };
-        unsigned char bmp_info[40] = {
-            40,0,0,0, // Info HD size
-            0,0,0,0,  // Width
-            0,0,0,0,  // Height
-            1,0,      // # color planes
-            24,0      // Bits per pixel
-        };
-        unsigned char bmp_pad[3] = { 0,0,0 };
-
-        // Set headers and info
-        bmp_header[2] = (unsigned char)(file_size);
-        bmp_header[3] = (unsigned char)(file_size >> 8);
-        bmp_header[4] = (unsigned char)(file_size >> 16);
-        bmp_header[5] = (unsigned char)(file_size >> 24);
-
-        bmp_info[4] = (unsigned char)(image_width);
-        bmp_info[5] = (unsigned char)(image_width >> 8);
-        bmp_info[6] = (unsigned char)(image_width >> 16);
-        bmp_info[7] = (unsigned char)(image_width >> 24);
-
-        bmp_info[8] = (unsigned char)(image_height);
-        bmp_info[9] = (unsigned char)(image_height >> 8);
-        bmp_info[10] = (unsigned char)(image_height >> 16);
-        bmp_info[11] = (unsigned char)(image_height >> 24);
-
-        // Write headers and info to file
-        f = fopen(filename.c_str(), "wb");
-        fwrite(bmp_header, 1, 14, f);
-        fwrite(bmp_info, 1, 40, f);
-
-        // Write data to file
-        for (int i = 0; i < image_height; i++)
-        {
-            fwrite(&image[0] + (image_width * (image_height - i - 1) * 3), 3, image_width, f);
-            fwrite(bmp_pad, 1, (4 - (image_width * 3) % 4) % 4, f);
-        }
-
-        // Close file
-        fclose(f);
+        // Encode the gamma corrected image as a bitmap and write it to disk
+        if (!write_file(filename, encode_bmp(get_bitmap_data(), image_width, image_height))) {
+            std::cerr << "Could not write " << filename << "\n";
+        }
     }
 };
 
@@ -0,0 +1,124 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Binary snapshot of an unfinished render:
+//
+//     checkpoint_header
+//     tile_count   x uint64  random generator state of each tile
+//     pixel_count  x uint32  samples accumulated in each pixel
+//     pixel_count  x 3 doubles  accumulated radiance
+//
+// A checkpoint only resumes a render with identical settings, which then
+// finishes bit-identical to a render that was never interrupted.
+struct checkpoint_header {
+    char magic[8];
+    uint32_t version;
+    int32_t image_width;
+    int32_t image_height;
+    int32_t samples_per_pixel;
+    int32_t samples_per_pass;
+    int32_t tile_size;
+    uint64_t seed;
+    uint64_t settings_hash; // Hash of the remaining camera parameters
+    uint32_t tile_count;
+    uint32_t reserved;
+
+    static constexpr uint32_t current_version = 1;
+
+    bool valid() const {
+        return memcmp(magic, "MRAYCKPT", 8) == 0 && version == current_version;
+    }
+
+    bool same_render(const checkpoint_header& other) const {
+        return image_width == other.image_width && image_height == other.image_height &&
+               samples_per_pixel == other.samples_per_pixel && samples_per_pass == other.samples_per_pass &&
+               tile_size == other.tile_size && seed == other.seed &&
+               settings_hash == other.settings_hash && tile_count == other.tile_count;
+    }
+};
+
+// Set by SIGTERM, render threads poll it between tiles
+inline volatile std::sig_atomic_t& checkpoint_signal_received() {
+    static volatile std::sig_atomic_t received = 0;
+    return received;
+}
+
+inline void checkpoint_signal_handler(int) {
+    checkpoint_signal_received() = 1;
+}
+
+// Route SIGTERM to the checkpoint flag while alive, restores the previous handler afterwards
+class checkpoint_signal_guard {
+  private:
+    void (*previous)(int);
+
+  public:
+    checkpoint_signal_guard() {
+        checkpoint_signal_received() = 0;
+        previous = std::signal(SIGTERM, checkpoint_signal_handler);
+    }
+
+    ~checkpoint_signal_guard() {
+        std::signal(SIGTERM, previous == SIG_ERR ? SIG_DFL : previous);
+        checkpoint_signal_received() = 0; // Handled by this render, later ones start afresh
+    }
+};
+
+// Write a checkpoint atomically, through a temporary file renamed over the old one
+inline bool write_checkpoint(const std::string& path, const checkpoint_header& header,
+                             const std::vector<uint64_t>& tile_states, const std::vector<uint32_t>& sample_counts,
+                             const double* radiance) {
+    std::string temporary = path + ".tmp";
+    FILE* f = fopen(temporary.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    size_t pixels = sample_counts.size();
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+              fwrite(tile_states.data(), sizeof(uint64_t), tile_states.size(), f) == tile_states.size() &&
+              fwrite(sample_counts.data(), sizeof(uint32_t), pixels, f) == pixels &&
+              fwrite(radiance, 3 * sizeof(double), pixels, f) == pixels;
+
+    ok = (fclose(f) == 0) && ok;
+    if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Read a checkpoint written for the render described by expected.
+// Returns false if there is none or it belongs to a different render.
+inline bool read_checkpoint(const std::string& path, const checkpoint_header& expected,
+                            std::vector<uint64_t>& tile_states, std::vector<uint32_t>& sample_counts,
+                            double* radiance) {
+    FILE* f = fopen(path.c_str(), "rb");
+    if (!f) {
+        return false;
+    }
+
+    checkpoint_header header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 && header.valid() && header.same_render(expected);
+
+    if (ok) {
+        size_t pixels = static_cast<size_t>(header.image_width) * header.image_height;
+        tile_states.resize(header.tile_count);
+        sample_counts.resize(pixels);
+        ok = fread(tile_states.data(), sizeof(uint64_t), tile_states.size(), f) == tile_states.size() &&
+             fread(sample_counts.data(), sizeof(uint32_t), pixels, f) == pixels &&
+             fread(radiance, 3 * sizeof(double), pixels, f) == pixels;
+    }
+
+    fclose(f);
+    return ok;
+}
+
+#endif
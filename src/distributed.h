@@ -0,0 +1,629 @@
+#ifndef DISTRIBUTED_H
+#define DISTRIBUTED_H
+
+#include "rtweekend.h"
+#include "bounded_queue.h"
+#include "camera.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "light_bvh.h"
+#include "progress.h"
+#include "tile.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Coordinator/worker rendering over a stream socket.
+//
+// The coordinator owns the frame and hands out tiles; workers render tiles with
+// their own threads and stream the accumulated samples back. Every message is a
+// header followed by a fixed layout payload:
+//
+//   worker -> coordinator   hello    { threads }
+//   coordinator -> worker   camera   { camera_settings }
+//   coordinator -> worker   tile     { tile_request }
+//   worker -> coordinator   result   { tile_result, pixel_count * 3 doubles }
+//   coordinator -> worker   shutdown { }
+//
+// Workers build the scene themselves, so coordinator and workers must agree on it.
+
+enum render_message_type : uint32_t {
+    msg_hello = 1,
+    msg_camera,
+    msg_tile,
+    msg_result,
+    msg_shutdown
+};
+
+struct render_message_header {
+    uint32_t type;
+    uint32_t size; // Payload size in bytes
+};
+
+struct worker_hello {
+    uint32_t threads;
+};
+
+// Camera parameters needed to render any tile of a frame
+struct camera_settings {
+    int32_t image_width;
+    int32_t image_height;
+    int32_t samples_per_pixel;
+    int32_t max_depth;
+    int32_t tile_size;
+    int32_t deterministic;
+    uint64_t seed;
+    double vfov;
+    double lookfrom[3];
+    double lookat[3];
+    double vup[3];
+    double defocus_angle;
+    double focus_dist;
+    int32_t sample_lights; // Workers sample the emissive objects of their own scene, 2 through a light_bvh
+    int32_t sky;
+    double background[3];
+    double environment_scale;
+    char environment[1024]; // Path of the environment map, loaded by each worker
+
+    static camera_settings from(const camera& cam) {
+        camera_settings settings;
+        settings.image_width = cam.image_width;
+        settings.image_height = cam.image_height;
+        settings.samples_per_pixel = cam.samples_per_pixel;
+        settings.max_depth = cam.max_depth;
+        settings.tile_size = cam.tile_size;
+        settings.deterministic = cam.deterministic ? 1 : 0;
+        settings.seed = cam.seed;
+        settings.vfov = cam.vfov;
+        settings.defocus_angle = cam.defocus_angle;
+        settings.focus_dist = cam.focus_dist;
+        settings.sample_lights = !cam.lights ? 0 : (dynamic_cast<const light_bvh*>(cam.lights.get()) ? 2 : 1);
+        settings.sky = cam.sky ? 1 : 0;
+        settings.environment_scale = cam.environment ? cam.environment->scale : 1.0;
+        memset(settings.environment, 0, sizeof(settings.environment));
+        if (cam.environment) {
+            strncpy(settings.environment, cam.environment->path().c_str(), sizeof(settings.environment) - 1);
+        }
+        for (int i = 0; i < 3; i++) {
+            settings.background[i] = cam.background[i];
+            settings.lookfrom[i] = cam.lookfrom[i];
+            settings.lookat[i] = cam.lookat[i];
+            settings.vup[i] = cam.vup[i];
+        }
+        return settings;
+    }
+
+    void apply(camera& cam) const {
+        cam.image_width = image_width;
+        cam.image_height = image_height;
+        cam.samples_per_pixel = samples_per_pixel;
+        cam.max_depth = max_depth;
+        cam.tile_size = tile_size;
+        cam.deterministic = deterministic != 0;
+        cam.seed = seed;
+        cam.vfov = vfov;
+        cam.lookfrom = point3d(lookfrom[0], lookfrom[1], lookfrom[2]);
+        cam.lookat = point3d(lookat[0], lookat[1], lookat[2]);
+        cam.vup = vector3d(vup[0], vup[1], vup[2]);
+        cam.defocus_angle = defocus_angle;
+        cam.focus_dist = focus_dist;
+        cam.sky = sky != 0;
+        cam.background = color(background[0], background[1], background[2]);
+    }
+};
+
+struct tile_request {
+    uint32_t id;
+    uint32_t frame; // Frames rendered by the coordinator before this one, varies the samples
+    int32_t x0, y0;
+    int32_t x1, y1;
+};
+
+struct tile_result {
+    uint32_t id;
+    uint32_t reserved;
+    uint64_t rays;
+};
+
+// Write the whole buffer, without raising SIGPIPE if the peer is gone. Waits for room
+// when a non-blocking socket is full, so only a closed or failed connection returns false.
+inline bool socket_write_all(int fd, const void* data, size_t size) {
+    const char* bytes = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t n = send(fd, bytes, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            pollfd writable = { fd, POLLOUT, 0 };
+            if (poll(&writable, 1, -1) < 0 && errno != EINTR) {
+                return false;
+            }
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool socket_read_all(int fd, void* data, size_t size) {
+    char* bytes = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t n = read(fd, bytes, size);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        bytes += n;
+        size -= n;
+    }
+    return true;
+}
+
+inline bool send_render_message(int fd, uint32_t type, const void* payload, uint32_t size) {
+    render_message_header header = { type, size };
+    return socket_write_all(fd, &header, sizeof(header)) && (size == 0 || socket_write_all(fd, payload, size));
+}
+
+inline sockaddr_un socket_address(const std::string& path) {
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path.c_str(), sizeof(address.sun_path) - 1);
+    return address;
+}
+
+// A worker process: connects to a coordinator and renders tiles until told to stop
+class render_worker {
+  private:
+    int fd = -1;
+    camera cam;
+    std::mutex send_mutex;
+
+    void render_loop(const hittable& world, bounded_queue<tile_request>& jobs) {
+        std::vector<color> accumulator;
+        tile_request job;
+
+        while (jobs.pop(job)) {
+            tile t = { job.x0, job.y0, job.x1, job.y1 };
+            tile_result result;
+            result.id = job.id;
+            result.reserved = 0;
+            result.rays = cam.render_tile(world, t, accumulator, job.id, job.frame);
+
+            uint32_t pixels_size = static_cast<uint32_t>(accumulator.size() * 3 * sizeof(double));
+            render_message_header header = { msg_result, static_cast<uint32_t>(sizeof(result)) + pixels_size };
+
+            // color is three packed doubles, the accumulator is sent as is
+            std::lock_guard<std::mutex> lock(send_mutex);
+            if (!socket_write_all(fd, &header, sizeof(header)) || !socket_write_all(fd, &result, sizeof(result)) ||
+                !socket_write_all(fd, accumulator.data(), pixels_size)) {
+                jobs.close();
+                return;
+            }
+        }
+    }
+
+  public:
+    // Connect to the coordinator at socket_path and serve tiles with the given number of threads.
+    // Returns 0 on a clean shutdown.
+    int run(const std::string& socket_path, const hittable& world, int threads) {
+        threads = threads > 0 ? threads : 1;
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = socket_address(socket_path);
+        if (fd < 0 || connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+            std::cerr << "Worker could not connect to " << socket_path << ": " << strerror(errno) << "\n";
+            return 1;
+        }
+
+        worker_hello hello = { static_cast<uint32_t>(threads) };
+        if (!send_render_message(fd, msg_hello, &hello, sizeof(hello))) {
+            close(fd);
+            return 1;
+        }
+
+        shared_ptr<hittable_list> lights = scene_lights(world);
+        shared_ptr<hittable> light_tree = make_shared<light_bvh>(*lights);
+        shared_ptr<environment_map> environment;
+
+        bounded_queue<tile_request> jobs(1 << 16);
+        std::vector<std::thread> render_threads;
+        for (int i = 0; i < threads; i++) {
+            render_threads.push_back(std::thread(&render_worker::render_loop, this, std::ref(world), std::ref(jobs)));
+        }
+
+        // Receive messages until shutdown or the coordinator goes away.
+        // A new camera is only sent once every tile of the previous frame came back,
+        // so no render thread is using the camera while it is updated.
+        int status = 1;
+        render_message_header header;
+        while (socket_read_all(fd, &header, sizeof(header))) {
+            std::vector<char> payload(header.size);
+            if (header.size > 0 && !socket_read_all(fd, payload.data(), header.size)) {
+                break;
+            }
+
+            if (header.type == msg_camera && header.size == sizeof(camera_settings)) {
+                camera_settings settings;
+                memcpy(&settings, payload.data(), sizeof(settings));
+                settings.apply(cam);
+                cam.lights = settings.sample_lights == 2 ? light_tree : (settings.sample_lights ? lights : nullptr);
+
+                // Environment maps are loaded once and kept while frames use the same one
+                if (settings.environment[0] == '\0') {
+                    environment = nullptr;
+                }
+                else if (!environment || environment->path() != settings.environment) {
+                    std::string error;
+                    environment = make_shared<environment_map>();
+                    if (!environment->load(settings.environment, error)) {
+                        std::cerr << "Worker: " << error << "\n";
+                        environment = nullptr;
+                    }
+                }
+                if (environment) {
+                    environment->scale = settings.environment_scale;
+                }
+                cam.environment = environment;
+                cam.prepare();
+            }
+            else if (header.type == msg_tile && header.size == sizeof(tile_request)) {
+                tile_request job;
+                memcpy(&job, payload.data(), sizeof(job));
+                jobs.push(job);
+            }
+            else if (header.type == msg_shutdown) {
+                status = 0;
+                break;
+            }
+        }
+
+        jobs.close();
+        for (std::thread& thread : render_threads) {
+            thread.join();
+        }
+
+        close(fd);
+        return status;
+    }
+};
+
+// Listens on a Unix socket, hands out tiles and collects the results.
+// Tiles held by a worker that disconnects are re-issued to the remaining ones,
+// and rendered locally if no worker is left.
+class render_coordinator {
+  private:
+    struct connection {
+        int fd;
+        bool ready = false;         // Hello received
+        bool has_camera = false;    // Camera of the current frame sent
+        size_t capacity = 0;        // Tiles kept in flight on this worker
+        std::vector<uint32_t> in_flight;
+        std::vector<unsigned char> inbox;
+    };
+
+    std::string socket_path;
+    int listen_fd = -1;
+    std::vector<connection> connections;
+    std::vector<pid_t> local_workers;
+    uint32_t frames_rendered = 0;
+
+    void drop_connection(size_t index, std::deque<uint32_t>& pending, const std::vector<bool>& done) {
+        connection& conn = connections[index];
+        size_t reissued = 0;
+        for (uint32_t id : conn.in_flight) {
+            if (!done[id]) {
+                pending.push_front(id);
+                reissued++;
+            }
+        }
+
+        if (progress != progress_mode::quiet) {
+            std::clog << "\nWorker lost, re-issuing " << reissued << " tiles\n" << std::flush;
+        }
+
+        close(conn.fd);
+        connections.erase(connections.begin() + index);
+    }
+
+    // Parse every complete message in a connection's inbox.
+    // Returns false if the worker sent something malformed.
+    bool process_inbox(connection& conn, camera& cam, const std::vector<tile>& tiles, std::vector<bool>& done,
+                       size_t& remaining, progress_reporter& reporter, std::vector<color>& accumulator) {
+        size_t offset = 0;
+        while (conn.inbox.size() - offset >= sizeof(render_message_header)) {
+            render_message_header header;
+            memcpy(&header, conn.inbox.data() + offset, sizeof(header));
+            if (conn.inbox.size() - offset - sizeof(header) < header.size) {
+                break;
+            }
+
+            const unsigned char* payload = conn.inbox.data() + offset + sizeof(header);
+            offset += sizeof(header) + header.size;
+
+            if (header.type == msg_hello && header.size == sizeof(worker_hello)) {
+                worker_hello hello;
+                memcpy(&hello, payload, sizeof(hello));
+                conn.ready = true;
+                conn.capacity = 2 * (hello.threads > 0 ? hello.threads : 1);
+            }
+            else if (header.type == msg_result && header.size >= sizeof(tile_result)) {
+                tile_result result;
+                memcpy(&result, payload, sizeof(result));
+                if (result.id >= tiles.size()) {
+                    return false;
+                }
+
+                const tile& t = tiles[result.id];
+                if (header.size != sizeof(tile_result) + t.pixel_count() * 3 * sizeof(double)) {
+                    return false;
+                }
+
+                for (size_t i = 0; i < conn.in_flight.size(); i++) {
+                    if (conn.in_flight[i] == result.id) {
+                        conn.in_flight.erase(conn.in_flight.begin() + i);
+                        break;
+                    }
+                }
+
+                // A re-issued tile may come back twice, keep the first copy
+                if (!done[result.id]) {
+                    accumulator.resize(t.pixel_count());
+                    memcpy(accumulator.data(), payload + sizeof(result), t.pixel_count() * 3 * sizeof(double));
+                    cam.commit_tile(t, accumulator);
+                    done[result.id] = true;
+                    remaining--;
+                    reporter.add(0, static_cast<long long>(t.pixel_count()) * cam.samples_per_pixel, result.rays);
+                }
+            }
+            else {
+                return false;
+            }
+        }
+
+        conn.inbox.erase(conn.inbox.begin(), conn.inbox.begin() + offset);
+        return true;
+    }
+
+    void accept_connections() {
+        while (true) {
+            int fd = accept(listen_fd, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+            connection conn;
+            conn.fd = fd;
+            connections.push_back(conn);
+        }
+    }
+
+    // Local workers without a connection are dead or stuck, neither will render again
+    void stop_local_workers() {
+        for (pid_t pid : local_workers) {
+            kill(pid, SIGKILL);
+            waitpid(pid, nullptr, 0);
+        }
+        local_workers.clear();
+    }
+
+  public:
+    progress_mode progress = progress_mode::bar; // Render progress output format
+    double worker_timeout = 10; // Seconds to wait without any worker before rendering locally
+
+    explicit render_coordinator(const std::string& path) : socket_path(path) {}
+
+    ~render_coordinator() {
+        shutdown();
+    }
+
+    // Create the listening socket. Returns false on failure.
+    bool listen() {
+        unlink(socket_path.c_str());
+
+        listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        sockaddr_un address = socket_address(socket_path);
+        if (listen_fd < 0 || bind(listen_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+            ::listen(listen_fd, 64) != 0) {
+            std::cerr << "Could not listen on " << socket_path << ": " << strerror(errno) << "\n";
+            return false;
+        }
+
+        fcntl(listen_fd, F_SETFL, fcntl(listen_fd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    // Fork worker processes on this machine. Must be called before any other thread is started,
+    // the children inherit the already loaded scene.
+    void spawn_local_workers(int count, const hittable& world, int threads_per_worker) {
+        for (int i = 0; i < count; i++) {
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listen_fd);
+                render_worker worker;
+                _exit(worker.run(socket_path, world, threads_per_worker));
+            }
+            if (pid > 0) {
+                local_workers.push_back(pid);
+            }
+        }
+    }
+
+    // Render one frame with the connected workers, the result is left in the camera image
+    void render(camera& cam, const hittable& world) {
+        cam.prepare();
+        uint32_t frame = frames_rendered++;
+
+        std::vector<tile> tiles = split_into_tiles(cam.image_width, 0, cam.image_height, cam.tile_size);
+        std::vector<bool> done(tiles.size(), false);
+        std::deque<uint32_t> pending;
+        for (uint32_t id = 0; id < tiles.size(); id++) {
+            pending.push_back(id);
+        }
+        size_t remaining = tiles.size();
+
+        camera_settings settings = camera_settings::from(cam);
+        for (connection& conn : connections) {
+            conn.has_camera = false;
+            conn.in_flight.clear();
+        }
+
+        long long total_samples = static_cast<long long>(cam.image_width) * cam.image_height * cam.samples_per_pixel;
+        progress_reporter reporter(progress, 1, total_samples, cam.progress_interval);
+        reporter.start();
+
+        std::vector<color> accumulator;
+        auto last_worker_seen = std::chrono::steady_clock::now();
+
+        while (remaining > 0) {
+            // Keep every ready worker supplied with tiles
+            for (size_t i = 0; i < connections.size();) {
+                connection& conn = connections[i];
+                bool ok = true;
+
+                if (conn.ready && !conn.has_camera) {
+                    ok = send_render_message(conn.fd, msg_camera, &settings, sizeof(settings));
+                    conn.has_camera = true;
+                }
+                while (ok && conn.ready && conn.in_flight.size() < conn.capacity && !pending.empty()) {
+                    uint32_t id = pending.front();
+                    pending.pop_front();
+                    if (done[id]) {
+                        continue;
+                    }
+
+                    const tile& t = tiles[id];
+                    tile_request job = { id, frame, t.x0, t.y0, t.x1, t.y1 };
+                    conn.in_flight.push_back(id);
+                    ok = send_render_message(conn.fd, msg_tile, &job, sizeof(job));
+                }
+
+                if (ok) {
+                    i++;
+                }
+                else {
+                    drop_connection(i, pending, done);
+                }
+            }
+
+            // With no worker connected for worker_timeout, finish the frame here
+            if (connections.empty()) {
+                double idle = std::chrono::duration<double>(std::chrono::steady_clock::now() - last_worker_seen).count();
+                if (idle > worker_timeout) {
+                    stop_local_workers();
+                    if (progress != progress_mode::quiet) {
+                        std::clog << "\nNo workers left, rendering " << remaining << " tiles locally\n" << std::flush;
+                    }
+                    for (uint32_t id = 0; id < tiles.size(); id++) {
+                        if (!done[id]) {
+                            long long rays = cam.render_tile(world, tiles[id], accumulator, id, frame);
+                            cam.commit_tile(tiles[id], accumulator);
+                            done[id] = true;
+                            reporter.add(0, static_cast<long long>(tiles[id].pixel_count()) * cam.samples_per_pixel, rays);
+                        }
+                    }
+                    remaining = 0;
+                    break;
+                }
+            }
+            else {
+                last_worker_seen = std::chrono::steady_clock::now();
+            }
+
+            // Wait for new workers or results
+            std::vector<pollfd> fds(connections.size() + 1);
+            fds[0].fd = listen_fd;
+            fds[0].events = POLLIN;
+            for (size_t i = 0; i < connections.size(); i++) {
+                fds[i + 1].fd = connections[i].fd;
+                fds[i + 1].events = POLLIN;
+            }
+
+            if (poll(fds.data(), fds.size(), 100) < 0 && errno != EINTR) {
+                break;
+            }
+
+            // Read from existing connections first, indices shift when one is dropped
+            for (size_t i = connections.size(); i-- > 0;) {
+                if (!(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) {
+                    continue;
+                }
+
+                connection& conn = connections[i];
+                bool alive = true;
+                while (true) {
+                    unsigned char buffer[1 << 16];
+                    ssize_t n = read(conn.fd, buffer, sizeof(buffer));
+                    if (n > 0) {
+                        conn.inbox.insert(conn.inbox.end(), buffer, buffer + n);
+                        continue;
+                    }
+                    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+                        break;
+                    }
+                    alive = false;
+                    break;
+                }
+
+                if (!process_inbox(conn, cam, tiles, done, remaining, reporter, accumulator)) {
+                    alive = false;
+                }
+                if (!alive) {
+                    drop_connection(i, pending, done);
+                }
+            }
+
+            if (fds[0].revents & POLLIN) {
+                accept_connections();
+            }
+        }
+
+        reporter.stop();
+    }
+
+    // Tell every worker to exit and reap the local ones
+    void shutdown() {
+        for (connection& conn : connections) {
+            send_render_message(conn.fd, msg_shutdown, nullptr, 0);
+            close(conn.fd);
+        }
+        connections.clear();
+
+        for (pid_t pid : local_workers) {
+            waitpid(pid, nullptr, 0);
+        }
+        local_workers.clear();
+
+        if (listen_fd >= 0) {
+            close(listen_fd);
+            unlink(socket_path.c_str());
+            listen_fd = -1;
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,117 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtweekend.h"
+#include "alias_table.h"
+#include "color.h"
+#include "image_io.h"
+
+#include <string>
+#include <vector>
+
+// HDR image surrounding the scene in latitude-longitude layout: the top row looks
+// straight up (+y), columns go around the y axis. Texels are sampled in proportion
+// to their brightness, so small bright regions such as the sun are lit directly.
+class environment_map {
+  private:
+    int width = 0;
+    int height = 0;
+    std::vector<float> texels; // RGB, top row first
+    alias_table distribution;  // Over texels, weighted by luminance and solid angle
+    std::string source;
+
+    void build_distribution() {
+        std::vector<double> weights(static_cast<size_t>(width) * height);
+        for (int y = 0; y < height; y++) {
+            double sin_theta = sin(pi * (y + 0.5) / height);
+            for (int x = 0; x < width; x++) {
+                size_t i = static_cast<size_t>(y) * width + x;
+                weights[i] = luminance(texel(x, y)) * sin_theta;
+            }
+        }
+        distribution = alias_table(weights);
+    }
+
+    static double luminance(const color& c) {
+        return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+    }
+
+    color texel(int x, int y) const {
+        const float* t = &texels[(static_cast<size_t>(y) * width + x) * 3];
+        return scale * color(t[0], t[1], t[2]);
+    }
+
+    // Texel seen in a direction
+    void texel_of(const vector3d& direction, int& x, int& y) const {
+        vector3d d = unit_vector(direction);
+        double theta = std::acos(d.y() < -1 ? -1 : (d.y() > 1 ? 1 : d.y()));
+        double phi = atan2(d.z(), d.x()) + pi;
+
+        x = static_cast<int>(phi / (2 * pi) * width);
+        y = static_cast<int>(theta / pi * height);
+        x = x < width ? (x >= 0 ? x : 0) : width - 1;
+        y = y < height ? (y >= 0 ? y : 0) : height - 1;
+    }
+
+  public:
+    double scale = 1.0; // Radiance multiplier
+
+    // Load an image file, see load_image(). Returns false and sets error on failure.
+    bool load(const std::string& path, std::string& error) {
+        image_data image;
+        if (!load_image(path, image, error)) {
+            return false;
+        }
+
+        width = image.width;
+        height = image.height;
+        texels.swap(image.texels);
+        source = path;
+        build_distribution();
+        return true;
+    }
+
+    const std::string& path() const {
+        return source;
+    }
+
+    bool empty() const {
+        return texels.empty();
+    }
+
+    // Radiance arriving from a direction
+    color value(const vector3d& direction) const {
+        int x, y;
+        texel_of(direction, x, y);
+        return texel(x, y);
+    }
+
+    // Solid angle density of random() picking direction
+    double pdf_value(const vector3d& direction) const {
+        int x, y;
+        texel_of(direction, x, y);
+
+        double sin_theta = sqrt(fmax(0.0, 1 - unit_vector(direction).y() * unit_vector(direction).y()));
+        if (sin_theta <= 0) {
+            return 0.0;
+        }
+
+        // Uniform over the texel's angles, converted to solid angle
+        double angle_area = (2 * pi / width) * (pi / height);
+        return distribution.pmf(y * width + x) / (angle_area * sin_theta);
+    }
+
+    // Random direction, bright texels more likely
+    vector3d random() const {
+        int i = distribution.sample(random_double());
+        int x = i % width;
+        int y = i / width;
+
+        // Uniform in the texel's angles
+        double phi = 2 * pi * (x + random_double()) / width - pi;
+        double theta = pi * (y + random_double()) / height;
+        return vector3d(sin(theta) * cos(phi), cos(theta), sin(theta) * sin(phi));
+    }
+};
+
+#endif
@@ -0,0 +1,425 @@
+#ifndef FARM_H
+#define FARM_H
+
+#include "rtweekend.h"
+#include "bitmap.h"
+#include "camera.h"
+#include "hittable.h"
+
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+// Description of an animation job shared by every process of a render farm.
+//
+//     # Comments start with '#'
+//     frames     0-359          # Frame list, ranges and single frames separated by commas
+//     output     render/frame%d.bmp
+//     lock_dir   render/locks   # Shared directory holding one lock file per frame being rendered
+//     stale_lock 3600           # Optional, seconds after which a lock from another host is reclaimed
+class job_manifest {
+  public:
+    std::vector<int> frames;
+    std::string output_template = "frame%d.bmp";
+    std::string lock_dir = ".";
+    int stale_lock_seconds = 0; // 0 never reclaims locks held by other hosts
+
+    // Parse a manifest file. Returns false and sets error on failure.
+    bool load(const std::string& path, std::string& error) {
+        FILE* f = fopen(path.c_str(), "r");
+        if (!f) {
+            error = "could not open " + path;
+            return false;
+        }
+
+        frames.clear();
+        char line[4096];
+        int line_number = 0;
+        while (fgets(line, sizeof(line), f)) {
+            line_number++;
+            char* comment = strchr(line, '#');
+            if (comment) {
+                *comment = '\0';
+            }
+
+            char key[64];
+            char value[4000];
+            int fields = sscanf(line, "%63s %3999s", key, value);
+            if (fields <= 0) {
+                continue;
+            }
+            if (fields == 1) {
+                error = path + ":" + std::to_string(line_number) + ": missing value for " + key;
+                fclose(f);
+                return false;
+            }
+
+            if (strcmp(key, "frames") == 0) {
+                if (!parse_frames(value)) {
+                    error = path + ":" + std::to_string(line_number) + ": bad frame list";
+                    fclose(f);
+                    return false;
+                }
+            }
+            else if (strcmp(key, "output") == 0) {
+                output_template = value;
+                std::string example;
+                if (!format_output_path(output_template, 0, example)) {
+                    error = path + ":" + std::to_string(line_number) + ": output needs exactly one frame number such as %d or %04d";
+                    fclose(f);
+                    return false;
+                }
+            }
+            else if (strcmp(key, "lock_dir") == 0) {
+                lock_dir = value;
+            }
+            else if (strcmp(key, "stale_lock") == 0) {
+                stale_lock_seconds = atoi(value);
+            }
+            else {
+                error = path + ":" + std::to_string(line_number) + ": unknown key " + key;
+                fclose(f);
+                return false;
+            }
+        }
+
+        fclose(f);
+        if (frames.empty()) {
+            error = path + ": no frames";
+            return false;
+        }
+        return true;
+    }
+
+    // Parse "0-99,150,200-359"
+    bool parse_frames(const std::string& list) {
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+
+            std::string range = list.substr(pos, end - pos);
+            int first, last;
+            if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+                if (last < first) {
+                    return false;
+                }
+                for (int frame = first; frame <= last; frame++) {
+                    frames.push_back(frame);
+                }
+            }
+            else if (sscanf(range.c_str(), "%d", &first) == 1) {
+                frames.push_back(first);
+            }
+            else {
+                return false;
+            }
+
+            pos = end + 1;
+        }
+        return true;
+    }
+
+    // Path of a frame from a template holding exactly one frame number, %d or zero padded
+    // as %04d, and %% for a percent sign. Returns false for any other template. It comes from
+    // the manifest, so it is never handed to printf.
+    static bool format_output_path(const std::string& pattern, int frame, std::string& path) {
+        path.clear();
+        int numbers = 0;
+        for (size_t i = 0; i < pattern.size(); i++) {
+            if (pattern[i] != '%') {
+                path += pattern[i];
+                continue;
+            }
+            if (i + 1 < pattern.size() && pattern[i + 1] == '%') {
+                path += '%';
+                i++;
+                continue;
+            }
+
+            size_t j = i + 1;
+            bool zero = j < pattern.size() && pattern[j] == '0';
+            size_t width = 0;
+            for (; j < pattern.size() && pattern[j] >= '0' && pattern[j] <= '9' && width < 100; j++) {
+                width = width * 10 + (pattern[j] - '0');
+            }
+            if (j == pattern.size() || pattern[j] != 'd' || width >= 100) {
+                return false;
+            }
+            numbers++;
+            std::string digits = std::to_string(frame < 0 ? -static_cast<long long>(frame) : frame);
+            std::string sign = frame < 0 ? "-" : "";
+            size_t padding = width > sign.size() + digits.size() ? width - sign.size() - digits.size() : 0;
+            path += zero ? sign + std::string(padding, '0') + digits : std::string(padding, ' ') + sign + digits;
+            i = j;
+        }
+        return numbers == 1;
+    }
+
+    // Output path of a frame, see format_output_path(). load() rejects templates without
+    // exactly one frame number; set by hand, such a template gets the frame appended.
+    std::string output_path(int frame) const {
+        std::string path;
+        if (!format_output_path(output_template, frame, path)) {
+            return output_template + std::to_string(frame);
+        }
+        return path;
+    }
+
+    std::string lock_path(int frame) const {
+        return lock_dir + "/frame" + std::to_string(frame) + ".lock";
+    }
+};
+
+// Claims frames of a manifest through lock files, so independent processes can
+// share one job. A frame whose output exists is finished and never claimed again.
+// Outputs are written to a temporary file and renamed, so they are never partial.
+class frame_claims {
+  private:
+    const job_manifest& manifest;
+    std::string host;
+
+    static bool file_exists(const std::string& path) {
+        struct stat info;
+        return stat(path.c_str(), &info) == 0;
+    }
+
+    // A lock is stale if its owner ran on this host and is gone, or if it is older than the manifest allows
+    bool is_stale(const std::string& lock) const {
+        FILE* f = fopen(lock.c_str(), "r");
+        if (!f) {
+            return false;
+        }
+
+        char owner_host[256] = "";
+        long owner_pid = 0;
+        int fields = fscanf(f, "%255s %ld", owner_host, &owner_pid);
+        struct stat info;
+        bool known = fstat(fileno(f), &info) == 0;
+        fclose(f);
+        if (!known) {
+            return false;
+        }
+
+        if (fields == 2 && host == owner_host) {
+            return owner_pid > 0 && kill(static_cast<pid_t>(owner_pid), 0) != 0 && errno == ESRCH;
+        }
+        if (manifest.stale_lock_seconds > 0) {
+            return difftime(time(nullptr), info.st_mtime) > manifest.stale_lock_seconds;
+        }
+        return false;
+    }
+
+    // Remove a stale lock. Breaking is serialised by a second lock file, and the lock is judged
+    // again while holding it, so a lock that another process broke and claimed in the meantime
+    // is never removed. Returns false if the lock was not removed.
+    bool break_lock(const std::string& lock) const {
+        std::string breaker = lock + ".break";
+        int fd = open(breaker.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+        if (fd < 0) {
+            // Someone else is breaking it. Breaking takes microseconds, so an old breaker
+            // was left by a process that died halfway.
+            struct stat info;
+            if (errno == EEXIST && stat(breaker.c_str(), &info) == 0 && difftime(time(nullptr), info.st_mtime) > 60) {
+                unlink(breaker.c_str());
+            }
+            return false;
+        }
+        close(fd);
+
+        bool stale = is_stale(lock);
+        if (stale) {
+            unlink(lock.c_str());
+        }
+        unlink(breaker.c_str());
+        return stale;
+    }
+
+  public:
+    explicit frame_claims(const job_manifest& _manifest) : manifest(_manifest) {
+        char name[256] = "localhost";
+        gethostname(name, sizeof(name) - 1);
+        host = name;
+    }
+
+    // Create the lock directory and any missing parents. Returns false and sets error on failure.
+    bool prepare(std::string& error) const {
+        const std::string& dir = manifest.lock_dir;
+        for (size_t end = dir.find('/', 1); ; end = dir.find('/', end + 1)) {
+            std::string part = dir.substr(0, end);
+            if (!part.empty() && mkdir(part.c_str(), 0777) != 0 && errno != EEXIST) {
+                error = "could not create " + part + ": " + strerror(errno);
+                return false;
+            }
+            if (end == std::string::npos) {
+                break;
+            }
+        }
+
+        struct stat info;
+        if (stat(dir.c_str(), &info) != 0 || !S_ISDIR(info.st_mode)) {
+            error = dir + " is not a directory";
+            return false;
+        }
+        return true;
+    }
+
+    bool is_finished(int frame) const {
+        return file_exists(manifest.output_path(frame));
+    }
+
+    // Atomically claim a frame. Returns false if it is finished or held by another process.
+    bool claim(int frame) {
+        std::string lock = manifest.lock_path(frame);
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            if (is_finished(frame)) {
+                return false;
+            }
+
+            int fd = open(lock.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0644);
+            if (fd >= 0) {
+                std::string owner = host + " " + std::to_string(getpid()) + "\n";
+                bool written = write(fd, owner.c_str(), owner.size()) == static_cast<ssize_t>(owner.size());
+                close(fd);
+
+                // The output may have appeared between the check and the claim
+                if (!written || is_finished(frame)) {
+                    unlink(lock.c_str());
+                    return false;
+                }
+                return true;
+            }
+
+            if (errno != EEXIST || !is_stale(lock) || !break_lock(lock)) {
+                return false;
+            }
+
+            // Owner is gone and the lock was broken, try once more. If another process
+            // claims it first, creating the lock decides between them.
+        }
+
+        return false;
+    }
+
+    void release(int frame) {
+        unlink(manifest.lock_path(frame).c_str());
+    }
+
+    // Publish a claimed frame's output and release it. Returns false if it could not be written.
+    bool complete(int frame, const std::vector<unsigned char>& data) {
+        std::string path = manifest.output_path(frame);
+        std::string temporary = path + ".tmp." + host + "." + std::to_string(getpid());
+
+        bool written = write_file(temporary, data) && rename(temporary.c_str(), path.c_str()) == 0;
+        if (!written) {
+            unlink(temporary.c_str());
+        }
+
+        release(frame);
+        return written;
+    }
+};
+
+// Touches a lock file from a background thread while its frame renders, so other hosts
+// do not take a long render for a stale lock. Stops when destroyed.
+class lock_heartbeat {
+  public:
+    lock_heartbeat(const std::string& _path, double _interval) : path(_path), interval(_interval) {
+        if (interval > 0) {
+            thread = std::thread([this] { run(); });
+        }
+    }
+
+    ~lock_heartbeat() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+
+  private:
+    std::string path;
+    double interval;
+    std::mutex mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+    std::thread thread;
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!wake.wait_for(lock, std::chrono::duration<double>(interval), [this] { return stopping; })) {
+            utimes(path.c_str(), nullptr);
+        }
+    }
+};
+
+// Render every frame of a manifest not finished or claimed by another process.
+// setup_frame configures the camera for a frame number. Returns the number of frames
+// rendered here, or -1 if the lock directory can not be created.
+inline int render_manifest(const job_manifest& manifest, const hittable& world, camera cam,
+                           const std::function<void(int frame, camera& cam)>& setup_frame) {
+    frame_claims claims(manifest);
+    std::string error;
+    if (!claims.prepare(error)) {
+        std::cerr << "Lock directory: " << error << "\n";
+        return -1;
+    }
+    int rendered = 0;
+    int skipped = 0;
+
+    for (int frame : manifest.frames) {
+        if (!claims.claim(frame)) {
+            skipped++;
+            continue;
+        }
+
+        if (setup_frame) {
+            setup_frame(frame, cam);
+        }
+        {
+            // Four refreshes per stale_lock period keep the lock well clear of it
+            lock_heartbeat heartbeat(manifest.lock_path(frame), manifest.stale_lock_seconds / 4.0);
+            cam.render(world);
+        }
+
+        std::vector<unsigned char> encoded = encode_bmp(cam.get_bitmap_data(), cam.image_width, cam.image_height);
+        if (!claims.complete(frame, encoded)) {
+            std::cerr << "\nCould not write " << manifest.output_path(frame) << "\n";
+            continue;
+        }
+
+        rendered++;
+        if (cam.progress == progress_mode::bar) {
+            std::clog << "\n\nSaved " << manifest.output_path(frame) << "\n" << std::flush;
+        }
+    }
+
+    if (cam.progress != progress_mode::quiet) {
+        std::clog << "\nRendered " << rendered << " frames, " << skipped << " finished or claimed elsewhere\n" << std::flush;
+    }
+    return rendered;
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "color.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Accumulation buffer for a rendered image.
+// Memory is allocated but never touched on allocation, so every row is
+// first-touched (and placed on a NUMA node) by the thread that writes it.
+class framebuffer {
+  private:
+    int w = 0;
+    int h = 0;
+    color* pixels = nullptr;
+
+    void allocate(int width, int height) {
+        std::free(pixels);
+        pixels = nullptr;
+        w = width;
+        h = height;
+
+        if (size() > 0) {
+            pixels = static_cast<color*>(std::malloc(size() * sizeof(color)));
+            if (!pixels) {
+                throw std::bad_alloc();
+            }
+        }
+    }
+
+  public:
+    framebuffer() {}
+
+    framebuffer(const framebuffer& other) {
+        allocate(other.w, other.h);
+        if (size() > 0) {
+            std::memcpy(pixels, other.pixels, size() * sizeof(color));
+        }
+    }
+
+    framebuffer& operator=(const framebuffer& other) {
+        if (this != &other) {
+            if (other.w != w || other.h != h) {
+                allocate(other.w, other.h);
+            }
+            if (size() > 0) {
+                std::memcpy(pixels, other.pixels, size() * sizeof(color));
+            }
+        }
+        return *this;
+    }
+
+    framebuffer(framebuffer&& other) : w(other.w), h(other.h), pixels(other.pixels) {
+        other.w = 0;
+        other.h = 0;
+        other.pixels = nullptr;
+    }
+
+    framebuffer& operator=(framebuffer&& other) {
+        if (this != &other) {
+            std::swap(w, other.w);
+            std::swap(h, other.h);
+            std::swap(pixels, other.pixels);
+        }
+        return *this;
+    }
+
+    ~framebuffer() { std::free(pixels); }
+
+    // Reallocate only when the dimensions change. Contents are left undefined.
+    void resize(int width, int height) {
+        if (width != w || height != h) {
+            allocate(width, height);
+        }
+    }
+
+    int width() const { return w; }
+    int height() const { return h; }
+    size_t size() const { return static_cast<size_t>(w) * h; }
+
+    color& operator[](size_t i) { return pixels[i]; }
+    const color& operator[](size_t i) const { return pixels[i]; }
+
+    color* data() { return pixels; }
+    const color* data() const { return pixels; }
+};
+
+#endif
@@ -2,6 +2,7 @@
 #define HITTABLE_H
 
 #include "rtweekend.h"
+#include "aabb.h"
 
 class material;
 
@@ -13,6 +14,12 @@ class hit_record {
     double t;
     bool front_face;
 
+    // Texture coordinates and the ray footprint in them, see ray::footprint()
+    double u = 0;
+    double v = 0;
+    double u_footprint = 0;
+    double v_footprint = 0;
+
     void set_face_normal(const ray& r, const vector3d& outward_normal) {
         // Sets the hit record normal vector.
         // NOTE: The parameter 'outward_normal' is assumed to have unit legth.
@@ -25,6 +32,52 @@ class hittable {
   public:
     virtual ~hittable() = default;
     virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+    // Box enclosing every point hit() can return, aabb::universe if unbounded
+    virtual aabb bounding_box() const = 0;
+
+    // Whether hit() can report scattering inside a volume, see medium.h
+    virtual bool contains_medium() const {
+        return false;
+    }
+
+    // hit() for shadow rays, only surfaces. Volumes dim shadow rays through transmittance()
+    // instead of blocking them.
+    virtual bool hit_surface(const ray& r, interval ray_t, hit_record& rec) const {
+        return contains_medium() ? false : hit(r, ray_t, rec);
+    }
+
+    // Fraction of light passing through the object's volumes along r within ray_t
+    virtual double transmittance(const ray& r, interval ray_t) const {
+        return 1.0;
+    }
+
+    // Whether the object emits light, see scene_lights()
+    virtual bool is_emissive() const {
+        return false;
+    }
+
+    // Total power emitted, used to pick among lights
+    virtual double emitted_power() const {
+        return 0.0;
+    }
+
+    // Cone bounding the surface normals around axis (half angle theta_o) and the spread of
+    // emission around them (theta_e). Returns false if light leaves in every direction.
+    virtual bool emission_cone(vector3d& axis, double& theta_o, double& theta_e) const {
+        return false;
+    }
+
+    // Solid angle density of random() picking direction from origin
+    virtual double pdf_value(const point3d& origin, const vector3d& direction) const {
+        return 0.0;
+    }
+
+    // Random direction from origin towards the object, for light sampling. The zero vector
+    // means nothing could be sampled, and the sample is skipped.
+    virtual vector3d random(const point3d& origin) const {
+        return vector3d(0, 0, 0);
+    }
 };
 
 #endif
\ No newline at end of file
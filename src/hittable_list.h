@@ -14,10 +14,16 @@ class hittable_list: public hittable {
     hittable_list() {}
     hittable_list(shared_ptr<hittable> object) { add(object); }
 
-    void clear() { objects.clear(); }
+    void clear() {
+        objects.clear();
+        bbox = aabb();
+        media = false;
+    }
     
     void add(shared_ptr<hittable> object) {
         objects.push_back(object);
+        bbox = aabb(bbox, object->bounding_box());
+        media = media || object->contains_medium();
     }
 
     bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
@@ -35,6 +41,95 @@ class hittable_list: public hittable {
 
         return hit_anything;
     }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    bool contains_medium() const override {
+        return media;
+    }
+
+    bool hit_surface(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!media) {
+            return hit(r, ray_t, rec);
+        }
+
+        hit_record temp_rec;
+        bool hit_anything = false;
+        double closest_so_far = ray_t.max;
+
+        for (const auto& object : objects) {
+            if (object->hit_surface(r, interval(ray_t.min, closest_so_far), temp_rec)) {
+                hit_anything = true;
+                closest_so_far = temp_rec.t;
+                rec = temp_rec;
+            }
+        }
+
+        return hit_anything;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override {
+        if (!media) {
+            return 1.0;
+        }
+
+        double fraction = 1.0;
+        for (const auto& object : objects) {
+            if (object->contains_medium()) {
+                fraction *= object->transmittance(r, ray_t);
+            }
+        }
+        return fraction;
+    }
+
+    // Picks one of the objects uniformly
+    double pdf_value(const point3d& origin, const vector3d& direction) const override {
+        if (objects.empty()) {
+            return 0.0;
+        }
+
+        double sum = 0.0;
+        for (const auto& object : objects) {
+            sum += object->pdf_value(origin, direction);
+        }
+        return sum / objects.size();
+    }
+
+    vector3d random(const point3d& origin) const override {
+        if (objects.empty()) {
+            return vector3d(0, 0, 0);
+        }
+
+        int size = static_cast<int>(objects.size());
+        return objects[random_int(0, size - 1)]->random(origin);
+    }
+
+  private:
+    aabb bbox;
+    bool media = false; // Whether any object contains a medium
 };
 
+// Collect the emissive objects of a scene, nested lists included, as the light list for a camera
+inline shared_ptr<hittable_list> scene_lights(const hittable& world) {
+    auto lights = make_shared<hittable_list>();
+    const hittable_list* list = dynamic_cast<const hittable_list*>(&world);
+    if (!list) {
+        return lights;
+    }
+
+    for (const auto& object : list->objects) {
+        if (dynamic_cast<const hittable_list*>(object.get())) {
+            for (const auto& light : scene_lights(*object)->objects) {
+                lights->add(light);
+            }
+        }
+        else if (object->is_emissive()) {
+            lights->add(object);
+        }
+    }
+    return lights;
+}
+
 #endif
\ No newline at end of file
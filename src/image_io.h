@@ -0,0 +1,284 @@
+#ifndef IMAGE_IO_H
+#define IMAGE_IO_H
+
+#include "mapped_file.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Linear RGB image, top row first
+struct image_data {
+    int width = 0;
+    int height = 0;
+    std::vector<float> texels;
+};
+
+// Parse "key\n" style header tokens, skipping whitespace and comments
+inline bool read_header_token(const unsigned char*& p, const unsigned char* end, char* token, size_t capacity) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n' || *p == '#')) {
+        if (*p == '#') {
+            while (p < end && *p != '\n') p++;
+        }
+        else {
+            p++;
+        }
+    }
+
+    size_t n = 0;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n' && n + 1 < capacity) {
+        token[n++] = static_cast<char>(*p++);
+    }
+    token[n] = '\0';
+    return n > 0;
+}
+
+// Portable float map: "PF" (RGB) or "Pf" (grey), rows bottom to top, negative scale is little endian
+inline bool decode_pfm(const mapped_file& file, image_data& image, std::string& error) {
+    const unsigned char* p = file.data();
+    const unsigned char* end = p + file.size();
+    char magic[8], w[32], h[32], scale[64];
+    if (!read_header_token(p, end, magic, sizeof(magic)) || !read_header_token(p, end, w, sizeof(w)) ||
+        !read_header_token(p, end, h, sizeof(h)) || !read_header_token(p, end, scale, sizeof(scale))) {
+        error = "bad PFM header";
+        return false;
+    }
+    p++; // Single whitespace before the pixels
+
+    int channels = strcmp(magic, "PF") == 0 ? 3 : (strcmp(magic, "Pf") == 0 ? 1 : 0);
+    image.width = atoi(w);
+    image.height = atoi(h);
+    bool little_endian = atof(scale) < 0;
+    size_t count = static_cast<size_t>(image.width) * image.height * channels;
+    if (channels == 0 || image.width <= 0 || image.height <= 0 || static_cast<size_t>(end - p) < count * sizeof(float)) {
+        error = "bad PFM header or truncated pixels";
+        return false;
+    }
+
+    uint16_t probe = 1;
+    bool host_little_endian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+
+    image.texels.resize(static_cast<size_t>(image.width) * image.height * 3);
+    for (int row = 0; row < image.height; row++) {
+        const unsigned char* line = p + static_cast<size_t>(image.height - 1 - row) * image.width * channels * sizeof(float);
+        for (int x = 0; x < image.width; x++) {
+            for (int c = 0; c < 3; c++) {
+                unsigned char bytes[4];
+                memcpy(bytes, line + (static_cast<size_t>(x) * channels + (channels == 3 ? c : 0)) * sizeof(float), 4);
+                if (little_endian != host_little_endian) {
+                    std::swap(bytes[0], bytes[3]);
+                    std::swap(bytes[1], bytes[2]);
+                }
+                float value;
+                memcpy(&value, bytes, sizeof(value));
+                image.texels[(static_cast<size_t>(row) * image.width + x) * 3 + c] = value;
+            }
+        }
+    }
+    return true;
+}
+
+// Radiance RGBE (.hdr), flat or with run length encoded scanlines
+inline bool decode_hdr(const mapped_file& file, image_data& image, std::string& error) {
+    const unsigned char* p = file.data();
+    const unsigned char* end = p + file.size();
+
+    // Header lines up to an empty line, then the resolution line
+    bool format_ok = true;
+    while (p < end) {
+        const unsigned char* line = p;
+        while (p < end && *p != '\n') p++;
+        std::string text(reinterpret_cast<const char*>(line), p - line);
+        p++;
+        if (text.empty()) {
+            break;
+        }
+        if (text.compare(0, 7, "FORMAT=") == 0 && text != "FORMAT=32-bit_rle_rgbe") {
+            format_ok = false;
+        }
+    }
+
+    char resolution[128] = "";
+    size_t n = 0;
+    while (p < end && *p != '\n' && n + 1 < sizeof(resolution)) {
+        resolution[n++] = static_cast<char>(*p++);
+    }
+    resolution[n] = '\0';
+    p++;
+
+    if (!format_ok || sscanf(resolution, "-Y %d +X %d", &image.height, &image.width) != 2 || image.width <= 0 || image.height <= 0) {
+        error = "unsupported HDR format or orientation";
+        return false;
+    }
+
+    image.texels.resize(static_cast<size_t>(image.width) * image.height * 3);
+    std::vector<unsigned char> scanline(static_cast<size_t>(image.width) * 4);
+
+    for (int row = 0; row < image.height; row++) {
+        if (end - p < 4) {
+            error = "truncated HDR pixels";
+            return false;
+        }
+
+        bool encoded = image.width >= 8 && image.width < 32768 && p[0] == 2 && p[1] == 2 && ((p[2] << 8) | p[3]) == image.width;
+        if (encoded) {
+            // Each of the four components is stored separately as runs and literals
+            p += 4;
+            for (int c = 0; c < 4; c++) {
+                int x = 0;
+                while (x < image.width) {
+                    if (p >= end) {
+                        error = "truncated HDR pixels";
+                        return false;
+                    }
+                    int count = *p++;
+                    if (count > 128) {
+                        count -= 128;
+                        if (x + count > image.width || p >= end) {
+                            error = "bad HDR run";
+                            return false;
+                        }
+                        for (int k = 0; k < count; k++) scanline[(x++) * 4 + c] = *p;
+                        p++;
+                    }
+                    else {
+                        if (count == 0 || x + count > image.width || end - p < count) {
+                            error = "bad HDR run";
+                            return false;
+                        }
+                        for (int k = 0; k < count; k++) scanline[(x++) * 4 + c] = *p++;
+                    }
+                }
+            }
+        }
+        else {
+            if (static_cast<size_t>(end - p) < scanline.size()) {
+                error = "truncated HDR pixels";
+                return false;
+            }
+            memcpy(scanline.data(), p, scanline.size());
+            p += scanline.size();
+        }
+
+        for (int x = 0; x < image.width; x++) {
+            const unsigned char* rgbe = &scanline[static_cast<size_t>(x) * 4];
+            double f = rgbe[3] == 0 ? 0.0 : ldexp(1.0, rgbe[3] - (128 + 8));
+            for (int c = 0; c < 3; c++) {
+                image.texels[(static_cast<size_t>(row) * image.width + x) * 3 + c] = static_cast<float>(rgbe[c] * f);
+            }
+        }
+    }
+    return true;
+}
+
+// Binary PPM (P6) with 8 bit samples, stored with the same gamma 2 the renderer writes
+inline bool decode_ppm(const mapped_file& file, image_data& image, std::string& error) {
+    const unsigned char* p = file.data();
+    const unsigned char* end = p + file.size();
+    char magic[8], w[32], h[32], maximum[32];
+    if (!read_header_token(p, end, magic, sizeof(magic)) || !read_header_token(p, end, w, sizeof(w)) ||
+        !read_header_token(p, end, h, sizeof(h)) || !read_header_token(p, end, maximum, sizeof(maximum))) {
+        error = "bad PPM header";
+        return false;
+    }
+    p++;
+
+    image.width = atoi(w);
+    image.height = atoi(h);
+    size_t count = static_cast<size_t>(image.width) * image.height * 3;
+    if (strcmp(magic, "P6") != 0 || atoi(maximum) != 255 || image.width <= 0 || image.height <= 0 ||
+        static_cast<size_t>(end - p) < count) {
+        error = "unsupported PPM, only 8 bit P6 is read";
+        return false;
+    }
+
+    image.texels.resize(count);
+    for (size_t i = 0; i < count; i++) {
+        double value = p[i] / 255.0;
+        image.texels[i] = static_cast<float>(value * value);
+    }
+    return true;
+}
+
+// Uncompressed 24 bit BMP, as written by encode_bmp(), with gamma 2
+inline bool decode_bmp(const mapped_file& file, image_data& image, std::string& error) {
+    const unsigned char* data = file.data();
+    if (file.size() < 54) {
+        error = "truncated BMP header";
+        return false;
+    }
+
+    uint32_t offset;
+    int32_t w, h;
+    uint16_t bits;
+    uint32_t compression;
+    memcpy(&offset, data + 10, 4);
+    memcpy(&w, data + 18, 4);
+    memcpy(&h, data + 22, 4);
+    memcpy(&bits, data + 28, 2);
+    memcpy(&compression, data + 30, 4);
+
+    bool bottom_up = h > 0;
+    image.width = w;
+    image.height = bottom_up ? h : -h;
+    size_t row_size = (static_cast<size_t>(image.width) * 3 + 3) & ~static_cast<size_t>(3);
+    if (bits != 24 || compression != 0 || image.width <= 0 || image.height <= 0 ||
+        file.size() < offset + row_size * image.height) {
+        error = "unsupported BMP, only uncompressed 24 bit is read";
+        return false;
+    }
+
+    image.texels.resize(static_cast<size_t>(image.width) * image.height * 3);
+    for (int row = 0; row < image.height; row++) {
+        const unsigned char* line = data + offset + row_size * (bottom_up ? image.height - 1 - row : row);
+        for (int x = 0; x < image.width; x++) {
+            for (int c = 0; c < 3; c++) {
+                double value = line[x * 3 + 2 - c] / 255.0; // Stored as BGR
+                image.texels[(static_cast<size_t>(row) * image.width + x) * 3 + c] = static_cast<float>(value * value);
+            }
+        }
+    }
+    return true;
+}
+
+// Read a .pfm, .hdr, .ppm or .bmp file through a memory mapping, recognized by its contents.
+// Returns false and sets error on failure.
+inline bool load_image(const std::string& path, image_data& image, std::string& error) {
+    mapped_file file;
+    if (!file.open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+
+    const unsigned char* d = file.data();
+    bool ok;
+    if (file.size() >= 2 && d[0] == 'P' && (d[1] == 'F' || d[1] == 'f')) {
+        ok = decode_pfm(file, image, error);
+    }
+    else if (file.size() >= 2 && d[0] == '#' && d[1] == '?') {
+        ok = decode_hdr(file, image, error);
+    }
+    else if (file.size() >= 2 && d[0] == 'P' && d[1] == '6') {
+        ok = decode_ppm(file, image, error);
+    }
+    else if (file.size() >= 2 && d[0] == 'B' && d[1] == 'M') {
+        ok = decode_bmp(file, image, error);
+    }
+    else {
+        error = "unknown image format";
+        ok = false;
+    }
+
+    if (!ok) {
+        error = path + ": " + error;
+        image = image_data();
+    }
+    return ok;
+}
+
+#endif
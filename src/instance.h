@@ -0,0 +1,200 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+
+// Affine map p -> M p + t, stored as the rows of [M | t]. Plain data, so it can be
+// stored in files and used from a mapping, see scene_file.h.
+struct affine_transform {
+    double m[12];
+
+    static affine_transform identity() {
+        return affine_transform{ { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, 1, 0 } };
+    }
+
+    static affine_transform translation(const vector3d& offset) {
+        return affine_transform{ { 1, 0, 0, offset.x(), 0, 1, 0, offset.y(), 0, 0, 1, offset.z() } };
+    }
+
+    static affine_transform scaling(double sx, double sy, double sz) {
+        return affine_transform{ { sx, 0, 0, 0, 0, sy, 0, 0, 0, 0, sz, 0 } };
+    }
+
+    // Counterclockwise looking down the axis
+    static affine_transform rotation(const vector3d& axis, double degrees) {
+        vector3d a = unit_vector(axis);
+        double c = cos(degrees_to_radians(degrees));
+        double s = sin(degrees_to_radians(degrees));
+        double x = a.x(), y = a.y(), z = a.z();
+        return affine_transform{ { c + x * x * (1 - c), x * y * (1 - c) - z * s, x * z * (1 - c) + y * s, 0,
+                                   y * x * (1 - c) + z * s, c + y * y * (1 - c), y * z * (1 - c) - x * s, 0,
+                                   z * x * (1 - c) - y * s, z * y * (1 - c) + x * s, c + z * z * (1 - c), 0 } };
+    }
+
+    // This transform followed by next
+    affine_transform then(const affine_transform& next) const {
+        affine_transform out;
+        for (int row = 0; row < 3; row++) {
+            for (int col = 0; col < 4; col++) {
+                const double* n = &next.m[4 * row];
+                out.m[4 * row + col] = n[0] * m[col] + n[1] * m[4 + col] + n[2] * m[8 + col] + (col == 3 ? n[3] : 0);
+            }
+        }
+        return out;
+    }
+
+    point3d point(const point3d& p) const {
+        return point3d(m[0] * p.x() + m[1] * p.y() + m[2] * p.z() + m[3],
+                       m[4] * p.x() + m[5] * p.y() + m[6] * p.z() + m[7],
+                       m[8] * p.x() + m[9] * p.y() + m[10] * p.z() + m[11]);
+    }
+
+    vector3d vector(const vector3d& v) const {
+        return vector3d(m[0] * v.x() + m[1] * v.y() + m[2] * v.z(),
+                        m[4] * v.x() + m[5] * v.y() + m[6] * v.z(),
+                        m[8] * v.x() + m[9] * v.y() + m[10] * v.z());
+    }
+
+    // Transpose of the linear part times v. Normals map to world space by the transpose of
+    // the inverse transform.
+    vector3d transposed_vector(const vector3d& v) const {
+        return vector3d(m[0] * v.x() + m[4] * v.y() + m[8] * v.z(),
+                        m[1] * v.x() + m[5] * v.y() + m[9] * v.z(),
+                        m[2] * v.x() + m[6] * v.y() + m[10] * v.z());
+    }
+
+    double determinant() const {
+        return m[0] * (m[5] * m[10] - m[6] * m[9]) - m[1] * (m[4] * m[10] - m[6] * m[8]) +
+               m[2] * (m[4] * m[9] - m[5] * m[8]);
+    }
+
+    affine_transform inverse() const {
+        double d = 1 / determinant();
+        affine_transform out;
+        out.m[0] = (m[5] * m[10] - m[6] * m[9]) * d;
+        out.m[1] = (m[2] * m[9] - m[1] * m[10]) * d;
+        out.m[2] = (m[1] * m[6] - m[2] * m[5]) * d;
+        out.m[4] = (m[6] * m[8] - m[4] * m[10]) * d;
+        out.m[5] = (m[0] * m[10] - m[2] * m[8]) * d;
+        out.m[6] = (m[2] * m[4] - m[0] * m[6]) * d;
+        out.m[8] = (m[4] * m[9] - m[5] * m[8]) * d;
+        out.m[9] = (m[1] * m[8] - m[0] * m[9]) * d;
+        out.m[10] = (m[0] * m[5] - m[1] * m[4]) * d;
+        vector3d t = out.vector(vector3d(m[3], m[7], m[11]));
+        out.m[3] = -t.x();
+        out.m[7] = -t.y();
+        out.m[11] = -t.z();
+        return out;
+    }
+
+    // Box around the transformed corners of box
+    aabb box(const aabb& box) const {
+        if (!box.is_bounded()) {
+            return box.is_empty() ? box : aabb::universe;
+        }
+        aabb out;
+        for (int corner = 0; corner < 8; corner++) {
+            point3d p = point(point3d(corner & 1 ? box.x.max : box.x.min, corner & 2 ? box.y.max : box.y.min,
+                                      corner & 4 ? box.z.max : box.z.min));
+            out = aabb(out, aabb(p, p));
+        }
+        return out;
+    }
+};
+
+// An object placed in the world by an affine transform, so one mesh can appear many times.
+// Rays are taken to the object's space and hits brought back. Light sampling through an
+// instance is exact for rotations, translations and uniform scales.
+//
+//     auto tree = make_shared<triangle_mesh>(buffers, bark);
+//     world.add(make_shared<instance>(tree, affine_transform::rotation(vector3d(0, 1, 0), 30)
+//                                               .then(affine_transform::translation(vector3d(4, 0, 2)))));
+class instance : public hittable {
+  public:
+    instance(shared_ptr<hittable> _object, const affine_transform& _to_world)
+        : object(_object), to_world(_to_world), to_object(_to_world.inverse()) {
+        bbox = to_world.box(object->bounding_box());
+    }
+
+    // Shared with instances stored in flat arrays, which have no instance object
+    static ray object_ray(const ray& r, const affine_transform& to_object, double scale) {
+        vector3d direction = to_object.vector(r.direction());
+        double length = direction.length();
+        double spread = length > 0 ? r.spread() * r.direction().length() / length : 0;
+        return ray(to_object.point(r.origin()), direction, r.width() / scale, spread / scale);
+    }
+
+    static void world_hit(const affine_transform& to_world, const affine_transform& to_object, hit_record& rec) {
+        rec.p = to_world.point(rec.p);
+        rec.normal = unit_vector(to_object.transposed_vector(rec.normal));
+    }
+
+    // Length in world units of a unit length in the object, in the mean
+    static double linear_scale(const affine_transform& to_world) {
+        return cbrt(fabs(to_world.determinant()));
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!object->hit(object_ray(r, to_object, linear_scale(to_world)), ray_t, rec)) {
+            return false;
+        }
+        world_hit(to_world, to_object, rec);
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    bool contains_medium() const override {
+        return object->contains_medium();
+    }
+
+    bool hit_surface(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!object->hit_surface(object_ray(r, to_object, linear_scale(to_world)), ray_t, rec)) {
+            return false;
+        }
+        world_hit(to_world, to_object, rec);
+        return true;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override {
+        return object->transmittance(object_ray(r, to_object, linear_scale(to_world)), ray_t);
+    }
+
+    bool is_emissive() const override {
+        return object->is_emissive();
+    }
+
+    // Areas grow with the square of the scale
+    double emitted_power() const override {
+        double scale = linear_scale(to_world);
+        return object->emitted_power() * scale * scale;
+    }
+
+    bool emission_cone(vector3d& axis, double& theta_o, double& theta_e) const override {
+        if (!object->emission_cone(axis, theta_o, theta_e)) {
+            return false;
+        }
+        axis = unit_vector(to_object.transposed_vector(axis));
+        return true;
+    }
+
+    double pdf_value(const point3d& origin, const vector3d& direction) const override {
+        return object->pdf_value(to_object.point(origin), to_object.vector(direction));
+    }
+
+    vector3d random(const point3d& origin) const override {
+        return to_world.vector(object->random(to_object.point(origin)));
+    }
+
+  private:
+    shared_ptr<hittable> object;
+    affine_transform to_world;
+    affine_transform to_object;
+    aabb bbox;
+};
+
+#endif
@@ -10,6 +10,13 @@ class interval {
 
     interval(double _min, double _max) : min(_min), max(_max) {}
 
+    // Smallest interval enclosing both
+    interval(const interval& a, const interval& b) : min(fmin(a.min, b.min)), max(fmax(a.max, b.max)) {}
+
+    double size() const {
+        return max - min;
+    }
+
     bool contains(double x) const {
         return min <= x && x <= max;
     }
@@ -0,0 +1,263 @@
+#ifndef LIGHT_BVH_H
+#define LIGHT_BVH_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "hittable_list.h"
+
+#include <algorithm>
+#include <vector>
+
+// Light list for scenes with many lights. A hierarchy over the lights bounds their
+// position, power and emission directions, so a light is picked in O(log L) with
+// probability roughly proportional to its contribution at the shading point.
+//
+//     cam.lights = make_shared<light_bvh>(*scene_lights(world));
+class light_bvh : public hittable {
+  private:
+    struct light_node {
+        aabb bounds;
+        double power;
+        vector3d axis;  // Emission cone, see hittable::emission_cone()
+        double theta_o; // pi for lights emitting in every direction
+        double theta_e;
+        int left;       // Children, or -1 for a leaf
+        int right;
+        int light;      // Light of a leaf
+    };
+
+    std::vector<shared_ptr<hittable>> lights;
+    std::vector<light_node> nodes;
+
+    static double angle_between(const vector3d& a, const vector3d& b) {
+        double cos_theta = dot(unit_vector(a), unit_vector(b));
+        return std::acos(cos_theta < -1 ? -1 : (cos_theta > 1 ? 1 : cos_theta));
+    }
+
+    // Rotate v around the unit axis by angle (Rodrigues)
+    static vector3d rotate(const vector3d& v, const vector3d& axis, double angle) {
+        return cos(angle) * v + sin(angle) * cross(axis, v) + (1 - cos(angle)) * dot(axis, v) * axis;
+    }
+
+    // Smallest cone enclosing the emission cones of both nodes
+    static void merge_cones(const light_node& a, const light_node& b, light_node& out) {
+        out.theta_e = fmax(a.theta_e, b.theta_e);
+        out.axis = a.axis;
+        out.theta_o = pi;
+        if (a.theta_o >= pi || b.theta_o >= pi) {
+            return;
+        }
+
+        const light_node& wide = a.theta_o >= b.theta_o ? a : b;
+        const light_node& narrow = a.theta_o >= b.theta_o ? b : a;
+        double theta_d = angle_between(wide.axis, narrow.axis);
+        if (fmin(theta_d + narrow.theta_o, pi) <= wide.theta_o) {
+            out.axis = wide.axis;
+            out.theta_o = wide.theta_o;
+            return;
+        }
+
+        double theta_o = 0.5 * (wide.theta_o + theta_d + narrow.theta_o);
+        vector3d rotation_axis = cross(wide.axis, narrow.axis);
+        if (theta_o >= pi || rotation_axis.length_squared() < 1e-12) {
+            return;
+        }
+
+        out.axis = unit_vector(rotate(unit_vector(wide.axis), unit_vector(rotation_axis), theta_o - wide.theta_o));
+        out.theta_o = theta_o;
+    }
+
+    // Build the subtree over indices [begin, end), returns its node
+    int build(std::vector<int>& indices, size_t begin, size_t end) {
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(light_node());
+
+        if (end - begin == 1) {
+            const hittable& light = *lights[indices[begin]];
+            light_node leaf;
+            leaf.bounds = light.bounding_box();
+            leaf.power = light.emitted_power();
+            leaf.axis = vector3d(0, 0, 1);
+            leaf.theta_o = pi;
+            leaf.theta_e = pi / 2;
+            if (!light.emission_cone(leaf.axis, leaf.theta_o, leaf.theta_e)) {
+                leaf.axis = vector3d(0, 0, 1);
+                leaf.theta_o = pi;
+                leaf.theta_e = pi / 2;
+            }
+            leaf.left = leaf.right = -1;
+            leaf.light = indices[begin];
+            nodes[index] = leaf;
+            return index;
+        }
+
+        // Split at the median along the widest axis of the light centers
+        aabb centers;
+        for (size_t k = begin; k < end; k++) {
+            point3d c = lights[indices[k]]->bounding_box().centroid();
+            centers = aabb(centers, aabb(c, c));
+        }
+        int axis = 0;
+        if (centers.y.size() > centers.axis(axis).size()) axis = 1;
+        if (centers.z.size() > centers.axis(axis).size()) axis = 2;
+
+        size_t middle = begin + (end - begin) / 2;
+        std::nth_element(indices.begin() + begin, indices.begin() + middle, indices.begin() + end, [&](int a, int b) {
+            return lights[a]->bounding_box().centroid()[axis] < lights[b]->bounding_box().centroid()[axis];
+        });
+
+        int left = build(indices, begin, middle);
+        int right = build(indices, middle, end);
+
+        light_node node;
+        node.bounds = aabb(nodes[left].bounds, nodes[right].bounds);
+        node.power = nodes[left].power + nodes[right].power;
+        merge_cones(nodes[left], nodes[right], node);
+        node.left = left;
+        node.right = right;
+        node.light = -1;
+        nodes[index] = node;
+        return index;
+    }
+
+    // Estimated contribution of a node's lights at point p
+    static double importance(const light_node& node, const point3d& p) {
+        if (node.power <= 0) {
+            return 0.0;
+        }
+
+        point3d center = node.bounds.centroid();
+        vector3d half_diagonal = 0.5 * vector3d(node.bounds.x.size(), node.bounds.y.size(), node.bounds.z.size());
+        double radius_squared = half_diagonal.length_squared();
+        double distance_squared = (p - center).length_squared();
+        double d2 = fmax(distance_squared, radius_squared);
+
+        if (node.theta_o >= pi) {
+            return node.power / d2;
+        }
+
+        // Smallest angle between the emission cone and the direction towards p,
+        // widened by the angle the bounds subtend at p
+        double theta_w = angle_between(node.axis, p - center);
+        double theta_b = distance_squared > radius_squared ? std::asin(sqrt(radius_squared / distance_squared)) : pi;
+        double theta_x = fmax(0.0, theta_w - node.theta_o - theta_b);
+        if (theta_x >= node.theta_e) {
+            return 0.0;
+        }
+        return node.power * cos(theta_x) / d2;
+    }
+
+  public:
+    light_bvh(const hittable_list& list) {
+        for (const auto& object : list.objects) {
+            if (object->emitted_power() > 0) {
+                lights.push_back(object);
+            }
+        }
+
+        std::vector<int> indices(lights.size());
+        for (size_t k = 0; k < indices.size(); k++) {
+            indices[k] = static_cast<int>(k);
+        }
+        if (!indices.empty()) {
+            nodes.reserve(2 * indices.size());
+            build(indices, 0, indices.size());
+        }
+    }
+
+    size_t size() const {
+        return lights.size();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        bool hit_anything = false;
+        std::vector<int> stack(1, 0);
+        while (!stack.empty()) {
+            const light_node& node = nodes[stack.back()];
+            stack.pop_back();
+            if (!node.bounds.hit(r, ray_t)) {
+                continue;
+            }
+
+            if (node.light >= 0) {
+                if (lights[node.light]->hit(r, ray_t, rec)) {
+                    hit_anything = true;
+                    ray_t.max = rec.t;
+                }
+            }
+            else {
+                stack.push_back(node.left);
+                stack.push_back(node.right);
+            }
+        }
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override {
+        return nodes.empty() ? aabb() : nodes[0].bounds;
+    }
+
+    // Sum over the lights the direction reaches of their selection probability times their density
+    double pdf_value(const point3d& origin, const vector3d& direction) const override {
+        if (nodes.empty()) {
+            return 0.0;
+        }
+
+        ray r(origin, direction);
+        double pdf = 0.0;
+
+        struct pending { int node; double probability; };
+        std::vector<pending> stack(1, pending{ 0, 1.0 });
+        while (!stack.empty()) {
+            pending item = stack.back();
+            stack.pop_back();
+
+            const light_node& node = nodes[item.node];
+            if (node.light >= 0) {
+                pdf += item.probability * lights[node.light]->pdf_value(origin, direction);
+                continue;
+            }
+
+            double left = importance(nodes[node.left], origin);
+            double right = importance(nodes[node.right], origin);
+            if (left + right <= 0) {
+                continue;
+            }
+
+            if (left > 0 && nodes[node.left].bounds.hit(r, interval(0.001, infinity))) {
+                stack.push_back(pending{ node.left, item.probability * left / (left + right) });
+            }
+            if (right > 0 && nodes[node.right].bounds.hit(r, interval(0.001, infinity))) {
+                stack.push_back(pending{ node.right, item.probability * right / (left + right) });
+            }
+        }
+        return pdf;
+    }
+
+    // Descend from the root choosing children by importance, then sample the light reached
+    vector3d random(const point3d& origin) const override {
+        if (nodes.empty()) {
+            return vector3d(0, 0, 0);
+        }
+
+        int index = 0;
+        while (nodes[index].light < 0) {
+            const light_node& node = nodes[index];
+            double left = importance(nodes[node.left], origin);
+            double right = importance(nodes[node.right], origin);
+            // No light below can reach origin, pdf_value() gives none of them weight either
+            if (left + right <= 0) {
+                return vector3d(0, 0, 0);
+            }
+            index = random_double() * (left + right) < left ? node.left : node.right;
+        }
+        return lights[nodes[index].light]->random(origin);
+    }
+};
+
+#endif
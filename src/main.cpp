@@ -1,12 +1,19 @@
 #include "rtweekend.h"
 #include "camera.h"
 #include "color.h"
+#include "distributed.h"
+#include "farm.h"
 #include "hittable_list.h"
 #include "material.h"
+#include "scene_description.h"
+#include "sequence.h"
 #include "sphere.h"
 
 #include "scene01.h"
 
+#include <cstdlib>
+#include <cstring>
+#include <string>
 #include <thread>
 
 void to_polar_coordinates(double x, double y, double &r, double &theta) {
@@ -35,11 +42,76 @@ void to_polar_coordinates(double x, double y, double &r, double &theta) {
     return;
 }
 
-int main() {
-    // World
-    hittable_list world = get_scene_01();
+int main(int argc, char** argv) {
+    // Distributed rendering options
+    int local_workers = 0;             // --workers N: render with N local worker processes
+    std::string worker_socket;         // --worker PATH: serve tiles to the coordinator at PATH
+    std::string socket_path = "/tmp/miniray.sock"; // --socket PATH: coordinator socket
+    std::string manifest_path;         // --manifest PATH: render the frames of a shared job manifest
+    int single_frame = -1;             // --frame N: render only frame N
+    std::string checkpoint_path;       // --checkpoint PATH: checkpoint and resume a single frame render
+    bool deterministic = false;        // --deterministic: same image for any thread count or worker layout
+    std::string environment_path;      // --environment PATH: light the scene with a .pfm or .hdr environment map
 
-    // Camera
+    // Scene and render settings, given on the command line override the scene's
+    std::string scene_path;            // --scene PATH: render a scene description instead of scene 1
+    int image_width = 0;               // --width N: image width in pixels
+    int image_height = 0;              // --height N: image height in pixels
+    int samples_per_pixel = 0;         // --spp N: samples per pixel
+    int max_depth = 0;                 // --depth N: maximum number of bounces
+    int threads = std::thread::hardware_concurrency(); // --threads N: render threads
+    std::string output_path;           // --output PATH: render one image to PATH instead of the orbit
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            local_workers = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--worker") == 0 && i + 1 < argc) {
+            worker_socket = argv[++i];
+        }
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) {
+            socket_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--manifest") == 0 && i + 1 < argc) {
+            manifest_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--frame") == 0 && i + 1 < argc) {
+            single_frame = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--checkpoint") == 0 && i + 1 < argc) {
+            checkpoint_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--deterministic") == 0) {
+            deterministic = true;
+        }
+        else if (strcmp(argv[i], "--environment") == 0 && i + 1 < argc) {
+            environment_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--scene") == 0 && i + 1 < argc) {
+            scene_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--width") == 0 && i + 1 < argc) {
+            image_width = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--height") == 0 && i + 1 < argc) {
+            image_height = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--spp") == 0 && i + 1 < argc) {
+            samples_per_pixel = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc) {
+            max_depth = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = std::max(1, atoi(argv[++i]));
+        }
+        else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output_path = argv[++i];
+        }
+    }
+
+    // World and camera
+    hittable_list world;
     camera cam;
 
     cam.image_width       = 300;
@@ -47,52 +119,139 @@ int main() {
     cam.samples_per_pixel = 20;
     cam.max_depth         = 20;
 
-    // cam.vfov     = 17;
-    // cam.lookfrom = point3d(0, 10, 0);
-    // cam.lookat   = point3d(0, 0, 0);
-    // cam.vup      = vector3d(0, 0, -1);
+    if (!scene_path.empty()) {
+        std::string error;
+        if (!load_scene_description(scene_path, world, cam, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
+    else {
+        world = get_scene_01();
+
+        // Scene 1, cam settings
+        cam.vfov     = 20;
+        cam.lookfrom = point3d(13, 2, 3);
+        cam.lookat   = point3d(0, 0, 0);
+        cam.vup      = vector3d(0, 1, 0);
+
+        cam.defocus_angle = 0.6;
+        cam.focus_dist    = 10.0;
+    }
+
+    if (image_width > 0) cam.image_width = image_width;
+    if (image_height > 0) cam.image_height = image_height;
+    if (samples_per_pixel > 0) cam.samples_per_pixel = samples_per_pixel;
+    if (max_depth > 0) cam.max_depth = max_depth;
+
+    if (!worker_socket.empty()) {
+        render_worker worker;
+        return worker.run(worker_socket, world, threads);
+    }
+
+    cam.deterministic = deterministic;
+
+    if (!environment_path.empty()) {
+        std::string error;
+        cam.environment = make_shared<environment_map>();
+        if (!cam.environment->load(environment_path, error)) {
+            std::cerr << error << "\n";
+            return 1;
+        }
+    }
 
-    // cam.defocus_angle = 0.1;
-    // cam.focus_dist    = 29.0;
+    // Orbit the camera around the vertical axis, one degree per frame
+    double orbit_radius = 0;
+    double orbit_theta = 0;
+    to_polar_coordinates(cam.lookfrom.x(), cam.lookfrom.z(), orbit_radius, orbit_theta);
+    double orbit_height = cam.lookfrom.y();
 
-    // Scene 1, cam settings
-    cam.vfov     = 20;
-    cam.lookfrom = point3d(13, 2, 3);
-    cam.lookat   = point3d(0, 0, 0);
-    cam.vup      = vector3d(0, 1, 0);
-    
-    cam.defocus_angle = 0.6;
-    cam.focus_dist    = 10.0;
+    auto orbit = [=](int frame, camera& frame_cam) {
+        double theta = orbit_theta + frame * 0.0174533;
+        frame_cam.lookfrom = point3d(orbit_radius * cos(theta), orbit_height, orbit_radius * sin(theta));
+    };
 
-    cam.max_threads = std::thread::hardware_concurrency();
+    if (single_frame >= 0 || !output_path.empty()) {
+        // Single frame, optionally checkpointed so it can be stopped with SIGTERM and resumed
+        if (single_frame >= 0) {
+            orbit(single_frame, cam);
+        }
 
-    for (int i = 0; i < 360; i++) {
-        // Render
-        cam.render(world);
+        if (local_workers > 0) {
+            // Tiles of the frame are spread over the worker processes
+            render_coordinator coordinator(socket_path);
+            if (!coordinator.listen()) {
+                return 1;
+            }
+            coordinator.spawn_local_workers(local_workers, world, std::max(1, threads / local_workers));
+            coordinator.render(cam, world);
+            coordinator.shutdown();
+        }
+        else {
+            cam.max_threads = threads;
+            cam.checkpoint_file = checkpoint_path;
+            cam.render(world);
 
-        // Write rendered image to bitmap file
-        std::string filename = "render/frame" + std::to_string(i) + ".bmp";
+            if (!cam.is_complete()) {
+                return 143;
+            }
+        }
+
+        std::string filename = !output_path.empty() ? output_path : "render/frame" + std::to_string(single_frame) + ".bmp";
         std::clog << "\n\nSaving " << filename << "...\n" << std::flush;
         cam.write_image(filename);
-        std::clog << "\nDone\n";
+        return 0;
+    }
+
+    if (!manifest_path.empty()) {
+        // Render farm, frames are claimed through lock files shared with other processes
+        job_manifest manifest;
+        std::string error;
+        if (!manifest.load(manifest_path, error)) {
+            std::cerr << "Invalid manifest: " << error << "\n";
+            return 1;
+        }
+
+        cam.max_threads = threads;
+        return render_manifest(manifest, world, cam, orbit) < 0 ? 1 : 0;
+    }
 
-        // Update frame
-        double x = cam.lookfrom.x();
-        double y = cam.lookfrom.y();
-        double z = cam.lookfrom.z();
-        
-        double r = 0;
-        double theta = 0;
-        
-        to_polar_coordinates(x, z, r, theta);
+    if (local_workers > 0) {
+        // Coordinator, tiles of each frame are spread over the worker processes
+        render_coordinator coordinator(socket_path);
+        if (!coordinator.listen()) {
+            return 1;
+        }
 
-        theta += 0.0174533;
+        int threads_per_worker = std::max(1, threads / local_workers);
+        coordinator.spawn_local_workers(local_workers, world, threads_per_worker);
 
-        x = r * cos(theta);
-        z = r * sin(theta);
+        for (int frame = 0; frame < 360; frame++) {
+            orbit(frame, cam);
+            coordinator.render(cam, world);
 
-        cam.lookfrom = point3d(x, y, z);
+            std::string filename = "render/frame" + std::to_string(frame) + ".bmp";
+            std::clog << "\n\nSaving " << filename << "...\n" << std::flush;
+            cam.write_image(filename);
+        }
+
+        coordinator.shutdown();
+        std::clog << "\nDone\n";
+        return 0;
     }
 
+    sequence_renderer sequence;
+    sequence.max_threads = threads;
+    sequence.setup_frame = orbit;
+
+    sequence.frame_filename = [](int frame) {
+        return "render/frame" + std::to_string(frame) + ".bmp";
+    };
+
+    // Render, frames are written to bitmap files while the next ones render
+    sequence.render_pipelined(world, cam, 0, 360);
+
+    std::clog << "\nDone\n";
+
     return 0;
 }
\ No newline at end of file
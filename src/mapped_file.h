@@ -0,0 +1,65 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read only memory mapping of a whole file, unmapped on destruction
+class mapped_file {
+  private:
+    const unsigned char* bytes = nullptr;
+    size_t length = 0;
+
+  public:
+    mapped_file() {}
+    mapped_file(const mapped_file&) = delete;
+    mapped_file& operator=(const mapped_file&) = delete;
+
+    ~mapped_file() {
+        close();
+    }
+
+    // Map the file at path. Returns false if it can not be opened or is empty.
+    bool open(const std::string& path) {
+        close();
+
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* mapping = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (mapping == MAP_FAILED) {
+            return false;
+        }
+
+        bytes = static_cast<const unsigned char*>(mapping);
+        length = static_cast<size_t>(info.st_size);
+        return true;
+    }
+
+    void close() {
+        if (bytes) {
+            munmap(const_cast<unsigned char*>(bytes), length);
+        }
+        bytes = nullptr;
+        length = 0;
+    }
+
+    const unsigned char* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+#endif
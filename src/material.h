@@ -4,32 +4,66 @@
 #include "rtweekend.h"
 #include "hittable.h"
 #include "color.h"
+#include "onb.h"
+#include "texture.h"
 
 class material {
   public:
     virtual ~material() = default;
 
     virtual bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const = 0;
+
+    // Radiance emitted towards the origin of r_in
+    virtual color emitted(const ray& r_in, const hit_record& rec) const {
+        return color(0, 0, 0);
+    }
+
+    virtual bool is_emissive() const {
+        return false;
+    }
+
+    // Radiance leaving an emitting surface, used to estimate the power of lights
+    virtual color emission() const {
+        return color(0, 0, 0);
+    }
+
+    // BSDF times cosine for light arriving along scattered, zero for specular materials
+    virtual color scattering(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return color(0, 0, 0);
+    }
+
+    // Solid angle density of scatter() picking the direction of scattered, zero for specular
+    // materials. Materials with a non-zero density are lit by explicit light samples.
+    virtual double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const {
+        return 0.0;
+    }
 };
 
 class lambertian : public material {
   public:
-    lambertian(const color& a) : albedo(a) {}
+    lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
+    lambertian(shared_ptr<texture> a) : albedo(a) {}
 
     bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
-        auto scatter_direction = rec.normal + random_unit_vector();
+        // Cosine weighted around the normal
+        onb uvw(rec.normal);
+        scattered = ray(rec.p, uvw.transform(random_cosine_direction()));
+        attenuation = albedo->value(rec);
+        return true;
+    }
 
-        // Catch degenerate scatter direction
-        if (scatter_direction.near_zero())
-            scatter_direction = rec.normal;
+    color scattering(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+        return albedo->value(rec) * scattering_pdf(r_in, rec, scattered);
+    }
 
-        scattered = ray(rec.p, scatter_direction);
-        attenuation = albedo;
-        return true;
+    // scatter() is cosine weighted
+    double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+        double cos_theta = dot(rec.normal, unit_vector(scattered.direction()));
+        return cos_theta < 0 ? 0 : cos_theta / pi;
     }
 
   private:
-    color albedo;
+    shared_ptr<texture> albedo;
 };
 
 class metal : public material {
@@ -83,4 +117,53 @@ class dielectric : public material {
     }
 };
 
+// Phase function of a medium, scatters equally in every direction
+class isotropic : public material {
+  public:
+    isotropic(const color& a) : albedo(make_shared<solid_color>(a)) {}
+    isotropic(shared_ptr<texture> a) : albedo(a) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        scattered = ray(rec.p, random_unit_vector());
+        attenuation = albedo->value(rec);
+        return true;
+    }
+
+    color scattering(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+        return albedo->value(rec) / (4 * pi);
+    }
+
+    double scattering_pdf(const ray& r_in, const hit_record& rec, const ray& scattered) const override {
+        return 1 / (4 * pi);
+    }
+
+  private:
+    shared_ptr<texture> albedo;
+};
+
+// Light source, emits from its front face and absorbs everything
+class emissive : public material {
+  public:
+    emissive(const color& _radiance) : radiance(_radiance) {}
+
+    bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered) const override {
+        return false;
+    }
+
+    color emitted(const ray& r_in, const hit_record& rec) const override {
+        return rec.front_face ? radiance : color(0, 0, 0);
+    }
+
+    bool is_emissive() const override {
+        return true;
+    }
+
+    color emission() const override {
+        return radiance;
+    }
+
+  private:
+    color radiance;
+};
+
 #endif
\ No newline at end of file
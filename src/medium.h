@@ -0,0 +1,307 @@
+#ifndef MEDIUM_H
+#define MEDIUM_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "hittable.h"
+#include "material.h"
+
+#include <algorithm>
+#include <vector>
+
+// Participating media: fog, smoke and other volumes that scatter light inside a boundary
+// object. hit() picks the point where a ray scatters, or misses if the ray passes through.
+// Shadow rays ask for transmittance() instead, which dims them rather than blocking them
+// at random. The boundary has to be closed and convex, a ray enters and leaves it once.
+
+// Part of r within ray_t inside the boundary, from t0 to t1
+inline bool medium_segment(const hittable& boundary, const ray& r, interval ray_t, double& t0, double& t1) {
+    hit_record entry, exit;
+    if (!boundary.hit(r, interval::universe, entry)) {
+        return false;
+    }
+    if (!boundary.hit(r, interval(entry.t + 0.0001, infinity), exit)) {
+        return false;
+    }
+
+    t0 = fmax(entry.t, fmax(ray_t.min, 0.0));
+    t1 = fmin(exit.t, ray_t.max);
+    return t0 < t1;
+}
+
+// Fills rec for a scattering event inside a medium
+inline void medium_event(const ray& r, double t, shared_ptr<material> phase_function, hit_record& rec) {
+    rec.t = t;
+    rec.p = r.at(t);
+    rec.normal = vector3d(1, 0, 0); // Arbitrary
+    rec.front_face = true;
+    rec.mat = phase_function;
+    rec.u = rec.v = 0;
+    rec.u_footprint = rec.v_footprint = 0;
+}
+
+// Medium of the same density everywhere, distances to scattering events and the
+// transmittance follow in closed form
+class constant_medium : public hittable {
+  public:
+    constant_medium(shared_ptr<hittable> b, double density, const color& albedo)
+        : boundary(b), neg_inv_density(-1 / density), sigma(density), phase_function(make_shared<isotropic>(albedo)) {}
+
+    constant_medium(shared_ptr<hittable> b, double density, shared_ptr<texture> albedo)
+        : boundary(b), neg_inv_density(-1 / density), sigma(density), phase_function(make_shared<isotropic>(albedo)) {}
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        double t0, t1;
+        if (!medium_segment(*boundary, r, ray_t, t0, t1)) {
+            return false;
+        }
+
+        double ray_length = r.direction().length();
+        double distance_inside_boundary = (t1 - t0) * ray_length;
+        double hit_distance = neg_inv_density * log(1 - random_double());
+        if (hit_distance > distance_inside_boundary) {
+            return false;
+        }
+
+        medium_event(r, t0 + hit_distance / ray_length, phase_function, rec);
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return boundary->bounding_box();
+    }
+
+    bool contains_medium() const override {
+        return true;
+    }
+
+    double transmittance(const ray& r, interval ray_t) const override {
+        double t0, t1;
+        if (!medium_segment(*boundary, r, ray_t, t0, t1)) {
+            return 1.0;
+        }
+        return exp(-sigma * (t1 - t0) * r.direction().length());
+    }
+
+  private:
+    shared_ptr<hittable> boundary;
+    double neg_inv_density;
+    double sigma;
+    shared_ptr<material> phase_function;
+};
+
+// Medium with density from a voxel grid spanning the boundary's bounding box, smoke for
+// example. Scattering events are found by delta tracking: tentative collisions are drawn
+// against an upper bound of the density (the majorant) and kept with probability
+// density / majorant. A coarse grid of majorants, walked cell by cell along the ray (DDA),
+// keeps the bound tight, so empty cells cost one step and dense ones few rejected samples.
+//
+//     std::vector<float> density(nx * ny * nz); // x fastest, then y, then z
+//     world.add(make_shared<grid_medium>(boundary, density, nx, ny, nz, 2.0, color(.8, .8, .8)));
+class grid_medium : public hittable {
+  public:
+    grid_medium(shared_ptr<hittable> b, std::vector<float> _density, int _nx, int _ny, int _nz, double _density_scale,
+                const color& albedo, int majorant_resolution = 16)
+        : boundary(b), density(std::move(_density)), density_scale(_density_scale),
+          phase_function(make_shared<isotropic>(albedo)) {
+        box = boundary->bounding_box();
+        n[0] = _nx;
+        n[1] = _ny;
+        n[2] = _nz;
+        for (int a = 0; a < 3; a++) {
+            m[a] = std::max(1, std::min(majorant_resolution, n[a]));
+            cell_size[a] = box.axis(a).size() / m[a];
+        }
+        build_majorants();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        double t0, t1;
+        if (!medium_segment(*boundary, r, ray_t, t0, t1)) {
+            return false;
+        }
+
+        // Delta tracking, restarted at each cell boundary since distances are memoryless
+        double ray_length = r.direction().length();
+        double collision = -1;
+        traverse(r, t0, t1, [&](double cell_t0, double cell_t1, double majorant) {
+            double t = cell_t0;
+            while (true) {
+                t -= log(1 - random_double()) / (majorant * ray_length);
+                if (t >= cell_t1) {
+                    return true;
+                }
+                if (random_double() * majorant < density_at(r.at(t))) {
+                    collision = t;
+                    return false;
+                }
+            }
+        });
+
+        if (collision < 0) {
+            return false;
+        }
+        medium_event(r, collision, phase_function, rec);
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return boundary->bounding_box();
+    }
+
+    bool contains_medium() const override {
+        return true;
+    }
+
+    // Ratio tracking: every tentative collision scales the estimate by the chance of passing
+    // it. Russian roulette ends paths through dense smoke early without bias.
+    double transmittance(const ray& r, interval ray_t) const override {
+        double t0, t1;
+        if (!medium_segment(*boundary, r, ray_t, t0, t1)) {
+            return 1.0;
+        }
+
+        double ray_length = r.direction().length();
+        double fraction = 1.0;
+        traverse(r, t0, t1, [&](double cell_t0, double cell_t1, double majorant) {
+            double t = cell_t0;
+            while (true) {
+                t -= log(1 - random_double()) / (majorant * ray_length);
+                if (t >= cell_t1) {
+                    return true;
+                }
+                fraction *= 1 - density_at(r.at(t)) / majorant;
+                if (fraction < 0.1) {
+                    if (random_double() < 0.5) {
+                        fraction = 0;
+                        return false;
+                    }
+                    fraction *= 2;
+                }
+            }
+        });
+        return fraction;
+    }
+
+  private:
+    shared_ptr<hittable> boundary;
+    std::vector<float> density; // x fastest, then y, then z
+    double density_scale;
+    shared_ptr<material> phase_function;
+
+    aabb box;                      // Covered by the grids
+    int n[3];                      // Voxels per axis
+    int m[3];                      // Majorant cells per axis
+    double cell_size[3];           // Of a majorant cell
+    std::vector<double> majorants; // Largest density in each cell, scaled
+
+    float voxel(int x, int y, int z) const {
+        return density[(static_cast<size_t>(z) * n[1] + y) * n[0] + x];
+    }
+
+    // Trilinear interpolation between voxel centers, scaled
+    double density_at(const point3d& p) const {
+        double f[3];
+        int i0[3], i1[3];
+        for (int a = 0; a < 3; a++) {
+            double x = (p[a] - box.axis(a).min) / box.axis(a).size() * n[a] - 0.5;
+            x = x < 0 ? 0 : (x > n[a] - 1 ? n[a] - 1 : x);
+            i0[a] = static_cast<int>(x);
+            i1[a] = i0[a] + 1 < n[a] ? i0[a] + 1 : i0[a];
+            f[a] = x - i0[a];
+        }
+
+        double c00 = voxel(i0[0], i0[1], i0[2]) * (1 - f[0]) + voxel(i1[0], i0[1], i0[2]) * f[0];
+        double c10 = voxel(i0[0], i1[1], i0[2]) * (1 - f[0]) + voxel(i1[0], i1[1], i0[2]) * f[0];
+        double c01 = voxel(i0[0], i0[1], i1[2]) * (1 - f[0]) + voxel(i1[0], i0[1], i1[2]) * f[0];
+        double c11 = voxel(i0[0], i1[1], i1[2]) * (1 - f[0]) + voxel(i1[0], i1[1], i1[2]) * f[0];
+        double c0 = c00 * (1 - f[1]) + c10 * f[1];
+        double c1 = c01 * (1 - f[1]) + c11 * f[1];
+        return density_scale * (c0 * (1 - f[2]) + c1 * f[2]);
+    }
+
+    // Each cell's bound covers every voxel the interpolation inside it can read
+    void build_majorants() {
+        majorants.assign(static_cast<size_t>(m[0]) * m[1] * m[2], 0.0);
+        int lo[3], hi[3];
+        for (int cz = 0; cz < m[2]; cz++) {
+            for (int cy = 0; cy < m[1]; cy++) {
+                for (int cx = 0; cx < m[0]; cx++) {
+                    int c[3] = { cx, cy, cz };
+                    for (int a = 0; a < 3; a++) {
+                        lo[a] = static_cast<int>(std::floor(static_cast<double>(c[a]) * n[a] / m[a] - 0.5));
+                        hi[a] = static_cast<int>(std::floor(static_cast<double>(c[a] + 1) * n[a] / m[a] - 0.5)) + 1;
+                        lo[a] = std::max(lo[a], 0);
+                        hi[a] = std::min(hi[a], n[a] - 1);
+                    }
+
+                    float largest = 0;
+                    for (int z = lo[2]; z <= hi[2]; z++) {
+                        for (int y = lo[1]; y <= hi[1]; y++) {
+                            for (int x = lo[0]; x <= hi[0]; x++) {
+                                largest = std::max(largest, voxel(x, y, z));
+                            }
+                        }
+                    }
+                    majorants[(static_cast<size_t>(cz) * m[1] + cy) * m[0] + cx] = density_scale * largest;
+                }
+            }
+        }
+    }
+
+    // Walk the majorant cells r crosses between t0 and t1 (Amanatides and Woo), calling
+    // visit(cell_t0, cell_t1, majorant) for cells with a non-zero bound until it returns false
+    template<typename F>
+    void traverse(const ray& r, double t0, double t1, F&& visit) const {
+        // The segment lies inside the boundary and so inside the box, cells are clamped
+        // against rounding at its faces
+        if (!box.hit(r, interval(t0, t1))) {
+            return;
+        }
+
+        point3d start = r.at(t0);
+        int cell[3], step[3];
+        double next[3], delta[3];
+        for (int a = 0; a < 3; a++) {
+            double x = (start[a] - box.axis(a).min) / cell_size[a];
+            cell[a] = std::max(0, std::min(m[a] - 1, static_cast<int>(std::floor(x))));
+
+            double d = r.direction()[a];
+            if (d > 0) {
+                step[a] = 1;
+                next[a] = (box.axis(a).min + (cell[a] + 1) * cell_size[a] - r.origin()[a]) / d;
+                delta[a] = cell_size[a] / d;
+            }
+            else if (d < 0) {
+                step[a] = -1;
+                next[a] = (box.axis(a).min + cell[a] * cell_size[a] - r.origin()[a]) / d;
+                delta[a] = -cell_size[a] / d;
+            }
+            else {
+                step[a] = 0;
+                next[a] = infinity;
+                delta[a] = infinity;
+            }
+        }
+
+        double t = t0;
+        while (t < t1) {
+            int a = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            double cell_t1 = fmin(next[a], t1);
+
+            double majorant = majorants[(static_cast<size_t>(cell[2]) * m[1] + cell[1]) * m[0] + cell[0]];
+            if (majorant > 0 && cell_t1 > t && !visit(t, cell_t1, majorant)) {
+                return;
+            }
+
+            t = cell_t1;
+            cell[a] += step[a];
+            next[a] += delta[a];
+            if (cell[a] < 0 || cell[a] >= m[a]) {
+                return;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,1037 @@
+#ifndef MESH_IO_H
+#define MESH_IO_H
+
+#include "mapped_file.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Wavefront OBJ and PLY loaders filling mesh_buffers. Files are memory mapped and split
+// into chunks at line boundaries (text) or record boundaries (binary) that threads parse
+// at the same time. A first pass counts each chunk's vertices, so the second writes them
+// straight to their place in the buffers; triangles are gathered per chunk and copied
+// together at the end. Polygons are split into fans of triangles.
+
+// How a load went, for reporting throughput
+struct mesh_load_stats {
+    size_t bytes = 0;
+    double seconds = 0;
+    int threads = 1;
+    bool zero_copy = false; // Positions are read from the mapped file in place
+
+    double megabytes_per_second() const {
+        return seconds > 0 ? bytes / seconds / 1e6 : 0;
+    }
+};
+
+// Number parsing without locale, null termination or errno; the file is not a C string
+
+inline void skip_blanks(const char*& p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) p++;
+}
+
+// Decimal number as in "-12.5e-3", correctly rounded. Digits up to 2^53 and powers of ten
+// up to 22 take Clinger's fast path; longer numbers, such as 17 digit round trip output,
+// go through strtod (in the C locale, which miniray never changes).
+inline bool parse_double(const char*& p, const char* end, double& value) {
+    static const double powers[23] = { 1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+                                       1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    skip_blanks(p, end);
+    const char* start = p;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+
+    uint64_t mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        if (mantissa < 1000000000000000000ULL) {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+        else {
+            exponent++;
+        }
+        digits = true;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+            if (mantissa < 1000000000000000000ULL) {
+                mantissa = mantissa * 10 + (*p - '0');
+                exponent--;
+            }
+            digits = true;
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p + 1;
+        bool negative_exponent = false;
+        if (q < end && (*q == '-' || *q == '+')) {
+            negative_exponent = *q == '-';
+            q++;
+        }
+        if (q < end && *q >= '0' && *q <= '9') {
+            int e = 0;
+            for (; q < end && *q >= '0' && *q <= '9'; q++) {
+                e = std::min(e * 10 + (*q - '0'), 10000);
+            }
+            exponent += negative_exponent ? -e : e;
+            p = q;
+        }
+    }
+
+    if ((mantissa > (1ULL << 53) || exponent < -22 || exponent > 22) && p - start < 64) {
+        char text[64];
+        memcpy(text, start, p - start);
+        text[p - start] = '\0';
+        value = strtod(text, nullptr);
+        return true;
+    }
+
+    double result = static_cast<double>(mantissa);
+    if (exponent < 0 && exponent >= -22) {
+        result /= powers[-exponent];
+    }
+    else if (exponent > 0 && exponent <= 22) {
+        result *= powers[exponent];
+    }
+    else if (exponent != 0) {
+        result *= std::pow(10.0, exponent);
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+inline bool parse_float(const char*& p, const char* end, float& value) {
+    double d;
+    if (!parse_double(p, end, d)) {
+        return false;
+    }
+    value = static_cast<float>(d);
+    return true;
+}
+
+inline bool parse_integer(const char*& p, const char* end, int64_t& value) {
+    skip_blanks(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    int64_t result = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; p++) {
+        result = std::min<int64_t>(result * 10 + (*p - '0'), INT64_C(1) << 40);
+    }
+    value = negative ? -result : result;
+    return true;
+}
+
+// Run work(0) .. work(count - 1) on count threads, the calling one included
+template<typename F>
+inline void run_parallel(int count, F&& work) {
+    std::vector<std::thread> threads;
+    for (int i = 1; i < count; i++) {
+        threads.push_back(std::thread([&work, i]() { work(i); }));
+    }
+    work(0);
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+// Threads for parsing size bytes: as asked (0 for all cores), but at least a megabyte each
+inline int loader_threads(int requested, size_t size) {
+    int threads = requested > 0 ? requested : static_cast<int>(std::thread::hardware_concurrency());
+    size_t most = std::max<size_t>(1, size >> 20);
+    return static_cast<int>(std::max<size_t>(1, std::min<size_t>(std::max(threads, 1), most)));
+}
+
+// Chunk starts of [begin, end) for count threads, each just after a newline. There are
+// count + 1 entries, the last is end.
+inline std::vector<const char*> split_lines(const char* begin, const char* end, int count) {
+    std::vector<const char*> starts(count + 1, end);
+    starts[0] = begin;
+    size_t size = end - begin;
+    for (int i = 1; i < count; i++) {
+        const char* p = std::max(begin + size / count * i, starts[i - 1]);
+        const char* newline = p < end ? static_cast<const char*>(memchr(p, '\n', end - p)) : nullptr;
+        starts[i] = newline ? newline + 1 : end;
+    }
+    return starts;
+}
+
+inline const char* line_end(const char* p, const char* end) {
+    const char* newline = static_cast<const char*>(memchr(p, '\n', end - p));
+    return newline ? newline : end;
+}
+
+// Triangle corners gathered by one chunk, concatenated into indices afterwards
+inline void merge_triangles(const std::vector<std::vector<uint32_t>>& chunks, std::vector<uint32_t>& indices) {
+    std::vector<size_t> offsets(chunks.size() + 1, 0);
+    for (size_t i = 0; i < chunks.size(); i++) {
+        offsets[i + 1] = offsets[i] + chunks[i].size();
+    }
+    indices.resize(offsets.back());
+    run_parallel(static_cast<int>(chunks.size()), [&](int i) {
+        if (!chunks[i].empty()) {
+            memcpy(indices.data() + offsets[i], chunks[i].data(), chunks[i].size() * sizeof(uint32_t));
+        }
+    });
+}
+
+// First error of any chunk, by position in the file
+inline bool first_chunk_error(const std::vector<std::string>& errors, std::string& error) {
+    for (const std::string& e : errors) {
+        if (!e.empty()) {
+            error = e;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Wavefront OBJ
+
+// Vertex lines of a chunk of an OBJ file
+struct obj_counts {
+    size_t lines = 0;
+    size_t positions = 0;
+    size_t texcoords = 0;
+    size_t normals = 0;
+};
+
+inline obj_counts count_obj_lines(const char* p, const char* end) {
+    obj_counts counts;
+    while (p < end) {
+        const char* e = line_end(p, end);
+        skip_blanks(p, e);
+        if (e - p >= 2 && p[0] == 'v') {
+            counts.positions += p[1] == ' ' || p[1] == '\t';
+            counts.texcoords += p[1] == 't';
+            counts.normals += p[1] == 'n';
+        }
+        counts.lines++;
+        p = e + 1;
+    }
+    return counts;
+}
+
+// Face corner, indices from zero into each attribute, -1 when not given
+struct obj_corner {
+    int64_t position;
+    int64_t texcoord;
+    int64_t normal;
+
+    bool operator==(const obj_corner& o) const {
+        return position == o.position && texcoord == o.texcoord && normal == o.normal;
+    }
+};
+
+struct obj_corner_hash {
+    size_t operator()(const obj_corner& c) const {
+        return static_cast<size_t>(mix_bits(c.position * 0x9e3779b97f4a7c15ULL ^ mix_bits(c.texcoord * 31 + c.normal)));
+    }
+};
+
+// Faces of one chunk
+struct obj_chunk {
+    std::vector<obj_corner> corners; // Three per triangle
+    std::string error;
+    bool separate_indices = false;   // Some corner's texture or normal index differs from its position index
+    bool any_texcoords = false;
+    bool any_normals = false;
+    bool missing_texcoords = false;
+    bool missing_normals = false;
+};
+
+// Parse "v/vt/vn", "v//vn", "v/vt" or "v", resolving negative (relative) indices against
+// the attributes read so far
+inline bool parse_obj_corner(const char*& p, const char* end, const obj_counts& before, const obj_counts& total,
+                             obj_corner& corner) {
+    int64_t value[3] = { 0, 0, 0 };
+    size_t seen[3] = { before.positions, before.texcoords, before.normals };
+    size_t count[3] = { total.positions, total.texcoords, total.normals };
+    for (int k = 0; k < 3; k++) {
+        if (k > 0) {
+            if (p == end || *p != '/') break;
+            p++;
+            if (p < end && *p == '/') continue;
+        }
+        if (!parse_integer(p, end, value[k]) || value[k] == 0) {
+            return false;
+        }
+    }
+
+    int64_t* out[3] = { &corner.position, &corner.texcoord, &corner.normal };
+    for (int k = 0; k < 3; k++) {
+        int64_t index = value[k] > 0 ? value[k] - 1 : (value[k] < 0 ? static_cast<int64_t>(seen[k]) + value[k] : -1);
+        if (value[k] != 0 && (index < 0 || index >= static_cast<int64_t>(count[k]))) {
+            return false;
+        }
+        *out[k] = index;
+    }
+    return true;
+}
+
+inline void parse_obj_chunk(const char* p, const char* end, obj_counts before, const obj_counts& total,
+                            float* positions, float* texcoords, float* normals, obj_chunk& chunk) {
+    std::vector<obj_corner> polygon;
+    size_t line = before.lines;
+    for (; p < end; p = line_end(p, end) + 1) {
+        const char* e = line_end(p, end);
+        line++;
+        skip_blanks(p, e);
+        if (p == e || *p == '#') {
+            continue;
+        }
+
+        bool ok = true;
+        if (e - p >= 2 && p[0] == 'v' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            float* v = positions + 3 * before.positions++;
+            ok = parse_float(p, e, v[0]) && parse_float(p, e, v[1]) && parse_float(p, e, v[2]);
+        }
+        else if (e - p >= 2 && p[0] == 'v' && p[1] == 't') {
+            p += 2;
+            float* t = texcoords + 2 * before.texcoords++;
+            t[1] = 0;
+            ok = parse_float(p, e, t[0]);
+            parse_float(p, e, t[1]);
+        }
+        else if (e - p >= 2 && p[0] == 'v' && p[1] == 'n') {
+            p += 2;
+            float* n = normals + 3 * before.normals++;
+            ok = parse_float(p, e, n[0]) && parse_float(p, e, n[1]) && parse_float(p, e, n[2]);
+        }
+        else if (e - p >= 2 && p[0] == 'f' && (p[1] == ' ' || p[1] == '\t')) {
+            p++;
+            polygon.clear();
+            while (true) {
+                skip_blanks(p, e);
+                if (p == e || *p == '#') break;
+                obj_corner corner;
+                if (!parse_obj_corner(p, e, before, total, corner)) {
+                    ok = false;
+                    break;
+                }
+                polygon.push_back(corner);
+            }
+            ok = ok && polygon.size() >= 3;
+
+            for (size_t k = 0; ok && k < polygon.size(); k++) {
+                const obj_corner& c = polygon[k];
+                chunk.any_texcoords |= c.texcoord >= 0;
+                chunk.any_normals |= c.normal >= 0;
+                chunk.missing_texcoords |= c.texcoord < 0;
+                chunk.missing_normals |= c.normal < 0;
+                chunk.separate_indices |= (c.texcoord >= 0 && c.texcoord != c.position) ||
+                                          (c.normal >= 0 && c.normal != c.position);
+            }
+            for (size_t k = 2; ok && k < polygon.size(); k++) {
+                chunk.corners.push_back(polygon[0]);
+                chunk.corners.push_back(polygon[k - 1]);
+                chunk.corners.push_back(polygon[k]);
+            }
+        }
+        // Groups, objects, materials, smoothing groups, lines and points are ignored
+
+        if (!ok) {
+            chunk.error = "line " + std::to_string(line) + ": malformed statement";
+            return;
+        }
+    }
+}
+
+// Vertices where each corner's position, texture and normal indices agree are used as
+// they are. Otherwise every distinct combination becomes a vertex of its own, which needs
+// one pass over all corners on a single thread.
+inline void unify_obj_vertices(std::vector<obj_chunk>& chunks, std::vector<float>& positions,
+                               std::vector<float>& texcoords, std::vector<float>& normals, int threads,
+                               mesh_buffers& mesh) {
+    bool separate = false, any_texcoords = false, any_normals = false, missing_texcoords = false,
+         missing_normals = false;
+    for (const obj_chunk& c : chunks) {
+        separate |= c.separate_indices;
+        any_texcoords |= c.any_texcoords;
+        any_normals |= c.any_normals;
+        missing_texcoords |= c.missing_texcoords;
+        missing_normals |= c.missing_normals;
+    }
+    bool use_texcoords = any_texcoords;
+    bool use_normals = any_normals;
+
+    std::vector<std::vector<uint32_t>> triangles(chunks.size());
+    std::vector<uint32_t> indices;
+    if (!separate && !(use_texcoords && missing_texcoords) && !(use_normals && missing_normals)) {
+        run_parallel(threads, [&](int i) {
+            triangles[i].resize(chunks[i].corners.size());
+            for (size_t k = 0; k < chunks[i].corners.size(); k++) {
+                triangles[i][k] = static_cast<uint32_t>(chunks[i].corners[k].position);
+            }
+            std::vector<obj_corner>().swap(chunks[i].corners);
+        });
+        merge_triangles(triangles, indices);
+
+        size_t vertices = positions.size() / 3;
+        if (use_texcoords) texcoords.resize(2 * vertices, 0.0f);
+        if (use_normals) normals.resize(3 * vertices, 0.0f);
+        mesh.positions = std::move(positions);
+        mesh.texcoords = use_texcoords ? std::move(texcoords) : std::vector<float>();
+        mesh.normals = use_normals ? std::move(normals) : std::vector<float>();
+        mesh.indices = std::move(indices);
+        return;
+    }
+
+    std::unordered_map<obj_corner, uint32_t, obj_corner_hash> vertices;
+    std::vector<float> p, t, n;
+    for (obj_chunk& chunk : chunks) {
+        for (const obj_corner& c : chunk.corners) {
+            auto inserted = vertices.insert(std::make_pair(c, static_cast<uint32_t>(vertices.size())));
+            if (inserted.second) {
+                p.insert(p.end(), &positions[3 * c.position], &positions[3 * c.position] + 3);
+                if (use_texcoords) {
+                    t.push_back(c.texcoord >= 0 ? texcoords[2 * c.texcoord] : 0.0f);
+                    t.push_back(c.texcoord >= 0 ? texcoords[2 * c.texcoord + 1] : 0.0f);
+                }
+                if (use_normals) {
+                    for (int a = 0; a < 3; a++) {
+                        n.push_back(c.normal >= 0 ? normals[3 * c.normal + a] : 0.0f); // Zero falls back to flat
+                    }
+                }
+            }
+            indices.push_back(inserted.first->second);
+        }
+        std::vector<obj_corner>().swap(chunk.corners);
+    }
+    mesh.positions = std::move(p);
+    mesh.texcoords = std::move(t);
+    mesh.normals = std::move(n);
+    mesh.indices = std::move(indices);
+}
+
+inline bool decode_obj(const char* begin, const char* end, int threads, mesh_buffers& mesh, std::string& error) {
+    std::vector<const char*> starts = split_lines(begin, end, threads);
+
+    // Vertices before each chunk, so chunks write theirs in place and resolve relative indices
+    std::vector<obj_counts> counts(threads + 1);
+    run_parallel(threads, [&](int i) { counts[i + 1] = count_obj_lines(starts[i], starts[i + 1]); });
+    for (int i = 1; i <= threads; i++) {
+        counts[i].lines += counts[i - 1].lines;
+        counts[i].positions += counts[i - 1].positions;
+        counts[i].texcoords += counts[i - 1].texcoords;
+        counts[i].normals += counts[i - 1].normals;
+    }
+    const obj_counts& total = counts[threads];
+    if (total.positions > UINT32_MAX) {
+        error = "too many vertices";
+        return false;
+    }
+
+    std::vector<float> positions(3 * total.positions), texcoords(2 * total.texcoords), normals(3 * total.normals);
+    std::vector<obj_chunk> chunks(threads);
+    run_parallel(threads, [&](int i) {
+        parse_obj_chunk(starts[i], starts[i + 1], counts[i], total, positions.data(), texcoords.data(), normals.data(),
+                        chunks[i]);
+    });
+
+    std::vector<std::string> errors;
+    for (const obj_chunk& c : chunks) errors.push_back(c.error);
+    if (first_chunk_error(errors, error)) {
+        return false;
+    }
+
+    unify_obj_vertices(chunks, positions, texcoords, normals, threads, mesh);
+    if (mesh.triangle_count() == 0) {
+        error = "no faces";
+        return false;
+    }
+    return true;
+}
+
+// PLY (Turk 1994), ASCII or binary in either byte order
+
+enum class ply_type {
+    int8,
+    uint8,
+    int16,
+    uint16,
+    int32,
+    uint32,
+    float32,
+    float64,
+    invalid
+};
+
+inline ply_type ply_type_named(const std::string& name) {
+    if (name == "char" || name == "int8") return ply_type::int8;
+    if (name == "uchar" || name == "uint8") return ply_type::uint8;
+    if (name == "short" || name == "int16") return ply_type::int16;
+    if (name == "ushort" || name == "uint16") return ply_type::uint16;
+    if (name == "int" || name == "int32") return ply_type::int32;
+    if (name == "uint" || name == "uint32") return ply_type::uint32;
+    if (name == "float" || name == "float32") return ply_type::float32;
+    if (name == "double" || name == "float64") return ply_type::float64;
+    return ply_type::invalid;
+}
+
+inline size_t ply_type_size(ply_type type) {
+    static const size_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8, 0 };
+    return sizes[static_cast<int>(type)];
+}
+
+// Binary value at p, swapping bytes if the file's order differs from the host's
+inline double read_ply_value(const unsigned char* p, ply_type type, bool swap) {
+    unsigned char bytes[8];
+    size_t size = ply_type_size(type);
+    for (size_t k = 0; k < size; k++) {
+        bytes[k] = p[swap ? size - 1 - k : k];
+    }
+    switch (type) {
+        case ply_type::int8: { int8_t v; memcpy(&v, bytes, 1); return v; }
+        case ply_type::uint8: { uint8_t v; memcpy(&v, bytes, 1); return v; }
+        case ply_type::int16: { int16_t v; memcpy(&v, bytes, 2); return v; }
+        case ply_type::uint16: { uint16_t v; memcpy(&v, bytes, 2); return v; }
+        case ply_type::int32: { int32_t v; memcpy(&v, bytes, 4); return v; }
+        case ply_type::uint32: { uint32_t v; memcpy(&v, bytes, 4); return v; }
+        case ply_type::float32: { float v; memcpy(&v, bytes, 4); return v; }
+        case ply_type::float64: { double v; memcpy(&v, bytes, 8); return v; }
+        default: return 0;
+    }
+}
+
+struct ply_property {
+    std::string name;
+    ply_type type = ply_type::invalid;       // Of the value, or of list items
+    ply_type count_type = ply_type::invalid; // Of a list's length, invalid for scalars
+    int slot = -1;                           // Vertex attribute it fills, see ply_slot
+    size_t offset = 0;                       // In a record of scalars
+
+    bool is_list() const { return count_type != ply_type::invalid; }
+};
+
+struct ply_element {
+    std::string name;
+    size_t count = 0;
+    std::vector<ply_property> properties;
+    size_t stride = 0; // Bytes per binary record, 0 if it has lists
+
+    int list_property(const char* a, const char* b) const {
+        for (size_t k = 0; k < properties.size(); k++) {
+            if (properties[k].is_list() && (properties[k].name == a || properties[k].name == b)) {
+                return static_cast<int>(k);
+            }
+        }
+        return -1;
+    }
+};
+
+// Position, normal and texture coordinate components of a vertex, in that order
+inline int ply_slot(const std::string& name) {
+    static const char* names[][3] = { { "x", "", "" },       { "y", "", "" },        { "z", "", "" },
+                                      { "nx", "", "" },      { "ny", "", "" },       { "nz", "", "" },
+                                      { "u", "s", "texture_u" }, { "v", "t", "texture_v" } };
+    for (int slot = 0; slot < 8; slot++) {
+        for (const char* n : names[slot]) {
+            if (*n && name == n) return slot;
+        }
+    }
+    return -1;
+}
+
+struct ply_header {
+    enum { ascii, binary_little_endian, binary_big_endian } format = ascii;
+    std::vector<ply_element> elements;
+    size_t body = 0; // Offset of the first record
+};
+
+inline bool parse_ply_header(const char* begin, const char* end, ply_header& header, std::string& error) {
+    const char* p = begin;
+    bool format = false;
+    size_t line = 0;
+    while (p < end) {
+        const char* e = line_end(p, end);
+        line++;
+        std::vector<std::string> words;
+        while (true) {
+            skip_blanks(p, e);
+            if (p == e) break;
+            const char* w = p;
+            while (p < e && *p != ' ' && *p != '\t' && *p != '\r') p++;
+            words.push_back(std::string(w, p));
+        }
+        p = e + 1;
+
+        if (words.empty() || words[0] == "comment" || words[0] == "obj_info") {
+            continue;
+        }
+        if (line == 1) {
+            if (words[0] != "ply") break;
+            continue;
+        }
+        if (words[0] == "end_header") {
+            if (!format) break;
+            header.body = std::min(p, end) - begin;
+            for (ply_element& element : header.elements) {
+                element.stride = 0;
+                bool lists = false;
+                for (ply_property& property : element.properties) {
+                    property.offset = element.stride;
+                    element.stride += ply_type_size(property.type);
+                    lists |= property.is_list();
+                }
+                element.stride = lists ? 0 : element.stride;
+            }
+            return true;
+        }
+        if (words[0] == "format" && words.size() >= 2) {
+            format = true;
+            if (words[1] == "ascii") header.format = ply_header::ascii;
+            else if (words[1] == "binary_little_endian") header.format = ply_header::binary_little_endian;
+            else if (words[1] == "binary_big_endian") header.format = ply_header::binary_big_endian;
+            else format = false;
+            if (!format) break;
+        }
+        else if (words[0] == "element" && words.size() >= 3) {
+            ply_element element;
+            element.name = words[1];
+            element.count = strtoull(words[2].c_str(), nullptr, 10);
+            header.elements.push_back(element);
+        }
+        else if (words[0] == "property" && !header.elements.empty()) {
+            ply_property property;
+            bool vertex = header.elements.back().name == "vertex";
+            if (words.size() >= 5 && words[1] == "list") {
+                property.count_type = ply_type_named(words[2]);
+                property.type = ply_type_named(words[3]);
+                property.name = words[4];
+                if (property.count_type == ply_type::invalid) break;
+            }
+            else if (words.size() >= 3) {
+                property.type = ply_type_named(words[1]);
+                property.name = words[2];
+                property.slot = vertex ? ply_slot(property.name) : -1;
+            }
+            if (property.type == ply_type::invalid) break;
+            header.elements.back().properties.push_back(property);
+        }
+        else {
+            break;
+        }
+    }
+
+    error = "bad PLY header, line " + std::to_string(line);
+    return false;
+}
+
+// Vertex attributes a PLY file provides
+struct ply_vertex_layout {
+    bool slots[8] = {};
+
+    bool has_normals() const { return slots[3] && slots[4] && slots[5]; }
+    bool has_texcoords() const { return slots[6] && slots[7]; }
+};
+
+// Store one vertex value by its slot
+inline void store_ply_vertex(int slot, size_t vertex, double value, float* positions, float* normals,
+                             float* texcoords) {
+    if (slot < 3) positions[3 * vertex + slot] = static_cast<float>(value);
+    else if (slot < 6 && normals) normals[3 * vertex + slot - 3] = static_cast<float>(value);
+    else if (slot < 8 && texcoords) texcoords[2 * vertex + slot - 6] = static_cast<float>(value);
+}
+
+// Fan of triangles over a face's vertex list, false if an index is out of range
+inline bool add_ply_face(const int64_t* polygon, size_t size, size_t vertices, std::vector<uint32_t>& triangles) {
+    if (size < 3) {
+        return size == 0; // Empty faces are skipped, points and lines are errors
+    }
+    for (size_t k = 0; k < size; k++) {
+        if (polygon[k] < 0 || polygon[k] >= static_cast<int64_t>(vertices)) return false;
+    }
+    for (size_t k = 2; k < size; k++) {
+        triangles.push_back(static_cast<uint32_t>(polygon[0]));
+        triangles.push_back(static_cast<uint32_t>(polygon[k - 1]));
+        triangles.push_back(static_cast<uint32_t>(polygon[k]));
+    }
+    return true;
+}
+
+inline bool decode_ply_ascii(const char* begin, const char* end, const ply_header& header, int threads,
+                             float* positions, float* normals, float* texcoords, size_t vertices,
+                             std::vector<uint32_t>& indices, std::string& error) {
+    // Records are lines; skip blank ones when counting so each chunk knows its first record
+    std::vector<const char*> starts = split_lines(begin, end, threads);
+    std::vector<size_t> records(threads + 1, 0);
+    run_parallel(threads, [&](int i) {
+        for (const char* p = starts[i]; p < starts[i + 1];) {
+            const char* e = line_end(p, starts[i + 1]);
+            skip_blanks(p, e);
+            records[i + 1] += p < e;
+            p = e + 1;
+        }
+    });
+    for (int i = 1; i <= threads; i++) {
+        records[i] += records[i - 1];
+    }
+
+    std::vector<size_t> element_start(header.elements.size() + 1, 0);
+    for (size_t k = 0; k < header.elements.size(); k++) {
+        element_start[k + 1] = element_start[k] + header.elements[k].count;
+    }
+    if (records[threads] < element_start.back()) {
+        error = "truncated PLY body";
+        return false;
+    }
+
+    std::vector<std::vector<uint32_t>> triangles(threads);
+    std::vector<std::string> errors(threads);
+    run_parallel(threads, [&](int i) {
+        size_t record = records[i];
+        size_t element = 0;
+        std::vector<int64_t> polygon;
+        for (const char* p = starts[i]; p < starts[i + 1]; p = line_end(p, starts[i + 1]) + 1) {
+            const char* e = line_end(p, starts[i + 1]);
+            skip_blanks(p, e);
+            if (p == e) continue;
+            while (element < header.elements.size() && record >= element_start[element + 1]) element++;
+            if (element == header.elements.size()) break;
+
+            const ply_element& el = header.elements[element];
+            size_t index = record++ - element_start[element];
+            bool vertex = el.name == "vertex";
+            bool face = el.name == "face";
+            bool ok = true;
+            for (const ply_property& property : el.properties) {
+                double value = 0;
+                if (!property.is_list()) {
+                    ok = parse_double(p, e, value);
+                    if (ok && vertex && property.slot >= 0) {
+                        store_ply_vertex(property.slot, index, value, positions, normals, texcoords);
+                    }
+                    continue;
+                }
+
+                int64_t size = 0;
+                ok = parse_integer(p, e, size) && size >= 0;
+                polygon.clear();
+                for (int64_t k = 0; ok && k < size; k++) {
+                    int64_t corner;
+                    ok = parse_integer(p, e, corner);
+                    polygon.push_back(corner);
+                }
+                if (ok && face && (property.name == "vertex_indices" || property.name == "vertex_index")) {
+                    ok = add_ply_face(polygon.data(), polygon.size(), vertices, triangles[i]);
+                }
+                if (!ok) break;
+            }
+            if (!ok) {
+                errors[i] = el.name + " " + std::to_string(index) + ": malformed or out of range";
+                return;
+            }
+        }
+    });
+
+    if (first_chunk_error(errors, error)) {
+        return false;
+    }
+    merge_triangles(triangles, indices);
+    return true;
+}
+
+// Walk a binary record with lists, calling list(property, count, items) for each list.
+// Returns the end of the record or nullptr if the file ends before it.
+template<typename F>
+inline const unsigned char* walk_ply_record(const unsigned char* p, const unsigned char* end, const ply_element& element,
+                                            bool swap, F&& list) {
+    for (const ply_property& property : element.properties) {
+        if (!property.is_list()) {
+            p += ply_type_size(property.type);
+            if (p > end) return nullptr;
+            continue;
+        }
+        size_t count_size = ply_type_size(property.count_type);
+        if (p + count_size > end) return nullptr;
+        double count = read_ply_value(p, property.count_type, swap);
+        p += count_size;
+        size_t items = count > 0 ? static_cast<size_t>(count) : 0;
+        if (static_cast<size_t>(end - p) / ply_type_size(property.type) < items) return nullptr;
+        list(property, items, p);
+        p += items * ply_type_size(property.type);
+    }
+    return p;
+}
+
+inline bool decode_ply_faces(const unsigned char* p, const unsigned char* end, const ply_element& element, bool swap,
+                             int threads, size_t vertices, std::vector<uint32_t>& indices, const unsigned char*& next,
+                             std::string& error) {
+    int list = element.list_property("vertex_indices", "vertex_index");
+    if (list < 0) {
+        error = "faces without vertex_indices";
+        return false;
+    }
+
+    // Most files hold only triangles: records of one list have the same size then and split
+    // evenly between threads. A record that is not a triangle sends the whole element down
+    // the sequential path.
+    const ply_property& indices_property = element.properties[list];
+    size_t count_size = ply_type_size(indices_property.count_type);
+    size_t item_size = ply_type_size(indices_property.type);
+    size_t stride = count_size + 3 * item_size;
+    if (element.properties.size() == 1 && static_cast<size_t>(end - p) / stride >= element.count) {
+        bool direct = !swap && (indices_property.type == ply_type::int32 || indices_property.type == ply_type::uint32);
+        threads = static_cast<int>(std::max<size_t>(1, std::min<size_t>(threads, element.count >> 16)));
+        std::vector<std::vector<uint32_t>> triangles(threads);
+        std::vector<char> fits(threads, 1);
+        run_parallel(threads, [&](int i) {
+            size_t first = element.count * i / threads;
+            size_t last = element.count * (i + 1) / threads;
+            triangles[i].reserve(3 * (last - first));
+            int64_t polygon[3];
+            for (size_t f = first; f < last; f++) {
+                const unsigned char* r = p + f * stride;
+                if (read_ply_value(r, indices_property.count_type, swap) != 3) {
+                    fits[i] = 0;
+                    return;
+                }
+                if (direct) {
+                    uint32_t corners[3];
+                    memcpy(corners, r + count_size, sizeof(corners));
+                    for (int k = 0; k < 3; k++) {
+                        polygon[k] = indices_property.type == ply_type::int32 ? static_cast<int32_t>(corners[k]) : corners[k];
+                    }
+                }
+                else {
+                    for (int k = 0; k < 3; k++) {
+                        polygon[k] = static_cast<int64_t>(read_ply_value(r + count_size + k * item_size, indices_property.type, swap));
+                    }
+                }
+                if (!add_ply_face(polygon, 3, vertices, triangles[i])) {
+                    fits[i] = 2;
+                    return;
+                }
+            }
+        });
+        // After a record that is not a triangle, later threads read from the middle of records,
+        // so their errors mean nothing. Range errors count only if all records were triangles.
+        if (std::count(fits.begin(), fits.end(), 0) == 0) {
+            if (std::count(fits.begin(), fits.end(), 2) > 0) {
+                error = "face index out of range";
+                return false;
+            }
+            merge_triangles(triangles, indices);
+            next = p + element.count * stride;
+            return true;
+        }
+    }
+
+    std::vector<uint32_t> triangles;
+    triangles.reserve(3 * element.count);
+    std::vector<int64_t> polygon;
+    bool ok = true;
+    for (size_t f = 0; f < element.count && p; f++) {
+        p = walk_ply_record(p, end, element, swap, [&](const ply_property& property, size_t items, const unsigned char* q) {
+            if (&property != &indices_property) return;
+            polygon.resize(items);
+            for (size_t k = 0; k < items; k++) {
+                polygon[k] = static_cast<int64_t>(read_ply_value(q + k * item_size, property.type, swap));
+            }
+            ok = ok && add_ply_face(polygon.data(), items, vertices, triangles);
+        });
+    }
+    if (!p || !ok) {
+        error = p ? "face index out of range" : "truncated PLY faces";
+        return false;
+    }
+    indices = std::move(triangles);
+    next = p;
+    return true;
+}
+
+inline bool decode_ply_binary(const shared_ptr<mapped_file>& file, const ply_header& header, int threads,
+                              mesh_buffers& mesh, bool& zero_copy, std::string& error) {
+    uint16_t probe = 1;
+    bool host_little_endian = *reinterpret_cast<unsigned char*>(&probe) == 1;
+    bool swap = (header.format == ply_header::binary_little_endian) != host_little_endian;
+
+    const unsigned char* p = file->data() + header.body;
+    const unsigned char* end = file->data() + file->size();
+    size_t vertices = 0;
+    std::vector<float> positions, normals, texcoords;
+    std::vector<uint32_t> indices;
+    for (const ply_element& element : header.elements) {
+        if (element.name == "vertex") {
+            if (element.stride == 0 || static_cast<size_t>(end - p) / element.stride < element.count) {
+                error = "truncated or unsupported PLY vertices";
+                return false;
+            }
+            vertices = element.count;
+            ply_vertex_layout layout;
+            for (const ply_property& property : element.properties) {
+                if (property.slot >= 0) layout.slots[property.slot] = true;
+            }
+
+            // Records of exactly three floats in host order are the position array itself
+            const std::vector<ply_property>& v = element.properties;
+            if (!swap && v.size() == 3 && v[0].slot == 0 && v[1].slot == 1 && v[2].slot == 2 &&
+                v[0].type == ply_type::float32 && v[1].type == ply_type::float32 && v[2].type == ply_type::float32 &&
+                reinterpret_cast<uintptr_t>(p) % alignof(float) == 0) {
+                mesh.positions = mesh_array<float>::view_of(reinterpret_cast<const float*>(p), 3 * vertices, file);
+                zero_copy = true;
+            }
+            else {
+                positions.resize(3 * vertices);
+                if (layout.has_normals()) normals.resize(3 * vertices);
+                if (layout.has_texcoords()) texcoords.resize(2 * vertices);
+                int n = static_cast<int>(std::max<size_t>(1, std::min<size_t>(threads, vertices >> 16)));
+                run_parallel(n, [&](int i) {
+                    for (size_t k = vertices * i / n; k < vertices * (i + 1) / n; k++) {
+                        const unsigned char* r = p + k * element.stride;
+                        for (const ply_property& property : element.properties) {
+                            if (property.slot < 0) continue;
+                            store_ply_vertex(property.slot, k, read_ply_value(r + property.offset, property.type, swap),
+                                             positions.data(), normals.empty() ? nullptr : normals.data(),
+                                             texcoords.empty() ? nullptr : texcoords.data());
+                        }
+                    }
+                });
+            }
+            p += vertices * element.stride;
+        }
+        else if (element.name == "face") {
+            if (!decode_ply_faces(p, end, element, swap, threads, vertices, indices, p, error)) {
+                return false;
+            }
+        }
+        else if (element.stride > 0) {
+            if (static_cast<size_t>(end - p) / element.stride < element.count) {
+                error = "truncated PLY " + element.name;
+                return false;
+            }
+            p += element.count * element.stride;
+        }
+        else {
+            for (size_t k = 0; k < element.count && p; k++) {
+                p = walk_ply_record(p, end, element, swap, [](const ply_property&, size_t, const unsigned char*) {});
+            }
+            if (!p) {
+                error = "truncated PLY " + element.name;
+                return false;
+            }
+        }
+    }
+
+    if (!zero_copy) mesh.positions = std::move(positions);
+    mesh.normals = std::move(normals);
+    mesh.texcoords = std::move(texcoords);
+    mesh.indices = std::move(indices);
+    return true;
+}
+
+inline bool decode_ply(const shared_ptr<mapped_file>& file, int threads, mesh_buffers& mesh, bool& zero_copy,
+                       std::string& error) {
+    const char* begin = reinterpret_cast<const char*>(file->data());
+    const char* end = begin + file->size();
+    ply_header header;
+    if (!parse_ply_header(begin, end, header, error)) {
+        return false;
+    }
+
+    const ply_element* vertex = nullptr;
+    for (const ply_element& element : header.elements) {
+        if (element.name == "vertex") vertex = &element;
+    }
+    if (!vertex || vertex->count > UINT32_MAX) {
+        error = "no or too many vertices";
+        return false;
+    }
+
+    if (header.format != ply_header::ascii) {
+        if (!decode_ply_binary(file, header, threads, mesh, zero_copy, error)) {
+            return false;
+        }
+    }
+    else {
+        ply_vertex_layout layout;
+        for (const ply_property& property : vertex->properties) {
+            if (property.slot >= 0) layout.slots[property.slot] = true;
+        }
+        std::vector<float> positions(3 * vertex->count);
+        std::vector<float> normals(layout.has_normals() ? 3 * vertex->count : 0);
+        std::vector<float> texcoords(layout.has_texcoords() ? 2 * vertex->count : 0);
+        std::vector<uint32_t> indices;
+        if (!decode_ply_ascii(begin + header.body, end, header, threads, positions.data(),
+                              normals.empty() ? nullptr : normals.data(), texcoords.empty() ? nullptr : texcoords.data(),
+                              vertex->count, indices, error)) {
+            return false;
+        }
+        mesh.positions = std::move(positions);
+        mesh.normals = std::move(normals);
+        mesh.texcoords = std::move(texcoords);
+        mesh.indices = std::move(indices);
+    }
+
+    if (mesh.triangle_count() == 0) {
+        error = "no faces";
+        return false;
+    }
+    return true;
+}
+
+// Read an .obj or .ply file, recognized by its contents, on the given number of threads
+// (0 for one per core). Returns false and sets error on failure.
+inline bool load_mesh(const std::string& path, mesh_buffers& mesh, std::string& error, int threads = 0,
+                      mesh_load_stats* stats = nullptr) {
+    auto start = std::chrono::steady_clock::now();
+    auto file = make_shared<mapped_file>();
+    if (!file->open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+
+    // Consecutive pages are read ahead while the threads walk their chunks
+    madvise(const_cast<unsigned char*>(file->data()), file->size(), MADV_SEQUENTIAL);
+
+    threads = loader_threads(threads, file->size());
+    bool zero_copy = false;
+    bool ok;
+    mesh = mesh_buffers();
+    if (file->size() >= 4 && memcmp(file->data(), "ply", 3) == 0 && (file->data()[3] == '\n' || file->data()[3] == '\r')) {
+        ok = decode_ply(file, threads, mesh, zero_copy, error);
+    }
+    else {
+        const char* begin = reinterpret_cast<const char*>(file->data());
+        ok = decode_obj(begin, begin + file->size(), threads, mesh, error);
+    }
+
+    if (!ok) {
+        error = path + ": " + error;
+        mesh = mesh_buffers();
+        return false;
+    }
+
+    if (stats) {
+        stats->bytes = file->size();
+        stats->seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        stats->threads = threads;
+        stats->zero_copy = zero_copy;
+    }
+    return true;
+}
+
+#endif
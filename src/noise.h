@@ -0,0 +1,242 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include "rtweekend.h"
+
+#include <cstdint>
+#include <vector>
+
+// Gradient noise over 3D points: improved Perlin noise, simplex noise and fractal sums
+// of either. The permutation and gradient tables are built once from a seed, so every
+// process rendering a scene sees the same noise. Like sampling.h, the scalar functions
+// have no data dependent branches and the batch versions run them over arrays in loops
+// the compiler can vectorize (with gathers for the table lookups on AVX2).
+enum class noise_basis {
+    perlin,
+    simplex
+};
+
+// floor() as an integer, cheaper than the libm call and vectorizable
+inline int floor_to_int(double x) {
+    int i = static_cast<int>(x);
+    return i - (x < i ? 1 : 0);
+}
+
+class noise {
+  private:
+    int32_t perm[512];      // Permutation of 0..255, repeated so indices need no wrapping
+    int32_t gradient_x[16]; // Edge midpoints of a cube, four repeated (Perlin 2002). Integers,
+    int32_t gradient_y[16]; // so table lookups gather elements as wide as the permutation's.
+    int32_t gradient_z[16];
+
+    static double fade(double t) {
+        return t * t * t * (t * (t * 6 - 15) + 10);
+    }
+
+    static double lerp(double t, double a, double b) {
+        return a + t * (b - a);
+    }
+
+    double grad(int hash, double x, double y, double z) const {
+        int h = hash & 15;
+        return gradient_x[h] * x + gradient_y[h] * y + gradient_z[h] * z;
+    }
+
+  public:
+    noise(uint64_t seed = 0x6e6f697365ULL) {
+        static const int32_t edges[16][3] = {
+            { 1, 1, 0 }, { -1, 1, 0 }, { 1, -1, 0 }, { -1, -1, 0 },
+            { 1, 0, 1 }, { -1, 0, 1 }, { 1, 0, -1 }, { -1, 0, -1 },
+            { 0, 1, 1 }, { 0, -1, 1 }, { 0, 1, -1 }, { 0, -1, -1 },
+            { 1, 1, 0 }, { 0, -1, 1 }, { -1, 1, 0 }, { 0, -1, -1 }
+        };
+        for (int k = 0; k < 16; k++) {
+            gradient_x[k] = edges[k][0];
+            gradient_y[k] = edges[k][1];
+            gradient_z[k] = edges[k][2];
+        }
+
+        // Fisher-Yates shuffle driven by the seed, independent of the render threads' generators
+        for (int k = 0; k < 256; k++) {
+            perm[k] = k;
+        }
+        uint64_t state = seed;
+        for (int k = 255; k > 0; k--) {
+            int other = static_cast<int>(mix_bits(state += 0x9e3779b97f4a7c15ULL) % (k + 1));
+            int32_t swap = perm[k];
+            perm[k] = perm[other];
+            perm[other] = swap;
+        }
+        for (int k = 0; k < 256; k++) {
+            perm[k + 256] = perm[k];
+        }
+    }
+
+    // Improved Perlin noise, in about [-1, 1]
+    __attribute__((always_inline)) double perlin(double x, double y, double z) const {
+        int xi = floor_to_int(x);
+        int yi = floor_to_int(y);
+        int zi = floor_to_int(z);
+        x -= xi;
+        y -= yi;
+        z -= zi;
+        xi &= 255;
+        yi &= 255;
+        zi &= 255;
+
+        double u = fade(x);
+        double v = fade(y);
+        double w = fade(z);
+
+        // Hashes of the eight cell corners
+        int a = perm[xi] + yi;
+        int aa = perm[a] + zi;
+        int ab = perm[a + 1] + zi;
+        int b = perm[xi + 1] + yi;
+        int ba = perm[b] + zi;
+        int bb = perm[b + 1] + zi;
+
+        return lerp(w, lerp(v, lerp(u, grad(perm[aa], x, y, z), grad(perm[ba], x - 1, y, z)),
+                               lerp(u, grad(perm[ab], x, y - 1, z), grad(perm[bb], x - 1, y - 1, z))),
+                       lerp(v, lerp(u, grad(perm[aa + 1], x, y, z - 1), grad(perm[ba + 1], x - 1, y, z - 1)),
+                               lerp(u, grad(perm[ab + 1], x, y - 1, z - 1), grad(perm[bb + 1], x - 1, y - 1, z - 1))));
+    }
+
+    // Simplex noise (Perlin 2001, after Gustavson), in about [-1, 1]. Sums four corners
+    // instead of interpolating eight.
+    __attribute__((always_inline)) double simplex(double x, double y, double z) const {
+        const double skew = 1.0 / 3;
+        const double unskew = 1.0 / 6;
+
+        // Cell of the skewed grid and the position in it
+        double s = (x + y + z) * skew;
+        int i = floor_to_int(x + s);
+        int j = floor_to_int(y + s);
+        int k = floor_to_int(z + s);
+        double t = (i + j + k) * unskew;
+        double x0 = x - (i - t);
+        double y0 = y - (j - t);
+        double z0 = z - (k - t);
+
+        // The cell splits into six tetrahedra, the order of the coordinates picks one.
+        // Comparisons instead of branches keep the batch loop vectorizable.
+        int x_ge_y = x0 >= y0 ? 1 : 0;
+        int y_ge_z = y0 >= z0 ? 1 : 0;
+        int x_ge_z = x0 >= z0 ? 1 : 0;
+        int i1 = x_ge_y & x_ge_z;
+        int j1 = (1 - x_ge_y) & y_ge_z;
+        int k1 = (1 - x_ge_z) & (1 - y_ge_z);
+        int i2 = x_ge_y | x_ge_z;
+        int j2 = (1 - x_ge_y) | y_ge_z;
+        int k2 = (1 - x_ge_z) | (1 - y_ge_z);
+
+        double x1 = x0 - i1 + unskew, y1 = y0 - j1 + unskew, z1 = z0 - k1 + unskew;
+        double x2 = x0 - i2 + 2 * unskew, y2 = y0 - j2 + 2 * unskew, z2 = z0 - k2 + 2 * unskew;
+        double x3 = x0 - 1 + 3 * unskew, y3 = y0 - 1 + 3 * unskew, z3 = z0 - 1 + 3 * unskew;
+
+        i &= 255;
+        j &= 255;
+        k &= 255;
+        int g0 = perm[i + perm[j + perm[k]]];
+        int g1 = perm[i + i1 + perm[j + j1 + perm[k + k1]]];
+        int g2 = perm[i + i2 + perm[j + j2 + perm[k + k2]]];
+        int g3 = perm[i + 1 + perm[j + 1 + perm[k + 1]]];
+
+        // Radial falloff of each corner, clamped at zero with fabs() because the compiler
+        // turns a comparison here into a branch
+        double t0 = 0.6 - x0 * x0 - y0 * y0 - z0 * z0;
+        double t1 = 0.6 - x1 * x1 - y1 * y1 - z1 * z1;
+        double t2 = 0.6 - x2 * x2 - y2 * y2 - z2 * z2;
+        double t3 = 0.6 - x3 * x3 - y3 * y3 - z3 * z3;
+        t0 = 0.5 * (t0 + std::fabs(t0));
+        t1 = 0.5 * (t1 + std::fabs(t1));
+        t2 = 0.5 * (t2 + std::fabs(t2));
+        t3 = 0.5 * (t3 + std::fabs(t3));
+        t0 *= t0;
+        t1 *= t1;
+        t2 *= t2;
+        t3 *= t3;
+
+        return 32 * (t0 * t0 * grad(g0, x0, y0, z0) + t1 * t1 * grad(g1, x1, y1, z1) +
+                     t2 * t2 * grad(g2, x2, y2, z2) + t3 * t3 * grad(g3, x3, y3, z3));
+    }
+
+    double value(noise_basis basis, double x, double y, double z) const {
+        return basis == noise_basis::simplex ? simplex(x, y, z) : perlin(x, y, z);
+    }
+
+    // Fractal Brownian motion: octaves of noise, each lacunarity times finer and gain times weaker
+    double fbm(noise_basis basis, double x, double y, double z, int octaves, double lacunarity = 2.0,
+               double gain = 0.5) const {
+        double sum = 0;
+        double frequency = 1;
+        double amplitude = 1;
+        for (int octave = 0; octave < octaves; octave++) {
+            sum += amplitude * value(basis, frequency * x, frequency * y, frequency * z);
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+        return sum;
+    }
+
+    // Batch versions over n points, inputs and outputs are separate arrays
+
+    void perlin_batch(int n, const double* __restrict x, const double* __restrict y, const double* __restrict z,
+                      double* __restrict out) const {
+        for (int i = 0; i < n; i++) {
+            out[i] = perlin(x[i], y[i], z[i]);
+        }
+    }
+
+    void simplex_batch(int n, const double* __restrict x, const double* __restrict y, const double* __restrict z,
+                       double* __restrict out) const {
+        for (int i = 0; i < n; i++) {
+            out[i] = simplex(x[i], y[i], z[i]);
+        }
+    }
+
+    // Octaves run as the outer loop so each pass over the points is a plain noise batch
+    void fbm_batch(noise_basis basis, int n, const double* __restrict x, const double* __restrict y,
+                   const double* __restrict z, int octaves, double lacunarity, double gain, double* __restrict out) const {
+        for (int i = 0; i < n; i++) {
+            out[i] = 0;
+        }
+
+        double frequency = 1;
+        double amplitude = 1;
+        for (int octave = 0; octave < octaves; octave++) {
+            if (basis == noise_basis::simplex) {
+                for (int i = 0; i < n; i++) {
+                    out[i] += amplitude * simplex(frequency * x[i], frequency * y[i], frequency * z[i]);
+                }
+            }
+            else {
+                for (int i = 0; i < n; i++) {
+                    out[i] += amplitude * perlin(frequency * x[i], frequency * y[i], frequency * z[i]);
+                }
+            }
+            frequency *= lacunarity;
+            amplitude *= gain;
+        }
+    }
+};
+
+// Density grid of n x n x n cells over [-1, 1]^3 for grid_medium: a ball of smoke that
+// fades towards its edge, roughened by fractal noise. x runs fastest, then y, then z.
+inline std::vector<float> smoke_density(int n) {
+    noise fbm;
+    std::vector<float> density(static_cast<size_t>(n) * n * n);
+    for (int z = 0; z < n; z++) {
+        for (int y = 0; y < n; y++) {
+            for (int x = 0; x < n; x++) {
+                vector3d p(2.0 * (x + 0.5) / n - 1, 2.0 * (y + 0.5) / n - 1, 2.0 * (z + 0.5) / n - 1);
+                double falloff = 1 - p.length();
+                double value = falloff > 0 ? falloff + 0.6 * fbm.fbm(noise_basis::perlin, 3 * p.x(), 3 * p.y(), 3 * p.z(), 4) : 0;
+                density[(static_cast<size_t>(z) * n + y) * n + x] = static_cast<float>(value > 0 ? value : 0);
+            }
+        }
+    }
+    return density;
+}
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef ONB_H
+#define ONB_H
+
+#include "rtweekend.h"
+
+// Orthonormal basis whose w axis is a given direction
+class onb {
+  public:
+    onb(const vector3d& n) {
+        axis[2] = unit_vector(n);
+        vector3d a = (fabs(axis[2].x()) > 0.9) ? vector3d(0, 1, 0) : vector3d(1, 0, 0);
+        axis[1] = unit_vector(cross(axis[2], a));
+        axis[0] = cross(axis[2], axis[1]);
+    }
+
+    const vector3d& u() const { return axis[0]; }
+    const vector3d& v() const { return axis[1]; }
+    const vector3d& w() const { return axis[2]; }
+
+    // Vector from basis coordinates to world coordinates
+    vector3d transform(const vector3d& v) const {
+        return (v[0] * axis[0]) + (v[1] * axis[1]) + (v[2] * axis[2]);
+    }
+
+  private:
+    vector3d axis[3];
+};
+
+#endif
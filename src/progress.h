@@ -0,0 +1,137 @@
+#ifndef PROGRESS_H
+#define PROGRESS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Output format of the render progress reporter
+enum class progress_mode {
+    bar,   // Human readable single line, rewritten in place
+    quiet, // No output at all
+    json   // One JSON object per line, suitable for job logs
+};
+
+class progress_reporter {
+  private:
+    // Per thread counters. Each thread only writes its own slot, padded so that
+    // two threads never share a cache line.
+    struct thread_counters {
+        std::atomic<long long> samples;
+        std::atomic<long long> rays;
+        char padding[128 - 2 * sizeof(std::atomic<long long>)];
+    };
+
+    progress_mode mode;
+    int num_threads;
+    long long total_samples;
+    std::chrono::duration<double> interval;
+    std::unique_ptr<thread_counters[]> counters;
+
+    std::chrono::steady_clock::time_point start_time;
+    std::thread reporter;
+    std::mutex mutex;
+    std::condition_variable wakeup;
+    bool running = false;
+
+    void sum_counters(long long& samples, long long& rays) const {
+        samples = 0;
+        rays = 0;
+        for (int i = 0; i < num_threads; i++) {
+            samples += counters[i].samples.load(std::memory_order_relaxed);
+            rays += counters[i].rays.load(std::memory_order_relaxed);
+        }
+    }
+
+    void print(const char* event) {
+        long long samples, rays;
+        sum_counters(samples, rays);
+
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        double fraction = total_samples > 0 ? static_cast<double>(samples) / total_samples : 1.0;
+        double eta = fraction > 0 ? elapsed * (1.0 - fraction) / fraction : 0.0;
+        double mrays_per_second = elapsed > 0 ? rays / elapsed / 1e6 : 0.0;
+        double samples_per_second = elapsed > 0 ? samples / elapsed : 0.0;
+
+        char line[256];
+        if (mode == progress_mode::json) {
+            snprintf(line, sizeof(line),
+                     "{\"event\":\"%s\",\"percent\":%.1f,\"elapsed_s\":%.3f,\"eta_s\":%.3f,"
+                     "\"mrays_per_s\":%.3f,\"samples_per_s\":%.0f}\n",
+                     event, fraction * 100, elapsed, eta, mrays_per_second, samples_per_second);
+        }
+        else {
+            snprintf(line, sizeof(line),
+                     "\rRendering: %3d%% | ETA %6.1fs | %7.2f Mrays/s | %10.0f samples/s ",
+                     static_cast<int>(fraction * 100), eta, mrays_per_second, samples_per_second);
+        }
+        std::clog << line << std::flush;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (running) {
+            // Sleep until the next report is due or the render finished
+            wakeup.wait_for(lock, interval);
+            if (running) {
+                print("progress");
+            }
+        }
+    }
+
+  public:
+    progress_reporter(progress_mode _mode, int _num_threads, long long _total_samples, double interval_seconds)
+        : mode(_mode), num_threads(_num_threads), total_samples(_total_samples), interval(interval_seconds),
+          counters(new thread_counters[_num_threads]) {
+        for (int i = 0; i < num_threads; i++) {
+            counters[i].samples.store(0, std::memory_order_relaxed);
+            counters[i].rays.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    ~progress_reporter() { stop(); }
+
+    // Record work done by a render thread, called once per finished tile. Two relaxed atomic
+    // adds on the thread's own counter, so it costs nothing next to a tile.
+    void add(int thread_id, long long samples, long long rays) {
+        counters[thread_id].samples.fetch_add(samples, std::memory_order_relaxed);
+        counters[thread_id].rays.fetch_add(rays, std::memory_order_relaxed);
+    }
+
+    void start() {
+        start_time = std::chrono::steady_clock::now();
+        if (mode == progress_mode::quiet) {
+            return;
+        }
+
+        running = true;
+        reporter = std::thread(&progress_reporter::run, this);
+    }
+
+    // Stop the reporter thread and print the final totals
+    void stop() {
+        if (!reporter.joinable()) {
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running = false;
+        }
+        wakeup.notify_all();
+        reporter.join();
+
+        print("done");
+    }
+
+    double elapsed_seconds() const {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+    }
+};
+
+#endif
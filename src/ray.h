@@ -8,17 +8,28 @@ class ray {
     point3d orig;
     vector3d dir;
 
+    // Ray cone: width at the origin and growth per unit distance, zero for an infinitely thin ray
+    double cone_width = 0;
+    double cone_spread = 0;
+
   public:
     // Constructors
-    ray() {}    
+    ray() {}
     ray(const point3d& origin, const vector3d& direction) : orig(origin), dir(direction) {}
+    ray(const point3d& origin, const vector3d& direction, double width, double spread)
+        : orig(origin), dir(direction), cone_width(width), cone_spread(spread) {}
 
     // Getters
     point3d origin() const { return orig; }
     point3d direction() const { return dir;}
+    double width() const { return cone_width; }
+    double spread() const { return cone_spread; }
 
     // Point at
-    point3d at(double t) const { return orig + t * dir; } 
+    point3d at(double t) const { return orig + t * dir; }
+
+    // Width of the ray cone at parameter t, used to filter textures
+    double footprint(double t) const { return cone_width + cone_spread * t * dir.length(); }
 };
 
-#endif
\ No newline at end of file
+#endif
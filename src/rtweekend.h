@@ -2,6 +2,7 @@
 #define RTWEEKEND_H
 
 #include <cmath>
+#include <cstdint>
 #include <cstdlib>
 #include <limits>
 #include <memory>
@@ -20,14 +21,39 @@ inline double degrees_to_radians(double degrees) {
     return degrees * pi / 180.0;
 }
 
+// Random number generator state of the calling thread (splitmix64).
+// Render threads load and store it per tile, so results do not depend on
+// which thread rendered what, and can be resumed exactly.
+inline uint64_t& random_state() {
+    thread_local uint64_t state = 0x853c49e6748fea9bULL;
+    return state;
+}
+
+// Scramble a 64 bit value, also used to derive independent seeds
+inline uint64_t mix_bits(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+inline uint64_t random_uint64() {
+    return mix_bits(random_state() += 0x9e3779b97f4a7c15ULL);
+}
+
 inline double random_double() {
-    return rand() / (RAND_MAX + 1.0);
+    // Returns a random real in [0, 1) with 53 bits of precision
+    return (random_uint64() >> 11) * (1.0 / 9007199254740992.0);
 }
 
 inline double random_double(double min, double max) {
     return min + (max - min) * random_double();
 }
 
+inline int random_int(int min, int max) {
+    // Returns a random integer in [min, max]
+    return static_cast<int>(random_double(min, max + 1));
+}
+
 // Common headers
 #include "interval.h"
 #include "ray.h"
@@ -0,0 +1,114 @@
+#ifndef SAMPLING_H
+#define SAMPLING_H
+
+#include <cmath>
+
+// Closed-form mappings from uniform numbers in [0, 1) to sampling domains.
+// Each takes a fixed number of inputs and has no data dependent branches, so it works
+// with stratified and low-discrepancy points as well as random ones, and the batch
+// versions vectorize. Angles come from short polynomials instead of calls into libm.
+
+// Sine and cosine of an angle in [-pi/4, pi/4], accurate to about 1e-9
+inline void sincos_quarter(double a, double& s, double& c) {
+    double a2 = a * a;
+    s = a * (1 + a2 * (-1.0 / 6 + a2 * (1.0 / 120 + a2 * (-1.0 / 5040 + a2 * (1.0 / 362880)))));
+    c = 1 + a2 * (-1.0 / 2 + a2 * (1.0 / 24 + a2 * (-1.0 / 720 + a2 * (1.0 / 40320 + a2 * (-1.0 / 3628800)))));
+}
+
+// Point on the unit circle at angle 2 pi u
+inline void sample_unit_circle(double u, double& x, double& y) {
+    const double quarter_pi = 0.78539816339744830962;
+    const double half_sqrt2 = 0.70710678118654752440;
+
+    // Quadrant and the angle within it, measured from the quadrant's middle
+    double t = 4 * u;
+    int quadrant = static_cast<int>(t);
+    quadrant = quadrant < 3 ? quadrant : 3;
+    double s, c;
+    sincos_quarter((t - quadrant - 0.5) * 2 * quarter_pi, s, c);
+
+    // Rotate by pi/4 to the quadrant's middle, then by whole quadrants.
+    // Selections are blends so the batch loops have no branches.
+    double cx = (c - s) * half_sqrt2;
+    double cy = (s + c) * half_sqrt2;
+    double odd = quadrant & 1;
+    double sign = 1 - 2 * (quadrant >> 1);
+    x = sign * (cx + odd * (-cy - cx));
+    y = sign * (cy + odd * (cx - cy));
+}
+
+// Uniform point in the unit disk, concentric mapping (Shirley and Chiu)
+inline void sample_unit_disk(double u1, double u2, double& x, double& y) {
+    const double quarter_pi = 0.78539816339744830962;
+
+    double ox = 2 * u1 - 1;
+    double oy = 2 * u2 - 1;
+
+    // Square rings map to circles, the larger coordinate gives the radius
+    double wide = std::fabs(ox) > std::fabs(oy) ? 1.0 : 0.0;
+    double r = oy + wide * (ox - oy);
+    double other = ox + wide * (oy - ox);
+    double ratio = other / (r + (r == 0 ? 1.0 : 0.0)); // other is 0 too when r is
+
+    double s, c;
+    sincos_quarter(quarter_pi * ratio, s, c);
+    x = r * (s + wide * (c - s));
+    y = r * (c + wide * (s - c));
+}
+
+// Uniform direction on the unit sphere
+inline void sample_unit_sphere(double u1, double u2, double& x, double& y, double& z) {
+    double cz = 1 - 2 * u1;
+    double r2 = 1 - cz * cz;
+    double r = std::sqrt(r2 > 0 ? r2 : 0);
+    double cx, cy;
+    sample_unit_circle(u2, cx, cy);
+    x = r * cx;
+    y = r * cy;
+    z = cz;
+}
+
+// Uniform point inside the unit sphere
+inline void sample_unit_ball(double u1, double u2, double u3, double& x, double& y, double& z) {
+    double sx, sy, sz;
+    sample_unit_sphere(u1, u2, sx, sy, sz);
+    double r = std::cbrt(u3);
+    x = r * sx;
+    y = r * sy;
+    z = r * sz;
+}
+
+// Direction around +z with density cos(theta) / pi, projected from the disk (Malley)
+inline void sample_cosine_hemisphere(double u1, double u2, double& x, double& y, double& z) {
+    double dx, dy;
+    sample_unit_disk(u1, u2, dx, dy);
+    x = dx;
+    y = dy;
+    double z2 = 1 - dx * dx - dy * dy;
+    z = std::sqrt(z2 > 0 ? z2 : 0);
+}
+
+// Batch versions over n samples, inputs and outputs are separate arrays
+
+inline void sample_unit_disk_batch(int n, const double* __restrict u1, const double* __restrict u2,
+                                   double* __restrict x, double* __restrict y) {
+    for (int i = 0; i < n; i++) {
+        sample_unit_disk(u1[i], u2[i], x[i], y[i]);
+    }
+}
+
+inline void sample_unit_sphere_batch(int n, const double* __restrict u1, const double* __restrict u2,
+                                     double* __restrict x, double* __restrict y, double* __restrict z) {
+    for (int i = 0; i < n; i++) {
+        sample_unit_sphere(u1[i], u2[i], x[i], y[i], z[i]);
+    }
+}
+
+inline void sample_cosine_hemisphere_batch(int n, const double* __restrict u1, const double* __restrict u2,
+                                           double* __restrict x, double* __restrict y, double* __restrict z) {
+    for (int i = 0; i < n; i++) {
+        sample_cosine_hemisphere(u1[i], u2[i], x[i], y[i], z[i]);
+    }
+}
+
+#endif
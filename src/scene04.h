@@ -0,0 +1,39 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+// Night scene lit only by a few small lights, meant for a camera without sky:
+//     cam.sky = false;
+//     cam.lights = scene_lights(world);
+hittable_list get_scene_04() {
+    // Materials
+    shared_ptr<material> concrete = make_shared<lambertian>(color(.7, .7, .7));
+    shared_ptr<material> red = make_shared<lambertian>(color(.8, .2, .15));
+    shared_ptr<material> blue = make_shared<lambertian>(color(.15, .3, .8));
+    shared_ptr<material> mirror = make_shared<metal>(color(.9, .9, .9), 0.05);
+    shared_ptr<material> glass = make_shared<dielectric>(1.5);
+
+    shared_ptr<material> warm_light = make_shared<emissive>(color(60, 45, 30));
+    shared_ptr<material> cold_light = make_shared<emissive>(color(25, 35, 60));
+
+    // World
+    hittable_list world;
+
+    world.add(make_shared<sphere>(point3d(0, -1000, 0), 1000, concrete));
+
+    world.add(make_shared<sphere>(point3d(-4, 1, 0), 1.0, red));
+    world.add(make_shared<sphere>(point3d(0, 1, 0), 1.0, glass));
+    world.add(make_shared<sphere>(point3d(4, 1, 0), 1.0, mirror));
+    world.add(make_shared<sphere>(point3d(0, 0.5, 3), 0.5, blue));
+
+    // Lights
+    world.add(make_shared<sphere>(point3d(-2, 3, 2), 0.2, warm_light));
+    world.add(make_shared<sphere>(point3d(3, 2.5, -2), 0.25, cold_light));
+    world.add(make_shared<sphere>(point3d(0, 0.15, 1.5), 0.15, warm_light));
+
+    return world;
+}
@@ -0,0 +1,35 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "sphere.h"
+
+// Town square at night lit by many small lights of very different power, for light
+// sampling benchmarks. Meant for a camera without sky, looking from around (0, 4, 14).
+hittable_list get_scene_05(int light_count = 1000) {
+    // Materials
+    shared_ptr<material> concrete = make_shared<lambertian>(color(.6, .6, .6));
+    shared_ptr<material> stone = make_shared<lambertian>(color(.5, .45, .4));
+
+    // World
+    hittable_list world;
+
+    world.add(make_shared<sphere>(point3d(0, -1000, 0), 1000, concrete));
+
+    for (int i = -2; i <= 2; i++) {
+        world.add(make_shared<sphere>(point3d(i * 3.5, 1.2, -1), 1.2, stone));
+    }
+
+    // Lights scattered over the square, most of them dim
+    for (int k = 0; k < light_count; k++) {
+        point3d position(random_double(-12, 12), random_double(0.2, 4), random_double(-12, 8));
+        double intensity = 2 * pow(10.0, random_double(0, 2.5));
+        color tint = 0.5 * (color(1, 1, 1) + color::random());
+
+        world.add(make_shared<sphere>(position, random_double(0.03, 0.08), make_shared<emissive>(intensity * tint)));
+    }
+
+    return world;
+}
@@ -0,0 +1,38 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "medium.h"
+#include "noise.h"
+#include "sphere.h"
+
+// Light shafts through thin fog and a cloud of smoke, for the participating media. Meant
+// for a camera without sky, with lights, looking from around (13, 2, 3).
+hittable_list get_scene_06(int smoke_resolution = 64) {
+    // Materials
+    shared_ptr<material> ground = make_shared<lambertian>(color(.5, .5, .5));
+    shared_ptr<material> red = make_shared<lambertian>(color(.8, .2, .15));
+    shared_ptr<material> mirror = make_shared<metal>(color(.9, .9, .9), 0.05);
+    shared_ptr<material> light = make_shared<emissive>(color(150, 110, 70));
+
+    // World
+    hittable_list world;
+
+    world.add(make_shared<sphere>(point3d(0, -1000, 0), 1000, ground));
+    world.add(make_shared<sphere>(point3d(-4, 1, 0), 1.0, red));
+    world.add(make_shared<sphere>(point3d(4, 1, 0), 1.0, mirror));
+    world.add(make_shared<sphere>(point3d(1, 5, -2), 0.4, light));
+
+    // Fog filling the whole scene
+    auto air = make_shared<sphere>(point3d(0, 0, 0), 40, ground);
+    world.add(make_shared<constant_medium>(air, 0.015, color(1, 1, 1)));
+
+    // Smoke ball with a fractal density that fades towards its edge
+    int n = smoke_resolution;
+    auto cloud = make_shared<sphere>(point3d(0, 1.4, 0), 1.4, ground);
+    world.add(make_shared<grid_medium>(cloud, smoke_density(n), n, n, n, 3.0, color(.9, .9, .9)));
+
+    return world;
+}
@@ -0,0 +1,549 @@
+#ifndef SCENE_DESCRIPTION_H
+#define SCENE_DESCRIPTION_H
+
+#include "rtweekend.h"
+#include "camera.h"
+#include "environment.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "light_bvh.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "medium.h"
+#include "mesh_io.h"
+#include "noise.h"
+#include "scene_file.h"
+#include "sphere.h"
+#include "texture.h"
+
+#include <cstring>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Text description of a scene and its camera, so scenes and views change without
+// recompiling. One statement per line, a keyword and its arguments separated by blanks,
+// # starts a comment. Names must be defined before they are used.
+//
+//     resolution 600 400
+//     samples 64
+//     lookfrom 13 2 3
+//     lookat 0 0 0
+//     material gold metal 0.98 0.77 0.25 0
+//     sphere 0 -1000 0 1000 lambertian 0.5 0.5 0.55
+//     sphere -4 1 0 1 gold
+//     mesh models/bunny.ply gold scale 10 translate 0 0 2
+//
+// Camera:     resolution W H, samples N, depth N, vfov DEGREES, lookfrom X Y Z,
+//             lookat X Y Z, vup X Y Z, defocus ANGLE DISTANCE, sky on|off,
+//             background R G B, environment PATH, lights off|all|bvh
+// Textures:   texture NAME checker SCALE R G B R G B,
+//             texture NAME noise SCALE OCTAVES R G B R G B
+// Materials:  material NAME MATERIAL, where MATERIAL is lambertian R G B,
+//             lambertian TEXTURE, metal R G B FUZZ, dielectric INDEX or emissive R G B.
+//             Objects take either a name or such a material in place.
+// Objects:    sphere X Y Z RADIUS MATERIAL, mesh PATH MATERIAL [TRANSFORM],
+//             fog X Y Z RADIUS DENSITY R G B, smoke X Y Z RADIUS RESOLUTION DENSITY R G B,
+//             scene_file PATH [unchecked]
+// Transforms: any sequence of scale S, scale X Y Z, rotate X Y Z DEGREES and
+//             translate X Y Z, applied in order
+//
+// Paths are relative to the description's directory and may not contain blanks. "lights"
+// hands the emissive objects to the camera once the whole file is read, "bvh" through a
+// light_bvh. Statements leave the camera settings they do not mention as they were.
+class scene_parser {
+  public:
+    scene_parser(const std::string& _source, const std::string& _directory, hittable_list& _world, camera& _cam)
+        : source(_source), directory(_directory), world(_world), cam(_cam) {}
+
+    // Reads [begin, end) in one pass. Returns false and sets error, with the line, on failure.
+    bool parse(const char* begin, const char* end, std::string& error) {
+        line_number = 0;
+        for (const char* line = begin; line < end;) {
+            const char* next = static_cast<const char*>(memchr(line, '\n', end - line));
+            p = line;
+            line_end = next ? next : end;
+            line_number++;
+
+            token keyword;
+            if (next_token(keyword) && !(statement(keyword) && at_line_end())) {
+                error = source + ":" + std::to_string(line_number) + ": " + message;
+                return false;
+            }
+            line = next ? next + 1 : end;
+        }
+        return finish(error);
+    }
+
+  private:
+    struct token {
+        const char* begin = nullptr;
+        size_t length = 0;
+
+        bool is(const char* word) const {
+            return strlen(word) == length && memcmp(begin, word, length) == 0;
+        }
+
+        std::string str() const {
+            return std::string(begin, length);
+        }
+    };
+
+    enum class light_mode { off, all, bvh };
+
+    std::string source;
+    std::string directory;
+    hittable_list& world;
+    camera& cam;
+
+    const char* p = nullptr;
+    const char* line_end = nullptr;
+    int line_number = 0;
+    std::string message;
+
+    std::unordered_map<std::string, shared_ptr<texture>> textures;
+    std::unordered_map<std::string, shared_ptr<material>> materials;
+    std::unordered_map<std::string, shared_ptr<mesh_buffers>> mesh_files;
+    std::map<std::pair<std::string, const material*>, shared_ptr<hittable>> meshes; // Shared by instances
+    light_mode lights = light_mode::off;
+
+    // Token parsing, within the current line
+
+    static bool is_blank(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    bool next_token(token& t) {
+        while (p < line_end && is_blank(*p)) p++;
+        if (p == line_end || *p == '#') {
+            return false;
+        }
+        t.begin = p;
+        while (p < line_end && !is_blank(*p) && *p != '#') p++;
+        t.length = p - t.begin;
+        return true;
+    }
+
+    bool at_line_end() {
+        token extra;
+        if (next_token(extra)) {
+            return fail("unexpected '" + extra.str() + "'");
+        }
+        return true;
+    }
+
+    bool fail(const std::string& what) {
+        message = what;
+        return false;
+    }
+
+    // Whether the next token starts like a number
+    bool number_follows() {
+        while (p < line_end && is_blank(*p)) p++;
+        return p < line_end && ((*p >= '0' && *p <= '9') || *p == '-' || *p == '+' || *p == '.');
+    }
+
+    bool number(double& value) {
+        const char* start = p;
+        if (!parse_double(p, line_end, value) || (p < line_end && !is_blank(*p) && *p != '#')) {
+            p = start;
+            token t;
+            return fail(next_token(t) ? "expected a number, got '" + t.str() + "'" : "expected a number");
+        }
+        return true;
+    }
+
+    bool positive(double& value) {
+        return number(value) && (value > 0 || fail("expected a positive number"));
+    }
+
+    bool count(int& value, int max = 1 << 20) {
+        double d;
+        if (!number(d)) {
+            return false;
+        }
+        if (d < 1 || d > max || d != floor(d)) {
+            return fail("expected a whole number from 1 to " + std::to_string(max));
+        }
+        value = static_cast<int>(d);
+        return true;
+    }
+
+    bool triple(vector3d& v) {
+        return number(v[0]) && number(v[1]) && number(v[2]);
+    }
+
+    bool word(token& t, const char* what) {
+        return next_token(t) || fail(std::string("expected ") + what);
+    }
+
+    bool on_off(bool& value) {
+        token t;
+        if (!word(t, "on or off")) {
+            return false;
+        }
+        value = t.is("on");
+        return value || t.is("off") || fail("expected on or off, got '" + t.str() + "'");
+    }
+
+    std::string path(const token& t) const {
+        return t.length > 0 && t.begin[0] != '/' ? directory + t.str() : t.str();
+    }
+
+    // Statements
+
+    bool statement(const token& keyword) {
+        if (keyword.is("sphere")) return sphere_statement();
+        if (keyword.is("material")) return material_statement();
+        if (keyword.is("texture")) return texture_statement();
+        if (keyword.is("mesh")) return mesh_statement();
+        if (keyword.is("fog")) return fog_statement();
+        if (keyword.is("smoke")) return smoke_statement();
+        if (keyword.is("scene_file")) return scene_file_statement();
+        if (keyword.is("resolution")) return count(cam.image_width) && count(cam.image_height);
+        if (keyword.is("samples")) return count(cam.samples_per_pixel);
+        if (keyword.is("depth")) return count(cam.max_depth, 1 << 16);
+        if (keyword.is("vfov")) return positive(cam.vfov);
+        if (keyword.is("lookfrom")) return triple(cam.lookfrom);
+        if (keyword.is("lookat")) return triple(cam.lookat);
+        if (keyword.is("vup")) return triple(cam.vup);
+        if (keyword.is("defocus")) return number(cam.defocus_angle) && positive(cam.focus_dist);
+        if (keyword.is("sky")) return on_off(cam.sky);
+        if (keyword.is("background")) return triple(cam.background);
+        if (keyword.is("environment")) return environment_statement();
+        if (keyword.is("lights")) return lights_statement();
+        return fail("unknown statement '" + keyword.str() + "'");
+    }
+
+    static bool is_material_type(const token& t) {
+        return t.is("lambertian") || t.is("metal") || t.is("dielectric") || t.is("emissive");
+    }
+
+    // A material by name, or defined in place by its type and parameters
+    bool material_value(shared_ptr<material>& out) {
+        token t;
+        if (!word(t, "a material")) {
+            return false;
+        }
+
+        if (t.is("lambertian")) {
+            if (!number_follows()) {
+                token name;
+                if (!word(name, "a color or texture")) {
+                    return false;
+                }
+                auto found = textures.find(name.str());
+                if (found == textures.end()) {
+                    return fail("unknown texture '" + name.str() + "'");
+                }
+                out = make_shared<lambertian>(found->second);
+                return true;
+            }
+            color albedo;
+            if (!triple(albedo)) {
+                return false;
+            }
+            out = make_shared<lambertian>(albedo);
+            return true;
+        }
+        if (t.is("metal")) {
+            color albedo;
+            double fuzz;
+            if (!triple(albedo) || !number(fuzz)) {
+                return false;
+            }
+            out = make_shared<metal>(albedo, fuzz);
+            return true;
+        }
+        if (t.is("dielectric")) {
+            double index;
+            if (!positive(index)) {
+                return false;
+            }
+            out = make_shared<dielectric>(index);
+            return true;
+        }
+        if (t.is("emissive")) {
+            color radiance;
+            if (!triple(radiance)) {
+                return false;
+            }
+            out = make_shared<emissive>(radiance);
+            return true;
+        }
+
+        auto found = materials.find(t.str());
+        if (found == materials.end() || !found->second) {
+            return fail("unknown material '" + t.str() + "'");
+        }
+        out = found->second;
+        return true;
+    }
+
+    bool material_statement() {
+        token name;
+        if (!word(name, "a material name")) {
+            return false;
+        }
+        if (is_material_type(name)) {
+            return fail("'" + name.str() + "' is a material type, not a name");
+        }
+        // Named only once defined, so the definition can not refer to itself
+        shared_ptr<material> mat;
+        if (!material_value(mat)) {
+            return false;
+        }
+        materials[name.str()] = mat;
+        return true;
+    }
+
+    bool texture_statement() {
+        token name, type;
+        if (!word(name, "a texture name") || !word(type, "checker or noise")) {
+            return false;
+        }
+
+        double scale;
+        int octaves = 1;
+        color even, odd;
+        if (type.is("checker")) {
+            if (!positive(scale) || !triple(even) || !triple(odd)) {
+                return false;
+            }
+            textures[name.str()] = make_shared<checker_texture>(scale, even, odd);
+            return true;
+        }
+        if (type.is("noise")) {
+            if (!positive(scale) || !count(octaves, 16) || !triple(even) || !triple(odd)) {
+                return false;
+            }
+            textures[name.str()] = make_shared<noise_texture>(scale, octaves, noise_basis::perlin, even, odd);
+            return true;
+        }
+        return fail("unknown texture type '" + type.str() + "'");
+    }
+
+    bool sphere_statement() {
+        point3d center;
+        double radius;
+        shared_ptr<material> mat;
+        if (!triple(center) || !positive(radius) || !material_value(mat)) {
+            return false;
+        }
+        world.add(make_shared<sphere>(center, radius, mat));
+        return true;
+    }
+
+    bool transform(affine_transform& out, bool& any) {
+        token t;
+        any = false;
+        while (next_token(t)) {
+            affine_transform step;
+            if (t.is("scale")) {
+                double x, y, z;
+                if (!number(x)) {
+                    return false;
+                }
+                y = z = x;
+                if (number_follows() && (!number(y) || !number(z))) {
+                    return false;
+                }
+                step = affine_transform::scaling(x, y, z);
+            }
+            else if (t.is("rotate")) {
+                vector3d axis;
+                double degrees;
+                if (!triple(axis) || !number(degrees)) {
+                    return false;
+                }
+                if (axis.length_squared() == 0) {
+                    return fail("rotation axis of zero length");
+                }
+                step = affine_transform::rotation(axis, degrees);
+            }
+            else if (t.is("translate")) {
+                vector3d offset;
+                if (!triple(offset)) {
+                    return false;
+                }
+                step = affine_transform::translation(offset);
+            }
+            else {
+                return fail("expected scale, rotate or translate, got '" + t.str() + "'");
+            }
+            out = any ? out.then(step) : step;
+            any = true;
+        }
+        if (any && out.determinant() == 0) {
+            return fail("transform flattens the mesh");
+        }
+        return true;
+    }
+
+    bool mesh_statement() {
+        token file;
+        shared_ptr<material> mat;
+        affine_transform to_world;
+        bool transformed;
+        if (!word(file, "a mesh path") || !material_value(mat) || !transform(to_world, transformed)) {
+            return false;
+        }
+
+        // Each file loads once and each file and material pair builds one hierarchy,
+        // further placements are instances of it
+        std::string mesh_path = path(file);
+        shared_ptr<mesh_buffers>& buffers = mesh_files[mesh_path];
+        if (!buffers) {
+            auto loaded = make_shared<mesh_buffers>();
+            std::string error;
+            if (!load_mesh(mesh_path, *loaded, error)) {
+                mesh_files.erase(mesh_path);
+                return fail(error);
+            }
+            if (loaded->triangle_count() == 0) {
+                mesh_files.erase(mesh_path);
+                return fail(mesh_path + ": no triangles");
+            }
+            buffers = loaded;
+        }
+        shared_ptr<hittable>& mesh = meshes[std::make_pair(mesh_path, mat.get())];
+        if (!mesh) {
+            mesh = make_shared<triangle_mesh>(buffers, mat);
+        }
+
+        if (transformed) {
+            world.add(make_shared<instance>(mesh, to_world));
+        }
+        else {
+            world.add(mesh);
+        }
+        return true;
+    }
+
+    bool fog_statement() {
+        point3d center;
+        double radius, density;
+        color albedo;
+        if (!triple(center) || !positive(radius) || !positive(density) || !triple(albedo)) {
+            return false;
+        }
+        world.add(make_shared<constant_medium>(make_shared<sphere>(center, radius, nullptr), density, albedo));
+        return true;
+    }
+
+    bool smoke_statement() {
+        point3d center;
+        double radius, density;
+        int resolution;
+        color albedo;
+        if (!triple(center) || !positive(radius) || !count(resolution, 1024) || !positive(density) || !triple(albedo)) {
+            return false;
+        }
+        int n = resolution;
+        world.add(make_shared<grid_medium>(make_shared<sphere>(center, radius, nullptr), smoke_density(n), n, n, n,
+                                           density, albedo));
+        return true;
+    }
+
+    bool scene_file_statement() {
+        token file, option;
+        if (!word(file, "a scene file path")) {
+            return false;
+        }
+        bool check = true;
+        if (next_token(option)) {
+            if (!option.is("unchecked")) {
+                return fail("expected unchecked, got '" + option.str() + "'");
+            }
+            check = false;
+        }
+        hittable_list included;
+        std::string error;
+        if (!load_scene_file(path(file), included, error, check)) {
+            return fail(error);
+        }
+        for (const auto& object : included.objects) {
+            world.add(object);
+        }
+        return true;
+    }
+
+    bool environment_statement() {
+        token file;
+        if (!word(file, "an environment map path")) {
+            return false;
+        }
+        auto map = make_shared<environment_map>();
+        std::string error;
+        if (!map->load(path(file), error)) {
+            return fail(error);
+        }
+        cam.environment = map;
+        return true;
+    }
+
+    bool lights_statement() {
+        token mode;
+        if (!word(mode, "off, all or bvh")) {
+            return false;
+        }
+        if (mode.is("off")) lights = light_mode::off;
+        else if (mode.is("all")) lights = light_mode::all;
+        else if (mode.is("bvh")) lights = light_mode::bvh;
+        else return fail("expected off, all or bvh, got '" + mode.str() + "'");
+        return true;
+    }
+
+    bool finish(std::string& error) {
+        if (lights == light_mode::off) {
+            return true;
+        }
+        shared_ptr<hittable_list> emissive_objects = scene_lights(world);
+        if (emissive_objects->objects.empty()) {
+            error = source + ": lights requested but the scene has no emissive objects";
+            return false;
+        }
+        if (lights == light_mode::bvh) {
+            cam.lights = make_shared<light_bvh>(*emissive_objects);
+        }
+        else {
+            cam.lights = emissive_objects;
+        }
+        return true;
+    }
+};
+
+// Scene description from memory, objects are added to world and settings to cam. Relative
+// paths are taken from directory, which ends in a slash or is empty.
+inline bool parse_scene_description(const char* begin, const char* end, hittable_list& world, camera& cam,
+                                    std::string& error, const std::string& source = "scene",
+                                    const std::string& directory = "") {
+    // Checkpoints of one scene must not resume in another
+    uint64_t hash = mix_bits(static_cast<uint64_t>(end - begin));
+    for (const char* p = begin; p < end; p++) {
+        hash = mix_bits(hash ^ static_cast<unsigned char>(*p));
+    }
+    for (unsigned char c : directory) {
+        hash = mix_bits(hash ^ c);
+    }
+    cam.scene_hash = hash;
+
+    scene_parser parser(source, directory, world, cam);
+    return parser.parse(begin, end, error);
+}
+
+// Scene description file, see scene_parser for the statements
+inline bool load_scene_description(const std::string& path, hittable_list& world, camera& cam, std::string& error) {
+    mapped_file file;
+    if (!file.open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+    const char* begin = reinterpret_cast<const char*>(file.data());
+    return parse_scene_description(begin, begin + file.size(), world, cam, error, path, directory);
+}
+
+#endif
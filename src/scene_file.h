@@ -0,0 +1,780 @@
+#ifndef SCENE_FILE_H
+#define SCENE_FILE_H
+
+#include "rtweekend.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "mapped_file.h"
+#include "material.h"
+#include "sphere.h"
+#include "triangle_mesh.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+// Binary scene container. Every kind of record sits in one flat array, records refer to
+// each other by index, and the arrays are found through a table of sections at the start
+// of the file. Loading maps the file and the renderer reads spheres, instances, meshes and
+// bounding volume hierarchies in place: nothing is allocated or built per object, only per
+// material, mesh and light. Sections are 64 byte aligned and little endian.
+//
+//     scene_builder scene;
+//     uint32_t gold = scene.add_metal(color(.9, .8, .4), 0.0);
+//     scene.add_sphere(point3d(0, 1, 0), 1.0, gold);
+//     scene.write("scene.mrs", error);
+//     ...
+//     hittable_list world;
+//     load_scene_file("scene.mrs", world, error);
+//
+// Version 1 stores solid colored materials only; textures and media stay in C++ scenes.
+
+const char scene_file_magic[8] = { 'M', 'R', 'A', 'Y', 'S', 'C', 'N', '\0' };
+const uint32_t scene_file_version = 1;
+const uint32_t scene_file_byte_order = 0x01020304; // Reads as 0x04030201 on a big endian host
+
+enum class scene_section_kind : uint32_t {
+    materials = 1,
+    spheres,
+    meshes,
+    instances,
+    positions,    // Floats, three per vertex
+    normals,      // Floats, three per vertex
+    texcoords,    // Floats, two per vertex
+    indices,      // Three per triangle
+    mesh_nodes,   // Prebuilt mesh hierarchies, see basic_triangle_mesh::hierarchy
+    mesh_packets,
+    mesh_order,
+    nodes,        // Hierarchy over spheres and instances that are not lights
+    objects,      // Objects in the order of the hierarchy's leaves
+    lights        // Emissive objects, kept out of the hierarchy
+};
+
+struct scene_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t section_count; // Entries of the section table that follows the header
+    uint32_t reserved;
+    uint64_t file_size;
+};
+
+// Sections of kinds a reader does not know are skipped, later versions may add some
+struct scene_section {
+    uint32_t kind;
+    uint32_t stride; // Size of a record, checked against the reader's
+    uint64_t offset;
+    uint64_t count;
+};
+
+enum class scene_material_type : uint32_t {
+    lambertian,
+    metal,
+    dielectric,
+    emissive
+};
+
+struct scene_material_record {
+    uint32_t type;
+    float color[3];  // Albedo or radiance
+    float parameter; // Fuzz of metals, index of refraction of dielectrics
+};
+
+struct scene_sphere_record {
+    double center[3];
+    double radius;
+    uint32_t material;
+    uint32_t reserved;
+};
+
+// Ranges of the shared geometry sections. Meshes may share geometry and differ in material.
+struct scene_mesh_record {
+    uint64_t first_vertex;   // In positions
+    uint64_t vertex_count;
+    uint64_t first_normal;   // In normals, no_attribute if there are none
+    uint64_t first_texcoord; // In texcoords, no_attribute if there are none
+    uint64_t first_index;
+    uint64_t index_count;
+    uint64_t first_node;     // Prebuilt hierarchy, node_count 0 to build it when loading
+    uint64_t node_count;
+    uint64_t first_packet;   // Lanes in mesh_order start at first_packet * width
+    uint64_t packet_count;
+    uint32_t width;          // Triangles per packet of the prebuilt hierarchy
+    uint32_t material;
+
+    static const uint64_t no_attribute = ~0ULL;
+};
+
+struct scene_instance_record {
+    affine_transform to_world;
+    affine_transform to_object;
+    uint32_t mesh;
+    uint32_t identity; // Non-zero if to_world is the identity, rays need no transform
+};
+
+// Same layout as basic_triangle_mesh::mesh_node: the left child follows its parent, offset
+// is the right child or, for leaves, the first entry in objects
+struct scene_node_record {
+    float bounds[6];
+    int32_t offset;
+    int32_t count;
+};
+
+// Entries of objects and lights: sphere index, or instance index with the high bit set
+const uint32_t scene_instance_bit = 0x80000000u;
+
+// Bounds rounded outwards to floats
+inline void store_scene_bounds(const aabb& box, float* bounds) {
+    for (int a = 0; a < 3; a++) {
+        float lo = static_cast<float>(box.axis(a).min);
+        float hi = static_cast<float>(box.axis(a).max);
+        bounds[a] = lo > box.axis(a).min ? std::nextafter(lo, -INFINITY) : lo;
+        bounds[a + 3] = hi < box.axis(a).max ? std::nextafter(hi, INFINITY) : hi;
+    }
+}
+
+// Object of the scene hierarchy while it is built
+struct scene_build_entry {
+    aabb box;
+    uint32_t object;
+};
+
+// Median split hierarchy over the objects, leaves of up to four. entries are reordered to
+// the order of the leaves.
+inline int build_scene_hierarchy(std::vector<scene_build_entry>& entries, size_t begin, size_t end,
+                                 std::vector<scene_node_record>& nodes) {
+    int index = static_cast<int>(nodes.size());
+    nodes.push_back(scene_node_record());
+
+    aabb bounds, centers;
+    for (size_t k = begin; k < end; k++) {
+        point3d c = entries[k].box.centroid();
+        bounds = aabb(bounds, entries[k].box);
+        centers = aabb(centers, aabb(c, c));
+    }
+    store_scene_bounds(bounds, nodes[index].bounds);
+
+    if (end - begin <= 4) {
+        nodes[index].offset = static_cast<int32_t>(begin);
+        nodes[index].count = static_cast<int32_t>(end - begin);
+        return index;
+    }
+
+    int axis = 0;
+    if (centers.y.size() > centers.axis(axis).size()) axis = 1;
+    if (centers.z.size() > centers.axis(axis).size()) axis = 2;
+
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(entries.begin() + begin, entries.begin() + middle, entries.begin() + end,
+                     [axis](const scene_build_entry& a, const scene_build_entry& b) {
+                         return a.box.centroid()[axis] < b.box.centroid()[axis];
+                     });
+
+    build_scene_hierarchy(entries, begin, middle, nodes);
+    int right = build_scene_hierarchy(entries, middle, end, nodes);
+    nodes[index].offset = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+// Whether a stored hierarchy can be walked safely: right children after their parents,
+// leaves accepted by valid_leaf and no deeper than the traversal stacks allow
+template<typename Node, typename F>
+inline bool valid_stored_hierarchy(const Node* nodes, size_t count, F&& valid_leaf) {
+    std::vector<uint8_t> depth(count, 0);
+    for (size_t k = 0; k < count; k++) {
+        const Node& node = nodes[k];
+        if (node.count > 0) {
+            if (!valid_leaf(node)) return false;
+            continue;
+        }
+        if (node.offset <= static_cast<int64_t>(k) || static_cast<uint64_t>(node.offset) >= count || depth[k] >= 60) {
+            return false;
+        }
+        depth[k + 1] = std::max<uint8_t>(depth[k + 1], depth[k] + 1);
+        depth[node.offset] = std::max<uint8_t>(depth[node.offset], depth[k] + 1);
+    }
+    return true;
+}
+
+inline aabb scene_sphere_box(const scene_sphere_record& s) {
+    vector3d extent(fabs(s.radius), fabs(s.radius), fabs(s.radius));
+    point3d center(s.center[0], s.center[1], s.center[2]);
+    return aabb(center - extent, center + extent);
+}
+
+inline shared_ptr<material> make_scene_material(const scene_material_record& m) {
+    color c(m.color[0], m.color[1], m.color[2]);
+    switch (static_cast<scene_material_type>(m.type)) {
+        case scene_material_type::metal: return make_shared<metal>(c, m.parameter);
+        case scene_material_type::dielectric: return make_shared<dielectric>(m.parameter);
+        case scene_material_type::emissive: return make_shared<emissive>(c);
+        default: return make_shared<lambertian>(c);
+    }
+}
+
+// Spheres and mesh instances of a scene file, intersected where they lie in the mapping
+class scene_objects : public hittable {
+  public:
+    scene_objects(shared_ptr<mapped_file> _file, const scene_sphere_record* _spheres,
+                  const scene_instance_record* _instances, mesh_array<scene_node_record> _nodes,
+                  mesh_array<uint32_t> _objects, std::vector<shared_ptr<material>> _materials,
+                  std::vector<shared_ptr<hittable>> _meshes)
+        : file(_file), spheres(_spheres), instances(_instances), nodes(std::move(_nodes)), objects(std::move(_objects)),
+          materials(std::move(_materials)), meshes(std::move(_meshes)) {
+        if (!nodes.empty()) {
+            const float* b = nodes[0].bounds;
+            bbox = aabb(point3d(b[0], b[1], b[2]), point3d(b[3], b[4], b[5]));
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (nodes.empty()) {
+            return false;
+        }
+
+        const scene_node_record* node_data = nodes.data();
+        double inverse[3] = { 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() };
+        vector3d d = r.direction();
+        int axis = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+        double closest = ray_t.max;
+        bool hit_anything = false;
+
+        int stack[64];
+        int size = 0;
+        stack[size++] = 0;
+        while (size > 0) {
+            int index = stack[--size];
+            const scene_node_record& node = node_data[index];
+            if (!node_hit(node, r, inverse, ray_t.min, closest)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int k = 0; k < node.count; k++) {
+                    if (hit_object(objects[node.offset + k], r, interval(ray_t.min, closest), rec)) {
+                        hit_anything = true;
+                        closest = rec.t;
+                    }
+                }
+                continue;
+            }
+
+            // Visit the child nearer along the ray first
+            int left = index + 1;
+            int right = node.offset;
+            bool left_first = d[axis] >= 0
+                ? node_data[left].bounds[axis] <= node_data[right].bounds[axis]
+                : node_data[left].bounds[axis + 3] >= node_data[right].bounds[axis + 3];
+            stack[size++] = left_first ? right : left;
+            stack[size++] = left_first ? left : right;
+        }
+        return hit_anything;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    size_t object_count() const {
+        return objects.size();
+    }
+
+  private:
+    shared_ptr<mapped_file> file; // Keeps the records mapped
+    const scene_sphere_record* spheres;
+    const scene_instance_record* instances;
+    mesh_array<scene_node_record> nodes;
+    mesh_array<uint32_t> objects;
+    std::vector<shared_ptr<material>> materials;
+    std::vector<shared_ptr<hittable>> meshes;
+    aabb bbox;
+
+    static bool node_hit(const scene_node_record& node, const ray& r, const double* inverse, double t_min, double t_max) {
+        for (int a = 0; a < 3; a++) {
+            double t0 = (node.bounds[a] - r.origin()[a]) * inverse[a];
+            double t1 = (node.bounds[a + 3] - r.origin()[a]) * inverse[a];
+            if (inverse[a] < 0) {
+                std::swap(t0, t1);
+            }
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+        return t_min <= t_max * (1 + 1e-12);
+    }
+
+    bool hit_object(uint32_t object, const ray& r, interval ray_t, hit_record& rec) const {
+        if (!(object & scene_instance_bit)) {
+            const scene_sphere_record& s = spheres[object];
+            if (!sphere::intersect(point3d(s.center[0], s.center[1], s.center[2]), s.radius, r, ray_t, rec)) {
+                return false;
+            }
+            rec.mat = materials[s.material];
+            return true;
+        }
+
+        const scene_instance_record& i = instances[object & ~scene_instance_bit];
+        const hittable& mesh = *meshes[i.mesh];
+        if (i.identity) {
+            return mesh.hit(r, ray_t, rec);
+        }
+        if (!mesh.hit(instance::object_ray(r, i.to_object, instance::linear_scale(i.to_world)), ray_t, rec)) {
+            return false;
+        }
+        instance::world_hit(i.to_world, i.to_object, rec);
+        return true;
+    }
+};
+
+// Typed view of a section, checked against the file's size and the record's alignment
+template<typename T>
+inline bool scene_section_view(const mapped_file& file, const scene_section* section, const T*& records, size_t& count,
+                               std::string& error) {
+    records = nullptr;
+    count = 0;
+    if (!section) {
+        return true;
+    }
+    if (section->stride != sizeof(T) || section->offset % alignof(T) != 0 || section->offset > file.size() ||
+        (file.size() - section->offset) / sizeof(T) < section->count) {
+        error = "bad section " + std::to_string(section->kind);
+        return false;
+    }
+    records = reinterpret_cast<const T*>(file.data() + section->offset);
+    count = static_cast<size_t>(section->count);
+    return true;
+}
+
+// Open a scene file into world: the mapped objects as one hittable, and the lights as
+// objects of their own so scene_lights() finds them. With check, every index in the file
+// is validated, which reads all of it; skip that for trusted files to open in time
+// independent of their size. Returns false and sets error on failure.
+inline bool load_scene_file(const std::string& path, hittable_list& world, std::string& error, bool check = true) {
+    auto file = make_shared<mapped_file>();
+    if (!file->open(path)) {
+        error = "could not open " + path;
+        return false;
+    }
+
+    const scene_file_header* header = reinterpret_cast<const scene_file_header*>(file->data());
+    if (file->size() < sizeof(scene_file_header) || memcmp(header->magic, scene_file_magic, 8) != 0) {
+        error = path + ": not a scene file";
+        return false;
+    }
+    if (header->version != scene_file_version || header->byte_order != scene_file_byte_order ||
+        header->file_size != file->size() ||
+        (file->size() - sizeof(scene_file_header)) / sizeof(scene_section) < header->section_count) {
+        error = path + ": unsupported version, byte order or truncated";
+        return false;
+    }
+
+    const scene_section* table = reinterpret_cast<const scene_section*>(file->data() + sizeof(scene_file_header));
+    auto find = [&](scene_section_kind kind) -> const scene_section* {
+        for (uint32_t k = 0; k < header->section_count; k++) {
+            if (table[k].kind == static_cast<uint32_t>(kind)) return &table[k];
+        }
+        return nullptr;
+    };
+
+    const scene_material_record* material_records;
+    const scene_sphere_record* spheres;
+    const scene_mesh_record* mesh_records;
+    const scene_instance_record* instances;
+    const float *positions, *normals, *texcoords;
+    const uint32_t *indices, *order, *objects, *lights;
+    const triangle_mesh::mesh_node* mesh_nodes;
+    const triangle_mesh::triangle_packet* packets;
+    const scene_node_record* nodes;
+    size_t material_count, sphere_count, mesh_count, instance_count, position_count, normal_count, texcoord_count,
+        index_count, order_count, object_count, light_count, mesh_node_count, packet_count, node_count;
+    using kind = scene_section_kind;
+    bool ok = scene_section_view(*file, find(kind::materials), material_records, material_count, error) &&
+              scene_section_view(*file, find(kind::spheres), spheres, sphere_count, error) &&
+              scene_section_view(*file, find(kind::meshes), mesh_records, mesh_count, error) &&
+              scene_section_view(*file, find(kind::instances), instances, instance_count, error) &&
+              scene_section_view(*file, find(kind::positions), positions, position_count, error) &&
+              scene_section_view(*file, find(kind::normals), normals, normal_count, error) &&
+              scene_section_view(*file, find(kind::texcoords), texcoords, texcoord_count, error) &&
+              scene_section_view(*file, find(kind::indices), indices, index_count, error) &&
+              scene_section_view(*file, find(kind::mesh_nodes), mesh_nodes, mesh_node_count, error) &&
+              scene_section_view(*file, find(kind::mesh_packets), packets, packet_count, error) &&
+              scene_section_view(*file, find(kind::mesh_order), order, order_count, error) &&
+              scene_section_view(*file, find(kind::nodes), nodes, node_count, error) &&
+              scene_section_view(*file, find(kind::objects), objects, object_count, error) &&
+              scene_section_view(*file, find(kind::lights), lights, light_count, error);
+    if (!ok) {
+        error = path + ": " + error;
+        return false;
+    }
+
+    auto fail = [&](const std::string& what) {
+        error = path + ": " + what;
+        return false;
+    };
+
+    std::vector<shared_ptr<material>> materials(material_count);
+    for (size_t k = 0; k < material_count; k++) {
+        materials[k] = make_scene_material(material_records[k]);
+    }
+
+    // Meshes view their geometry and prebuilt hierarchy in the mapping
+    std::vector<shared_ptr<hittable>> meshes(mesh_count);
+    for (size_t k = 0; k < mesh_count; k++) {
+        const scene_mesh_record& m = mesh_records[k];
+        auto in = [](uint64_t first, uint64_t count, size_t size) { return first <= size && size - first >= count; };
+        bool has_normals = m.first_normal != scene_mesh_record::no_attribute;
+        bool has_texcoords = m.first_texcoord != scene_mesh_record::no_attribute;
+        if (!in(3 * m.first_vertex, 3 * m.vertex_count, position_count) || !in(m.first_index, m.index_count, index_count) ||
+            (has_normals && !in(3 * m.first_normal, 3 * m.vertex_count, normal_count)) ||
+            (has_texcoords && !in(2 * m.first_texcoord, 2 * m.vertex_count, texcoord_count)) ||
+            m.material >= material_count) {
+            return fail("mesh " + std::to_string(k) + " out of range");
+        }
+
+        auto buffers = make_shared<mesh_buffers>();
+        buffers->positions = mesh_array<float>::view_of(positions + 3 * m.first_vertex, 3 * m.vertex_count, file);
+        if (has_normals) {
+            buffers->normals = mesh_array<float>::view_of(normals + 3 * m.first_normal, 3 * m.vertex_count, file);
+        }
+        if (has_texcoords) {
+            buffers->texcoords = mesh_array<float>::view_of(texcoords + 2 * m.first_texcoord, 2 * m.vertex_count, file);
+        }
+        buffers->indices = mesh_array<uint32_t>::view_of(indices + m.first_index, m.index_count, file);
+        if (check) {
+            for (size_t i = 0; i < m.index_count; i++) {
+                if (buffers->indices[i] >= m.vertex_count) return fail("mesh " + std::to_string(k) + " index out of range");
+            }
+        }
+
+        bool prebuilt = m.node_count > 0 && m.width == 8 && in(m.first_node, m.node_count, mesh_node_count) &&
+                        in(m.first_packet, m.packet_count, packet_count) &&
+                        in(8 * m.first_packet, 8 * m.packet_count, order_count);
+        if (prebuilt && check) {
+            prebuilt = valid_stored_hierarchy(mesh_nodes + m.first_node, m.node_count, [&](const triangle_mesh::mesh_node& node) {
+                return node.offset >= 0 && node.count <= triangle_mesh::leaf_packets * 8 &&
+                       static_cast<uint64_t>(node.offset) + (node.count + 7) / 8 <= m.packet_count;
+            });
+            for (size_t i = 0; i < 8 * m.packet_count && prebuilt; i++) {
+                prebuilt = order[8 * m.first_packet + i] < m.index_count / 3;
+            }
+        }
+        if (prebuilt) {
+            triangle_mesh::hierarchy tree;
+            tree.nodes = mesh_array<triangle_mesh::mesh_node>::view_of(mesh_nodes + m.first_node, m.node_count, file);
+            tree.packets = mesh_array<triangle_mesh::triangle_packet>::view_of(packets + m.first_packet, m.packet_count, file);
+            tree.order = mesh_array<uint32_t>::view_of(order + 8 * m.first_packet, 8 * m.packet_count, file);
+            meshes[k] = make_shared<triangle_mesh>(buffers, materials[m.material], std::move(tree));
+        }
+        else {
+            meshes[k] = make_shared<triangle_mesh>(buffers, materials[m.material]);
+        }
+    }
+
+    for (size_t k = 0; k < instance_count; k++) {
+        if (instances[k].mesh >= mesh_count) return fail("instance " + std::to_string(k) + " out of range");
+    }
+
+    auto valid_object = [&](uint32_t object) {
+        return object & scene_instance_bit ? (object & ~scene_instance_bit) < instance_count
+                                           : object < sphere_count && spheres[object].material < material_count;
+    };
+    if (check) {
+        for (size_t k = 0; k < object_count; k++) {
+            if (!valid_object(objects[k])) return fail("object " + std::to_string(k) + " out of range");
+        }
+        if (!valid_stored_hierarchy(nodes, node_count, [&](const scene_node_record& node) {
+                return node.offset >= 0 && static_cast<uint64_t>(node.offset) + node.count <= object_count;
+            })) {
+            return fail("bad hierarchy");
+        }
+    }
+
+    // Without a stored hierarchy, build one over the objects now
+    mesh_array<scene_node_record> node_array;
+    mesh_array<uint32_t> object_array;
+    if (node_count > 0) {
+        node_array = mesh_array<scene_node_record>::view_of(nodes, node_count, file);
+        object_array = mesh_array<uint32_t>::view_of(objects, object_count, file);
+    }
+    else if (object_count > 0) {
+        std::vector<scene_build_entry> entries(object_count);
+        for (size_t k = 0; k < object_count; k++) {
+            uint32_t object = objects[k];
+            if (!valid_object(object)) return fail("object " + std::to_string(k) + " out of range");
+            entries[k].object = object;
+            if (object & scene_instance_bit) {
+                const scene_instance_record& i = instances[object & ~scene_instance_bit];
+                entries[k].box = i.to_world.box(meshes[i.mesh]->bounding_box());
+            }
+            else {
+                entries[k].box = scene_sphere_box(spheres[object]);
+            }
+        }
+        std::vector<scene_node_record> built;
+        built.reserve(object_count / 2 + 1);
+        build_scene_hierarchy(entries, 0, object_count, built);
+        std::vector<uint32_t> ordered(object_count);
+        for (size_t k = 0; k < object_count; k++) ordered[k] = entries[k].object;
+        node_array = std::move(built);
+        object_array = std::move(ordered);
+    }
+
+    world.clear();
+    world.add(make_shared<scene_objects>(file, spheres, instances, std::move(node_array), std::move(object_array),
+                                         materials, meshes));
+
+    for (size_t k = 0; k < light_count; k++) {
+        uint32_t light = lights[k];
+        if (!valid_object(light)) return fail("light " + std::to_string(k) + " out of range");
+        if (light & scene_instance_bit) {
+            const scene_instance_record& i = instances[light & ~scene_instance_bit];
+            world.add(i.identity ? meshes[i.mesh] : make_shared<instance>(meshes[i.mesh], i.to_world));
+        }
+        else {
+            const scene_sphere_record& s = spheres[light];
+            world.add(make_shared<sphere>(point3d(s.center[0], s.center[1], s.center[2]), s.radius, materials[s.material]));
+        }
+    }
+    return true;
+}
+
+// Collects a scene and writes it as a scene file
+class scene_builder {
+  public:
+    uint32_t add_material(scene_material_type type, const color& c, double parameter = 0) {
+        scene_material_record m;
+        m.type = static_cast<uint32_t>(type);
+        for (int a = 0; a < 3; a++) m.color[a] = static_cast<float>(c[a]);
+        m.parameter = static_cast<float>(parameter);
+        materials.push_back(m);
+        return static_cast<uint32_t>(materials.size() - 1);
+    }
+
+    uint32_t add_lambertian(const color& albedo) {
+        return add_material(scene_material_type::lambertian, albedo);
+    }
+
+    uint32_t add_metal(const color& albedo, double fuzz) {
+        return add_material(scene_material_type::metal, albedo, fuzz < 1 ? fuzz : 1);
+    }
+
+    uint32_t add_dielectric(double index_of_refraction) {
+        return add_material(scene_material_type::dielectric, color(1, 1, 1), index_of_refraction);
+    }
+
+    uint32_t add_emissive(const color& radiance) {
+        return add_material(scene_material_type::emissive, radiance);
+    }
+
+    void add_sphere(const point3d& center, double radius, uint32_t material) {
+        scene_sphere_record s = {};
+        for (int a = 0; a < 3; a++) s.center[a] = center[a];
+        s.radius = radius;
+        s.material = material;
+        spheres.push_back(s);
+    }
+
+    // A mesh with its material, placed with add_instance(). Meshes with the same buffers
+    // share their geometry in the file.
+    uint32_t add_mesh(shared_ptr<const mesh_buffers> buffers, uint32_t material) {
+        meshes.push_back(std::make_pair(buffers, material));
+        return static_cast<uint32_t>(meshes.size() - 1);
+    }
+
+    void add_instance(uint32_t mesh, const affine_transform& to_world = affine_transform::identity()) {
+        scene_instance_record i = {};
+        i.to_world = to_world;
+        i.to_object = to_world.inverse();
+        i.mesh = mesh;
+        affine_transform identity = affine_transform::identity();
+        i.identity = memcmp(&to_world, &identity, sizeof(affine_transform)) == 0;
+        instances.push_back(i);
+    }
+
+    size_t object_count() const {
+        return spheres.size() + instances.size();
+    }
+
+    // Write to path, with prebuilt hierarchies for meshes and objects unless hierarchies is
+    // false. Returns false and sets error on failure.
+    bool write(const std::string& path, std::string& error, bool hierarchies = true) const {
+        for (const scene_sphere_record& s : spheres) {
+            if (s.material >= materials.size()) {
+                error = "sphere material out of range";
+                return false;
+            }
+        }
+        for (const auto& m : meshes) {
+            if (m.second >= materials.size() || !m.first) {
+                error = "mesh or its material missing";
+                return false;
+            }
+        }
+        for (const scene_instance_record& i : instances) {
+            if (i.mesh >= meshes.size()) {
+                error = "instance mesh out of range";
+                return false;
+            }
+        }
+
+        // Geometry and hierarchies, once per distinct buffers
+        std::vector<float> positions, normals, texcoords;
+        std::vector<uint32_t> indices, order;
+        std::vector<triangle_mesh::mesh_node> mesh_nodes;
+        std::vector<triangle_mesh::triangle_packet> packets;
+        std::vector<scene_mesh_record> mesh_records;
+        std::vector<aabb> mesh_boxes;
+        std::map<const mesh_buffers*, size_t> stored; // First mesh record with the buffers
+        for (const auto& m : meshes) {
+            const mesh_buffers& b = *m.first;
+            auto previous = stored.find(&b);
+            if (previous != stored.end()) {
+                scene_mesh_record r = mesh_records[previous->second];
+                r.material = m.second;
+                mesh_records.push_back(r);
+                mesh_boxes.push_back(mesh_boxes[previous->second]);
+                continue;
+            }
+            stored[&b] = mesh_records.size();
+
+            scene_mesh_record r = {};
+            r.first_vertex = positions.size() / 3;
+            r.vertex_count = b.positions.size() / 3;
+            r.first_normal = b.normals.empty() ? scene_mesh_record::no_attribute : normals.size() / 3;
+            r.first_texcoord = b.texcoords.empty() ? scene_mesh_record::no_attribute : texcoords.size() / 2;
+            r.first_index = indices.size();
+            r.index_count = b.indices.size();
+            r.width = 8;
+            r.material = m.second;
+            positions.insert(positions.end(), b.positions.data(), b.positions.data() + b.positions.size());
+            normals.insert(normals.end(), b.normals.data(), b.normals.data() + b.normals.size());
+            texcoords.insert(texcoords.end(), b.texcoords.data(), b.texcoords.data() + b.texcoords.size());
+            indices.insert(indices.end(), b.indices.data(), b.indices.data() + b.indices.size());
+
+            triangle_mesh mesh(m.first, nullptr);
+            mesh_boxes.push_back(mesh.bounding_box());
+            if (hierarchies) {
+                const triangle_mesh::hierarchy& tree = mesh.bvh();
+                r.first_node = mesh_nodes.size();
+                r.node_count = tree.nodes.size();
+                r.first_packet = packets.size();
+                r.packet_count = tree.packets.size();
+                mesh_nodes.insert(mesh_nodes.end(), tree.nodes.data(), tree.nodes.data() + tree.nodes.size());
+                packets.insert(packets.end(), tree.packets.data(), tree.packets.data() + tree.packets.size());
+                order.insert(order.end(), tree.order.data(), tree.order.data() + tree.order.size());
+            }
+            mesh_records.push_back(r);
+        }
+
+        // Lights apart, everything else under the hierarchy
+        std::vector<scene_build_entry> entries;
+        std::vector<uint32_t> lights;
+        uint32_t emissive = static_cast<uint32_t>(scene_material_type::emissive);
+        for (size_t k = 0; k < spheres.size(); k++) {
+            const scene_sphere_record& s = spheres[k];
+            if (materials[s.material].type == emissive) {
+                lights.push_back(static_cast<uint32_t>(k));
+            }
+            else {
+                entries.push_back(scene_build_entry{ scene_sphere_box(s), static_cast<uint32_t>(k) });
+            }
+        }
+        for (size_t k = 0; k < instances.size(); k++) {
+            const scene_instance_record& i = instances[k];
+            uint32_t object = static_cast<uint32_t>(k) | scene_instance_bit;
+            if (materials[mesh_records[i.mesh].material].type == emissive) {
+                lights.push_back(object);
+            }
+            else {
+                entries.push_back(scene_build_entry{ i.to_world.box(mesh_boxes[i.mesh]), object });
+            }
+        }
+        std::vector<scene_node_record> nodes;
+        if (hierarchies && !entries.empty()) {
+            nodes.reserve(entries.size() / 2 + 1);
+            build_scene_hierarchy(entries, 0, entries.size(), nodes);
+        }
+        std::vector<uint32_t> objects(entries.size());
+        for (size_t k = 0; k < entries.size(); k++) objects[k] = entries[k].object;
+
+        struct section_data {
+            scene_section_kind kind;
+            uint32_t stride;
+            size_t count;
+            const void* data;
+        };
+        std::vector<section_data> sections = {
+            { scene_section_kind::materials, sizeof(scene_material_record), materials.size(), materials.data() },
+            { scene_section_kind::spheres, sizeof(scene_sphere_record), spheres.size(), spheres.data() },
+            { scene_section_kind::meshes, sizeof(scene_mesh_record), mesh_records.size(), mesh_records.data() },
+            { scene_section_kind::instances, sizeof(scene_instance_record), instances.size(), instances.data() },
+            { scene_section_kind::positions, sizeof(float), positions.size(), positions.data() },
+            { scene_section_kind::normals, sizeof(float), normals.size(), normals.data() },
+            { scene_section_kind::texcoords, sizeof(float), texcoords.size(), texcoords.data() },
+            { scene_section_kind::indices, sizeof(uint32_t), indices.size(), indices.data() },
+            { scene_section_kind::mesh_nodes, sizeof(triangle_mesh::mesh_node), mesh_nodes.size(), mesh_nodes.data() },
+            { scene_section_kind::mesh_packets, sizeof(triangle_mesh::triangle_packet), packets.size(), packets.data() },
+            { scene_section_kind::mesh_order, sizeof(uint32_t), order.size(), order.data() },
+            { scene_section_kind::nodes, sizeof(scene_node_record), nodes.size(), nodes.data() },
+            { scene_section_kind::objects, sizeof(uint32_t), objects.size(), objects.data() },
+            { scene_section_kind::lights, sizeof(uint32_t), lights.size(), lights.data() },
+        };
+
+        scene_file_header header = {};
+        memcpy(header.magic, scene_file_magic, 8);
+        header.version = scene_file_version;
+        header.byte_order = scene_file_byte_order;
+        header.section_count = static_cast<uint32_t>(sections.size());
+
+        std::vector<scene_section> table(sections.size());
+        uint64_t offset = sizeof(header) + table.size() * sizeof(scene_section);
+        for (size_t k = 0; k < sections.size(); k++) {
+            offset = (offset + 63) / 64 * 64;
+            table[k].kind = static_cast<uint32_t>(sections[k].kind);
+            table[k].stride = sections[k].stride;
+            table[k].offset = offset;
+            table[k].count = sections[k].count;
+            offset += sections[k].count * sections[k].stride;
+        }
+        header.file_size = offset;
+
+        // Written to a temporary name first so readers never see a partial file
+        std::string temporary = path + ".tmp";
+        FILE* f = fopen(temporary.c_str(), "wb");
+        if (!f) {
+            error = "could not create " + temporary;
+            return false;
+        }
+
+        static const char padding[64] = {};
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                  fwrite(table.data(), sizeof(scene_section), table.size(), f) == table.size();
+        uint64_t written = sizeof(header) + table.size() * sizeof(scene_section);
+        for (size_t k = 0; k < sections.size() && ok; k++) {
+            ok = fwrite(padding, 1, table[k].offset - written, f) == table[k].offset - written;
+            size_t bytes = sections[k].count * sections[k].stride;
+            ok = ok && (bytes == 0 || fwrite(sections[k].data, 1, bytes, f) == bytes);
+            written = table[k].offset + bytes;
+        }
+
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            remove(temporary.c_str());
+            error = "could not write " + path;
+            return false;
+        }
+        return true;
+    }
+
+  private:
+    std::vector<scene_material_record> materials;
+    std::vector<scene_sphere_record> spheres;
+    std::vector<std::pair<shared_ptr<const mesh_buffers>, uint32_t>> meshes;
+    std::vector<scene_instance_record> instances;
+};
+
+#endif
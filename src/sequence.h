@@ -0,0 +1,261 @@
+#ifndef SEQUENCE_H
+#define SEQUENCE_H
+
+#include "rtweekend.h"
+#include "bitmap.h"
+#include "bounded_queue.h"
+#include "camera.h"
+#include "framebuffer.h"
+#include "hittable.h"
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Renders a range of frames over one shared, read-only scene.
+// Small frames leave cores idle at the end of every frame, so when there are
+// too few pixels per core several frames are rendered concurrently instead,
+// each one with its own camera and a share of the threads.
+class sequence_renderer {
+  private:
+    // A frame travelling through the pipeline stages
+    struct pipeline_frame {
+        int frame = 0;
+        int width = 0;
+        int height = 0;
+        int samples_per_pixel = 0;
+        framebuffer radiance;              // Output of the render stage
+        std::vector<unsigned char> pixels; // Output of the tonemap stage
+        std::vector<unsigned char> encoded;// Output of the encode stage
+    };
+
+    using frame_queue = bounded_queue<pipeline_frame>;
+
+    std::atomic<int> next_frame;
+    std::atomic<int> frames_done;
+    std::mutex log_mutex;
+
+    // Start a pipeline stage with the given number of workers. The output
+    // queue is closed once the last worker of the stage has finished.
+    template <typename stage_body>
+    static void start_stage(std::vector<std::thread>& threads, int workers, frame_queue* output, stage_body body) {
+        workers = workers > 0 ? workers : 1;
+        std::shared_ptr<std::atomic<int>> remaining = std::make_shared<std::atomic<int>>(workers);
+
+        for (int i = 0; i < workers; i++) {
+            threads.push_back(std::thread([=]() {
+                body();
+                if (--*remaining == 0 && output) {
+                    output->close();
+                }
+            }));
+        }
+    }
+
+    void render_stage(const hittable& world, camera cam, int last_frame, frame_queue& rendered) {
+        for (int frame = next_frame++; frame < last_frame; frame = next_frame++) {
+            if (setup_frame) {
+                setup_frame(frame, cam);
+            }
+
+            cam.render(world);
+
+            pipeline_frame item;
+            item.frame = frame;
+            item.width = cam.image_width;
+            item.height = cam.image_height;
+            item.samples_per_pixel = cam.samples_per_pixel;
+            item.radiance = cam.get_image();
+            rendered.push(std::move(item));
+        }
+    }
+
+    void frame_worker(const hittable& world, camera cam, int last_frame, bool log_frames) {
+        for (int frame = next_frame++; frame < last_frame; frame = next_frame++) {
+            if (setup_frame) {
+                setup_frame(frame, cam);
+            }
+
+            cam.render(world);
+
+            if (frame_complete) {
+                frame_complete(frame, cam);
+            }
+
+            int done = ++frames_done;
+            if (log_frames) {
+                std::lock_guard<std::mutex> lock(log_mutex);
+                std::clog << "Frame " << frame << " done (" << done << " frames completed)\n" << std::flush;
+            }
+        }
+    }
+
+  public:
+    int max_threads = 1; // Threads shared by all frames in flight
+
+    // Below this many pixels per thread a frame is too small to keep every core busy,
+    // so frames are rendered concurrently instead
+    int min_pixels_per_thread = 128 * 128;
+
+    progress_mode progress = progress_mode::bar; // Output format of the frame log
+
+    // Configure the camera for a frame, e.g. move it along an animation path.
+    // Must depend only on the frame number, frames may be set up in any order.
+    std::function<void(int frame, camera& cam)> setup_frame;
+
+    // Called once a frame is rendered, e.g. to write it to disk.
+    // May be called concurrently from different threads.
+    std::function<void(int frame, camera& cam)> frame_complete;
+
+    // Pipelined mode settings
+    int tonemap_workers = 1; // Threads converting radiance to gamma corrected pixels
+    int encode_workers = 1;  // Threads encoding pixels into bitmap files
+    int queue_capacity = 2;  // Frames buffered between two stages
+
+    // Output path of a frame in pipelined mode
+    std::function<std::string(int frame)> frame_filename;
+
+    // Threads of the worker-th of frames concurrent frames. Threads that do not divide
+    // evenly go to the first workers, one each, so no thread is left idle.
+    static int thread_share(int threads, int frames, int worker) {
+        return threads / frames + (worker < threads % frames ? 1 : 0);
+    }
+
+    // Number of frames rendered concurrently for a given frame size
+    int frames_in_flight(int image_width, int image_height, int frame_count) const {
+        int threads = max_threads > 0 ? max_threads : 1;
+        long long pixels = static_cast<long long>(image_width) * image_height;
+
+        if (pixels / threads >= min_pixels_per_thread) {
+            return 1;
+        }
+
+        long long threads_per_frame = pixels / min_pixels_per_thread;
+        threads_per_frame = threads_per_frame > 0 ? threads_per_frame : 1;
+
+        int frames = static_cast<int>(threads / threads_per_frame);
+        frames = frames < frame_count ? frames : frame_count;
+        return frames > 0 ? frames : 1;
+    }
+
+    // Render frames [first_frame, last_frame) starting from the base camera settings
+    void render(const hittable& world, const camera& base, int first_frame, int last_frame) {
+        int threads = max_threads > 0 ? max_threads : 1;
+        // Temporal reprojection needs every frame rendered in order by the same camera
+        int frames = base.temporal ? 1 : frames_in_flight(base.image_width, base.image_height, last_frame - first_frame);
+
+        next_frame = first_frame;
+        frames_done = 0;
+
+        if (frames <= 1) {
+            // Intra-frame parallelism, one frame at a time with every thread
+            camera cam = base;
+            cam.max_threads = threads;
+            frame_worker(world, cam, last_frame, false);
+            return;
+        }
+
+        // Inter-frame parallelism, each frame gets an equal share of the threads
+        camera cam = base;
+        cam.progress = progress_mode::quiet;
+        cam.pin_threads = false;
+        cam.numa_aware = false;
+
+        if (progress == progress_mode::bar) {
+            std::clog << "\nRendering " << frames << " frames at a time on " << threads << " threads at "
+                      << base.image_width << "x" << base.image_height << " pixels\n\n" << std::flush;
+        }
+
+        std::vector<std::thread> workers;
+        for (int i = 0; i < frames; i++) {
+            cam.max_threads = thread_share(threads, frames, i);
+            workers.push_back(std::thread(&sequence_renderer::frame_worker, this, std::ref(world), cam, last_frame, progress == progress_mode::bar));
+        }
+
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Render frames [first_frame, last_frame) through a staged pipeline:
+    // camera update/render -> tonemap/gamma -> encode -> write.
+    // Stages run on their own workers connected by bounded queues, so frame N
+    // is post-processed and written while frame N+1 renders.
+    void render_pipelined(const hittable& world, const camera& base, int first_frame, int last_frame) {
+        int threads = max_threads > 0 ? max_threads : 1;
+        // Temporal reprojection needs every frame rendered in order by the same camera
+        int frames = base.temporal ? 1 : frames_in_flight(base.image_width, base.image_height, last_frame - first_frame);
+
+        next_frame = first_frame;
+        frames_done = 0;
+
+        camera cam = base;
+        if (frames > 1) {
+            cam.progress = progress_mode::quiet;
+            cam.pin_threads = false;
+            cam.numa_aware = false;
+        }
+
+        frame_queue rendered(queue_capacity);
+        frame_queue tonemapped(queue_capacity);
+        frame_queue encoded(queue_capacity);
+
+        std::vector<std::thread> stages;
+
+        // Render stage, one worker per frame in flight
+        std::atomic<int> render_workers(0);
+        start_stage(stages, frames, &rendered, [&, cam]() {
+            camera worker_cam = cam;
+            worker_cam.max_threads = thread_share(threads, frames, render_workers++);
+            render_stage(world, worker_cam, last_frame, rendered);
+        });
+
+        // Tonemap stage
+        start_stage(stages, tonemap_workers, &tonemapped, [&]() {
+            pipeline_frame item;
+            while (rendered.pop(item)) {
+                item.pixels = to_bitmap_data(item.radiance, item.samples_per_pixel);
+                item.radiance = framebuffer();
+                tonemapped.push(std::move(item));
+            }
+        });
+
+        // Encode stage
+        start_stage(stages, encode_workers, &encoded, [&]() {
+            pipeline_frame item;
+            while (tonemapped.pop(item)) {
+                item.encoded = encode_bmp(item.pixels, item.width, item.height);
+                item.pixels.clear();
+                encoded.push(std::move(item));
+            }
+        });
+
+        // Write stage, a single writer keeps the disk access sequential
+        start_stage(stages, 1, nullptr, [&]() {
+            pipeline_frame item;
+            while (encoded.pop(item)) {
+                std::string filename = frame_filename ? frame_filename(item.frame) : "frame" + std::to_string(item.frame) + ".bmp";
+                bool written = write_file(filename, item.encoded);
+
+                int done = ++frames_done;
+                std::lock_guard<std::mutex> lock(log_mutex);
+                if (!written) {
+                    std::cerr << "Could not write " << filename << "\n";
+                }
+                else if (progress == progress_mode::bar) {
+                    std::clog << "\nSaved " << filename << " (" << done << " frames completed)\n" << std::flush;
+                }
+            }
+        });
+
+        for (std::thread& stage : stages) {
+            stage.join();
+        }
+    }
+};
+
+#endif
@@ -3,17 +3,46 @@
 
 #include "rtweekend.h"
 #include "hittable.h"
+#include "material.h"
+#include "onb.h"
 
 class sphere : public hittable {
   private:
     point3d center;
     double radius;
     shared_ptr<material> mat;
+    aabb bbox;
+
+    // Random direction in the cone around +z that subtends the sphere at the given squared distance
+    vector3d random_to_sphere(double distance_squared) const {
+        double r1 = random_double();
+        double r2 = random_double();
+        double z = 1 + r2 * (sqrt(1 - radius * radius / distance_squared) - 1);
+
+        double phi = 2 * pi * r1;
+        double x = cos(phi) * sqrt(1 - z * z);
+        double y = sin(phi) * sqrt(1 - z * z);
+
+        return vector3d(x, y, z);
+    }
+
+    // Latitude-longitude coordinates of a point on the unit sphere, v = 0 at the bottom
+    static void get_sphere_uv(const point3d& p, double& u, double& v) {
+        double theta = std::acos(-p.y() < -1 ? -1 : (-p.y() > 1 ? 1 : -p.y()));
+        double phi = atan2(-p.z(), p.x()) + pi;
+        u = phi / (2 * pi);
+        v = theta / pi;
+    }
 
   public:
-    sphere(point3d _center, double _radius, shared_ptr<material> _material) : center(_center), radius(_radius), mat(_material) {}
+    sphere(point3d _center, double _radius, shared_ptr<material> _material) : center(_center), radius(_radius), mat(_material) {
+        vector3d extent(fabs(radius), fabs(radius), fabs(radius));
+        bbox = aabb(center - extent, center + extent);
+    }
 
-    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+    // Everything of a hit but the material. Shared with spheres stored in flat arrays, which
+    // have no sphere object, see scene_file.h.
+    static bool intersect(const point3d& center, double radius, const ray& r, interval ray_t, hit_record& rec) {
         vector3d oc = r.origin() - center;
         double a = r.direction().length_squared();
         double half_b = dot(oc, r.direction());
@@ -39,11 +68,71 @@ class sphere : public hittable {
         rec.p = r.at(root);
         vector3d outward_normal = (rec.p - center) / radius;
         rec.set_face_normal(r, outward_normal);
+        get_sphere_uv(outward_normal, rec.u, rec.v);
+
+        // Lines of latitude shrink towards the poles
+        double footprint = r.footprint(root) / fabs(radius);
+        double ring = sqrt(fmax(1e-6, 1 - outward_normal.y() * outward_normal.y()));
+        rec.u_footprint = footprint / (2 * pi * ring);
+        rec.v_footprint = footprint / pi;
+
+        return true;
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (!intersect(center, radius, r, ray_t, rec)) {
+            return false;
+        }
 
         // Set the spehere material
         rec.mat = mat;
 
         return true;
     }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    bool is_emissive() const override {
+        return mat && mat->is_emissive();
+    }
+
+    // Lambertian emitter: pi * area * luminance of the radiance
+    double emitted_power() const override {
+        if (!is_emissive()) {
+            return 0.0;
+        }
+        color radiance = mat->emission();
+        double luminance = 0.2126 * radiance.x() + 0.7152 * radiance.y() + 0.0722 * radiance.z();
+        return pi * 4 * pi * radius * radius * luminance;
+    }
+
+    // Uniform over the cone of directions subtended by the sphere, or over all directions from inside
+    double pdf_value(const point3d& origin, const vector3d& direction) const override {
+        hit_record rec;
+        if (!hit(ray(origin, direction), interval(0.001, infinity), rec)) {
+            return 0.0;
+        }
+
+        double distance_squared = (center - origin).length_squared();
+        if (distance_squared <= radius * radius) {
+            return 1 / (4 * pi);
+        }
+
+        double cos_theta_max = sqrt(1 - radius * radius / distance_squared);
+        return 1 / (2 * pi * (1 - cos_theta_max));
+    }
+
+    vector3d random(const point3d& origin) const override {
+        vector3d direction = center - origin;
+        double distance_squared = direction.length_squared();
+        if (distance_squared <= radius * radius) {
+            return random_unit_vector();
+        }
+
+        onb uvw(direction);
+        return uvw.transform(random_to_sphere(distance_squared));
+    }
 };
 #endif
\ No newline at end of file
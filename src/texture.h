@@ -0,0 +1,247 @@
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "hittable.h"
+#include "noise.h"
+#include "texture_cache.h"
+
+// Hit points shaded together, one array per attribute, see texture::value_batch(). Arrays a
+// texture does not need may be left null and read as 0.
+struct texture_points {
+    int count = 0;
+    const double* u = nullptr;
+    const double* v = nullptr;
+    const double* x = nullptr; // Position
+    const double* y = nullptr;
+    const double* z = nullptr;
+    const double* u_footprint = nullptr;
+    const double* v_footprint = nullptr;
+};
+
+// Color varying over a surface
+class texture {
+  public:
+    virtual ~texture() = default;
+
+    virtual color value(const hit_record& rec) const = 0;
+
+    // Values at many points in one call, written to r, g and b. Procedural textures override
+    // this with loops over the arrays that vectorize, the default calls value() per point.
+    virtual void value_batch(const texture_points& points, double* r, double* g, double* b) const {
+        auto at = [](const double* values, int i) { return values ? values[i] : 0.0; };
+        hit_record rec;
+        for (int i = 0; i < points.count; i++) {
+            rec.p = point3d(at(points.x, i), at(points.y, i), at(points.z, i));
+            rec.u = at(points.u, i);
+            rec.v = at(points.v, i);
+            rec.u_footprint = at(points.u_footprint, i);
+            rec.v_footprint = at(points.v_footprint, i);
+            color c = value(rec);
+            r[i] = c.x();
+            g[i] = c.y();
+            b[i] = c.z();
+        }
+    }
+};
+
+class solid_color : public texture {
+  public:
+    solid_color(const color& c) : albedo(c) {}
+
+    color value(const hit_record& rec) const override {
+        return albedo;
+    }
+
+    void value_batch(const texture_points& points, double* r, double* g, double* b) const override {
+        for (int i = 0; i < points.count; i++) {
+            r[i] = albedo.x();
+            g[i] = albedo.y();
+            b[i] = albedo.z();
+        }
+    }
+
+  private:
+    color albedo;
+};
+
+// Points are split into chunks this large for the temporary arrays of batch evaluation
+const int texture_chunk = 64;
+
+// Points with only the given range of another batch
+inline texture_points texture_points_range(const texture_points& points, int first, int count) {
+    texture_points range;
+    range.count = count;
+    auto offset = [first](const double* array) { return array ? array + first : nullptr; };
+    range.u = offset(points.u);
+    range.v = offset(points.v);
+    range.x = offset(points.x);
+    range.y = offset(points.y);
+    range.z = offset(points.z);
+    range.u_footprint = offset(points.u_footprint);
+    range.v_footprint = offset(points.v_footprint);
+    return range;
+}
+
+// Copy of selected points of a chunk, for textures that pass only some points on
+struct texture_gather {
+    double u[texture_chunk], v[texture_chunk];
+    double x[texture_chunk], y[texture_chunk], z[texture_chunk];
+    double u_footprint[texture_chunk], v_footprint[texture_chunk];
+
+    texture_points gather(const texture_points& points, const int* indices, int count) {
+        texture_points subset;
+        subset.count = count;
+        subset.u = copy(points.u, indices, count, u);
+        subset.v = copy(points.v, indices, count, v);
+        subset.x = copy(points.x, indices, count, x);
+        subset.y = copy(points.y, indices, count, y);
+        subset.z = copy(points.z, indices, count, z);
+        subset.u_footprint = copy(points.u_footprint, indices, count, u_footprint);
+        subset.v_footprint = copy(points.v_footprint, indices, count, v_footprint);
+        return subset;
+    }
+
+    static const double* copy(const double* from, const int* indices, int count, double* to) {
+        if (!from) {
+            return nullptr;
+        }
+        for (int k = 0; k < count; k++) {
+            to[k] = from[indices[k]];
+        }
+        return to;
+    }
+};
+
+// Solid 3D checkerboard of two textures, cubes of side scale
+class checker_texture : public texture {
+  public:
+    checker_texture(double scale, shared_ptr<texture> _even, shared_ptr<texture> _odd)
+        : inv_scale(1.0 / scale), even(_even), odd(_odd) {}
+
+    checker_texture(double scale, const color& c1, const color& c2)
+        : checker_texture(scale, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
+
+    color value(const hit_record& rec) const override {
+        return parity(rec.p.x(), rec.p.y(), rec.p.z()) ? odd->value(rec) : even->value(rec);
+    }
+
+    // Points are sorted into the two sides first, so each texture only runs on its own points
+    void value_batch(const texture_points& points, double* r, double* g, double* b) const override {
+        int side[texture_chunk];
+        int indices[2][texture_chunk];
+        texture_gather subset;
+        double sr[texture_chunk], sg[texture_chunk], sb[texture_chunk];
+        for (int first = 0; first < points.count; first += texture_chunk) {
+            int count = points.count - first < texture_chunk ? points.count - first : texture_chunk;
+            texture_points chunk = texture_points_range(points, first, count);
+
+            for (int i = 0; i < count; i++) {
+                side[i] = parity(chunk.x[i], chunk.y[i], chunk.z[i]);
+            }
+            int sizes[2] = { 0, 0 };
+            for (int i = 0; i < count; i++) {
+                indices[side[i]][sizes[side[i]]++] = i;
+            }
+
+            for (int s = 0; s < 2; s++) {
+                if (sizes[s] == 0) {
+                    continue;
+                }
+                (s ? odd : even)->value_batch(subset.gather(chunk, indices[s], sizes[s]), sr, sg, sb);
+                for (int k = 0; k < sizes[s]; k++) {
+                    r[first + indices[s][k]] = sr[k];
+                    g[first + indices[s][k]] = sg[k];
+                    b[first + indices[s][k]] = sb[k];
+                }
+            }
+        }
+    }
+
+  private:
+    double inv_scale;
+    shared_ptr<texture> even;
+    shared_ptr<texture> odd;
+
+    // 1 in odd cubes, 0 in even ones
+    int parity(double x, double y, double z) const {
+        return (floor_to_int(inv_scale * x) + floor_to_int(inv_scale * y) + floor_to_int(inv_scale * z)) & 1;
+    }
+};
+
+// Blend of two textures by gradient noise of the position: plain noise with one octave,
+// fractal Brownian motion with more. Features are about scale in size.
+class noise_texture : public texture {
+  public:
+    noise_texture(double scale, int _octaves, noise_basis _basis, shared_ptr<texture> _low, shared_ptr<texture> _high)
+        : frequency(1.0 / scale), octaves(_octaves), basis(_basis), low(_low), high(_high) {}
+
+    noise_texture(double scale, int _octaves = 1, noise_basis _basis = noise_basis::perlin,
+                  const color& c1 = color(0, 0, 0), const color& c2 = color(1, 1, 1))
+        : noise_texture(scale, _octaves, _basis, make_shared<solid_color>(c1), make_shared<solid_color>(c2)) {}
+
+    color value(const hit_record& rec) const override {
+        double n = tables.fbm(basis, frequency * rec.p.x(), frequency * rec.p.y(), frequency * rec.p.z(), octaves);
+        double t = blend(n);
+        return (1 - t) * low->value(rec) + t * high->value(rec);
+    }
+
+    void value_batch(const texture_points& points, double* r, double* g, double* b) const override {
+        double x[texture_chunk], y[texture_chunk], z[texture_chunk], t[texture_chunk];
+        double low_r[texture_chunk], low_g[texture_chunk], low_b[texture_chunk];
+        for (int first = 0; first < points.count; first += texture_chunk) {
+            int count = points.count - first < texture_chunk ? points.count - first : texture_chunk;
+            texture_points chunk = texture_points_range(points, first, count);
+
+            for (int i = 0; i < count; i++) {
+                x[i] = frequency * chunk.x[i];
+                y[i] = frequency * chunk.y[i];
+                z[i] = frequency * chunk.z[i];
+            }
+            tables.fbm_batch(basis, count, x, y, z, octaves, 2.0, 0.5, t);
+
+            low->value_batch(chunk, low_r, low_g, low_b);
+            high->value_batch(chunk, r + first, g + first, b + first);
+            for (int i = 0; i < count; i++) {
+                double s = blend(t[i]);
+                r[first + i] = low_r[i] + s * (r[first + i] - low_r[i]);
+                g[first + i] = low_g[i] + s * (g[first + i] - low_g[i]);
+                b[first + i] = low_b[i] + s * (b[first + i] - low_b[i]);
+            }
+        }
+    }
+
+  private:
+    noise tables;
+    double frequency;
+    int octaves;
+    noise_basis basis;
+    shared_ptr<texture> low;
+    shared_ptr<texture> high;
+
+    // Noise in about [-1, 1] to a blend factor in [0, 1]
+    static double blend(double n) {
+        double t = 0.5 * (1 + n);
+        return t < 0 ? 0 : (t > 1 ? 1 : t);
+    }
+};
+
+// Image from a texture_cache, filtered by the footprint of the ray that hit
+class image_texture : public texture {
+  public:
+    image_texture(shared_ptr<texture_cache> _cache, int _id) : cache(_cache), id(_id) {}
+
+    color value(const hit_record& rec) const override {
+        if (!cache || id < 0) {
+            return color(0, 1, 1); // Cyan marks a missing texture
+        }
+        return cache->lookup(id, rec.u, rec.v, rec.u_footprint, rec.v_footprint);
+    }
+
+  private:
+    shared_ptr<texture_cache> cache;
+    int id;
+};
+
+#endif
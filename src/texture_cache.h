@@ -0,0 +1,397 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "rtweekend.h"
+#include "color.h"
+#include "image_io.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Image textures larger than memory. Textures are stored on disk as mip-mapped square
+// tiles (see convert()) that are read on first use and kept in a shared cache of fixed
+// size, least recently used tiles are dropped first. Each thread remembers the tiles it
+// used last, so most lookups take no lock.
+//
+//     auto textures = make_shared<texture_cache>(512 << 20);
+//     int earth = textures->open("earth.hdr", error);
+//     auto mat = make_shared<lambertian>(make_shared<image_texture>(textures, earth));
+class texture_cache {
+  public:
+    struct statistics {
+        uint64_t hits;      // Tiles found in the shared cache
+        uint64_t misses;    // Tiles read from disk
+        uint64_t evictions;
+        size_t bytes;       // Held by the shared cache
+    };
+
+  private:
+    // Tiled file layout: file_header, one level_header per mip level, then the tiles of each
+    // level row by row, tile_size x tile_size RGB floats each, edge tiles padded
+    struct file_header {
+        char magic[8];
+        int32_t width;
+        int32_t height;
+        int32_t tile_size;
+        int32_t levels;
+    };
+
+    struct level_header {
+        int32_t width;
+        int32_t height;
+        int32_t tiles_x;
+        int32_t tiles_y;
+        int64_t offset; // Of the first tile
+    };
+
+    struct texture_file {
+        int fd = -1;
+        file_header header;
+        std::vector<level_header> levels;
+    };
+
+    struct tile_data {
+        std::vector<float> texels;
+    };
+
+    struct cache_entry {
+        uint64_t key;
+        shared_ptr<const tile_data> tile;
+    };
+
+    // Per thread direct-mapped cache of recently used tiles
+    struct local_slot {
+        uint64_t owner = 0; // serial of the texture_cache, 0 if empty
+        uint64_t key = 0;
+        shared_ptr<const tile_data> tile;
+    };
+
+    static const int local_slots = 64;
+
+    size_t budget;
+    uint64_t serial;
+    std::deque<texture_file> textures;
+
+    std::mutex lock;
+    std::list<cache_entry> recent; // Most recently used first
+    std::unordered_map<uint64_t, std::list<cache_entry>::iterator> entries;
+    size_t bytes = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t evictions = 0;
+
+    static uint64_t next_serial() {
+        static std::atomic<uint64_t> counter(0);
+        return ++counter;
+    }
+
+    static uint64_t tile_key(int texture, int level, int tile) {
+        return (static_cast<uint64_t>(texture) << 40) | (static_cast<uint64_t>(level) << 32) | static_cast<uint32_t>(tile);
+    }
+
+    size_t tile_bytes(const texture_file& file) const {
+        return static_cast<size_t>(file.header.tile_size) * file.header.tile_size * 3 * sizeof(float);
+    }
+
+    shared_ptr<const tile_data> read_tile(const texture_file& file, int level, int tile) const {
+        auto data = make_shared<tile_data>();
+        size_t size = tile_bytes(file);
+        data->texels.resize(size / sizeof(float));
+
+        off_t offset = file.levels[level].offset + static_cast<off_t>(tile) * size;
+        size_t done = 0;
+        while (done < size) {
+            ssize_t n = pread(file.fd, reinterpret_cast<char*>(data->texels.data()) + done, size - done, offset + done);
+            if (n <= 0) {
+                // Unreadable tiles show up black rather than stopping the render
+                std::fill(data->texels.begin(), data->texels.end(), 0.0f);
+                break;
+            }
+            done += n;
+        }
+        return data;
+    }
+
+    // Tile from the shared cache or disk. The read happens outside the lock, if two threads
+    // miss the same tile at once the first one inserted wins.
+    shared_ptr<const tile_data> shared_tile(const texture_file& file, uint64_t key, int level, int tile) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            auto found = entries.find(key);
+            if (found != entries.end()) {
+                hits++;
+                recent.splice(recent.begin(), recent, found->second);
+                return found->second->tile;
+            }
+        }
+
+        shared_ptr<const tile_data> data = read_tile(file, level, tile);
+
+        std::lock_guard<std::mutex> guard(lock);
+        auto found = entries.find(key);
+        if (found != entries.end()) {
+            recent.splice(recent.begin(), recent, found->second);
+            return found->second->tile;
+        }
+
+        misses++;
+        recent.push_front(cache_entry{ key, data });
+        entries[key] = recent.begin();
+        bytes += tile_bytes(file);
+
+        // Tiles still held by a thread's local cache stay alive until it replaces them
+        while (bytes > budget && recent.size() > 1) {
+            const cache_entry& oldest = recent.back();
+            bytes -= oldest.tile->texels.size() * sizeof(float);
+            entries.erase(oldest.key);
+            recent.pop_back();
+            evictions++;
+        }
+        return data;
+    }
+
+    color texel(int texture, int level, int x, int y) {
+        const texture_file& file = textures[texture];
+        const level_header& l = file.levels[level];
+        int size = file.header.tile_size;
+        int tile = (y / size) * l.tiles_x + x / size;
+        uint64_t key = tile_key(texture, level, tile);
+
+        thread_local local_slot slots[local_slots];
+        local_slot& slot = slots[(key ^ (key >> 29) ^ serial) % local_slots];
+        if (slot.owner != serial || slot.key != key) {
+            slot.tile = shared_tile(file, key, level, tile);
+            slot.owner = serial;
+            slot.key = key;
+        }
+
+        const float* t = &slot.tile->texels[(static_cast<size_t>(y % size) * size + x % size) * 3];
+        return color(t[0], t[1], t[2]);
+    }
+
+    // Bilinear filtered value of a level, u wraps around and v is clamped
+    color bilinear(int texture, int level, double u, double v) {
+        const level_header& l = textures[texture].levels[level];
+        double x = (u - std::floor(u)) * l.width - 0.5;
+        double y = (1 - (v < 0 ? 0 : (v > 1 ? 1 : v))) * l.height - 0.5;
+        int x0 = static_cast<int>(std::floor(x));
+        int y0 = static_cast<int>(std::floor(y));
+        double tx = x - x0;
+        double ty = y - y0;
+
+        int x1 = x0 + 1 < l.width ? x0 + 1 : 0;
+        x0 = x0 < 0 ? l.width - 1 : x0;
+        int y1 = y0 + 1 < l.height ? y0 + 1 : l.height - 1;
+        y0 = y0 < 0 ? 0 : y0;
+
+        color top = (1 - tx) * texel(texture, level, x0, y0) + tx * texel(texture, level, x1, y0);
+        color bottom = (1 - tx) * texel(texture, level, x0, y1) + tx * texel(texture, level, x1, y1);
+        return (1 - ty) * top + ty * bottom;
+    }
+
+    static bool is_tiled(const std::string& path) {
+        FILE* f = fopen(path.c_str(), "rb");
+        if (!f) {
+            return false;
+        }
+        char magic[8];
+        bool tiled = fread(magic, 1, sizeof(magic), f) == sizeof(magic) && memcmp(magic, "MRAYTEX1", 8) == 0;
+        fclose(f);
+        return tiled;
+    }
+
+    static bool newer_than(const std::string& path, const std::string& other) {
+        struct stat a, b;
+        return stat(path.c_str(), &a) == 0 && stat(other.c_str(), &b) == 0 && a.st_mtime >= b.st_mtime;
+    }
+
+  public:
+    texture_cache(size_t budget_bytes = 256 << 20) : budget(budget_bytes), serial(next_serial()) {}
+
+    ~texture_cache() {
+        for (texture_file& file : textures) {
+            ::close(file.fd);
+        }
+    }
+
+    texture_cache(const texture_cache&) = delete;
+    texture_cache& operator=(const texture_cache&) = delete;
+
+    // Open a texture and return its id, or -1 with error set. Images that are not tiled yet
+    // are converted once to path + ".tiled" next to them. Textures must be opened before
+    // rendering starts.
+    int open(const std::string& path, std::string& error) {
+        std::string tiled = path;
+        if (!is_tiled(path)) {
+            tiled = path + ".tiled";
+            if (!is_tiled(tiled) || !newer_than(tiled, path)) {
+                image_data image;
+                if (!load_image(path, image, error) || !convert(image, tiled, 64, error)) {
+                    return -1;
+                }
+            }
+        }
+
+        texture_file file;
+        file.fd = ::open(tiled.c_str(), O_RDONLY);
+        if (file.fd < 0) {
+            error = "could not open " + tiled;
+            return -1;
+        }
+
+        bool ok = pread(file.fd, &file.header, sizeof(file.header), 0) == sizeof(file.header) &&
+                  memcmp(file.header.magic, "MRAYTEX1", 8) == 0 && file.header.tile_size > 0 &&
+                  file.header.levels > 0 && file.header.levels <= 32;
+        if (ok) {
+            file.levels.resize(file.header.levels);
+            size_t size = file.levels.size() * sizeof(level_header);
+            ok = pread(file.fd, file.levels.data(), size, sizeof(file.header)) == static_cast<ssize_t>(size);
+        }
+        if (!ok) {
+            ::close(file.fd);
+            error = tiled + ": bad tiled texture";
+            return -1;
+        }
+
+        std::lock_guard<std::mutex> guard(lock);
+        textures.push_back(file);
+        return static_cast<int>(textures.size()) - 1;
+    }
+
+    // Filtered value at (u, v) for a ray footprint of u_footprint by v_footprint, the mip
+    // level is picked so the footprint covers about one texel and blended with the next
+    color lookup(int texture, double u, double v, double u_footprint, double v_footprint) {
+        const texture_file& file = textures[texture];
+        double width = fmax(u_footprint * file.header.width, v_footprint * file.header.height);
+        double level = width > 1 ? std::log2(width) : 0.0;
+        int last = file.header.levels - 1;
+        if (level >= last) {
+            return bilinear(texture, last, u, v);
+        }
+
+        int fine = static_cast<int>(level);
+        double blend = level - fine;
+        color value = bilinear(texture, fine, u, v);
+        if (blend > 0) {
+            value = (1 - blend) * value + blend * bilinear(texture, fine + 1, u, v);
+        }
+        return value;
+    }
+
+    int width(int texture) const {
+        return textures[texture].header.width;
+    }
+
+    int height(int texture) const {
+        return textures[texture].header.height;
+    }
+
+    statistics stats() {
+        std::lock_guard<std::mutex> guard(lock);
+        return statistics{ hits, misses, evictions, bytes };
+    }
+
+    // Write an image as a tiled texture with a full mip chain of 2 x 2 box filtered levels.
+    // Returns false and sets error on failure.
+    static bool convert(const image_data& image, const std::string& path, int tile_size, std::string& error) {
+        if (image.width <= 0 || image.height <= 0 || tile_size <= 0) {
+            error = "empty image";
+            return false;
+        }
+
+        // Mip chain down to a single texel
+        std::vector<image_data> chain(1, image);
+        while (chain.back().width > 1 || chain.back().height > 1) {
+            const image_data& fine = chain.back();
+            image_data coarse;
+            coarse.width = (fine.width + 1) / 2;
+            coarse.height = (fine.height + 1) / 2;
+            coarse.texels.resize(static_cast<size_t>(coarse.width) * coarse.height * 3);
+            for (int y = 0; y < coarse.height; y++) {
+                for (int x = 0; x < coarse.width; x++) {
+                    int x0 = 2 * x, x1 = 2 * x + 1 < fine.width ? 2 * x + 1 : 2 * x;
+                    int y0 = 2 * y, y1 = 2 * y + 1 < fine.height ? 2 * y + 1 : 2 * y;
+                    for (int c = 0; c < 3; c++) {
+                        float sum = fine.texels[(static_cast<size_t>(y0) * fine.width + x0) * 3 + c] +
+                                    fine.texels[(static_cast<size_t>(y0) * fine.width + x1) * 3 + c] +
+                                    fine.texels[(static_cast<size_t>(y1) * fine.width + x0) * 3 + c] +
+                                    fine.texels[(static_cast<size_t>(y1) * fine.width + x1) * 3 + c];
+                        coarse.texels[(static_cast<size_t>(y) * coarse.width + x) * 3 + c] = 0.25f * sum;
+                    }
+                }
+            }
+            chain.push_back(std::move(coarse));
+        }
+
+        file_header header;
+        memcpy(header.magic, "MRAYTEX1", 8);
+        header.width = image.width;
+        header.height = image.height;
+        header.tile_size = tile_size;
+        header.levels = static_cast<int32_t>(chain.size());
+
+        std::vector<level_header> levels(chain.size());
+        int64_t offset = sizeof(header) + levels.size() * sizeof(level_header);
+        size_t tile_floats = static_cast<size_t>(tile_size) * tile_size * 3;
+        for (size_t k = 0; k < chain.size(); k++) {
+            levels[k].width = chain[k].width;
+            levels[k].height = chain[k].height;
+            levels[k].tiles_x = (chain[k].width + tile_size - 1) / tile_size;
+            levels[k].tiles_y = (chain[k].height + tile_size - 1) / tile_size;
+            levels[k].offset = offset;
+            offset += static_cast<int64_t>(levels[k].tiles_x) * levels[k].tiles_y * tile_floats * sizeof(float);
+        }
+
+        // Written to a temporary name first so readers never see a partial file
+        std::string temporary = path + ".tmp";
+        FILE* f = fopen(temporary.c_str(), "wb");
+        if (!f) {
+            error = "could not create " + temporary;
+            return false;
+        }
+
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                  fwrite(levels.data(), sizeof(level_header), levels.size(), f) == levels.size();
+        std::vector<float> tile(tile_floats);
+        for (size_t k = 0; k < chain.size() && ok; k++) {
+            const image_data& level = chain[k];
+            for (int ty = 0; ty < levels[k].tiles_y && ok; ty++) {
+                for (int tx = 0; tx < levels[k].tiles_x && ok; tx++) {
+                    // Texels past the edge repeat the last row and column
+                    for (int y = 0; y < tile_size; y++) {
+                        int sy = ty * tile_size + y < level.height ? ty * tile_size + y : level.height - 1;
+                        for (int x = 0; x < tile_size; x++) {
+                            int sx = tx * tile_size + x < level.width ? tx * tile_size + x : level.width - 1;
+                            memcpy(&tile[(static_cast<size_t>(y) * tile_size + x) * 3],
+                                   &level.texels[(static_cast<size_t>(sy) * level.width + sx) * 3], 3 * sizeof(float));
+                        }
+                    }
+                    ok = fwrite(tile.data(), sizeof(float), tile.size(), f) == tile.size();
+                }
+            }
+        }
+
+        ok = fclose(f) == 0 && ok;
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0) {
+            remove(temporary.c_str());
+            error = "could not write " + path;
+            return false;
+        }
+        return true;
+    }
+};
+
+#endif
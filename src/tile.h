@@ -0,0 +1,32 @@
+#ifndef TILE_H
+#define TILE_H
+
+#include <vector>
+
+// Rectangular block of pixels [x0, x1) x [y0, y1)
+struct tile {
+    int x0, y0;
+    int x1, y1;
+
+    int width() const { return x1 - x0; }
+    int height() const { return y1 - y0; }
+    int pixel_count() const { return width() * height(); }
+};
+
+// Split rows [min_row, max_row) of an image into tiles of at most tile_size x tile_size pixels, row by row
+inline std::vector<tile> split_into_tiles(int image_width, int min_row, int max_row, int tile_size) {
+    std::vector<tile> tiles;
+    for (int y = min_row; y < max_row; y += tile_size) {
+        for (int x = 0; x < image_width; x += tile_size) {
+            tile t;
+            t.x0 = x;
+            t.y0 = y;
+            t.x1 = x + tile_size < image_width ? x + tile_size : image_width;
+            t.y1 = y + tile_size < max_row ? y + tile_size : max_row;
+            tiles.push_back(t);
+        }
+    }
+    return tiles;
+}
+
+#endif
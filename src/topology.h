@@ -0,0 +1,184 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// A NUMA node and the CPUs attached to it
+struct numa_node {
+    int id;
+    std::vector<int> cpus;
+};
+
+class cpu_topology {
+  private:
+    // Parse a kernel cpu list such as "0-3,8-11"
+    static std::vector<int> parse_cpu_list(const std::string& list) {
+        std::vector<int> cpus;
+        size_t pos = 0;
+        while (pos < list.size()) {
+            size_t end = list.find(',', pos);
+            if (end == std::string::npos) {
+                end = list.size();
+            }
+
+            std::string range = list.substr(pos, end - pos);
+            int first, last;
+            if (sscanf(range.c_str(), "%d-%d", &first, &last) == 2) {
+                for (int cpu = first; cpu <= last; cpu++) {
+                    cpus.push_back(cpu);
+                }
+            }
+            else if (sscanf(range.c_str(), "%d", &first) == 1) {
+                cpus.push_back(first);
+            }
+
+            pos = end + 1;
+        }
+        return cpus;
+    }
+
+    static std::string read_line(const std::string& path) {
+        std::string line;
+        FILE* f = fopen(path.c_str(), "r");
+        if (f) {
+            char buffer[4096];
+            if (fgets(buffer, sizeof(buffer), f)) {
+                line = buffer;
+            }
+            fclose(f);
+        }
+        return line;
+    }
+
+  public:
+    std::vector<numa_node> nodes;
+
+    // Discover the NUMA layout from /sys, restricted to the CPUs this process may run on.
+    // Falls back to a single node holding every available CPU.
+    static cpu_topology discover() {
+        cpu_topology topology;
+
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool have_mask = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        DIR* dir = opendir("/sys/devices/system/node");
+        if (dir) {
+            struct dirent* entry;
+            while ((entry = readdir(dir)) != nullptr) {
+                int id;
+                if (sscanf(entry->d_name, "node%d", &id) != 1) {
+                    continue;
+                }
+
+                numa_node node;
+                node.id = id;
+                std::string path = std::string("/sys/devices/system/node/") + entry->d_name + "/cpulist";
+                for (int cpu : parse_cpu_list(read_line(path))) {
+                    if (!have_mask || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+                        node.cpus.push_back(cpu);
+                    }
+                }
+
+                if (!node.cpus.empty()) {
+                    topology.nodes.push_back(node);
+                }
+            }
+            closedir(dir);
+        }
+
+        // Keep nodes in id order, readdir does not guarantee any
+        for (size_t i = 1; i < topology.nodes.size(); i++) {
+            for (size_t j = i; j > 0 && topology.nodes[j].id < topology.nodes[j - 1].id; j--) {
+                std::swap(topology.nodes[j], topology.nodes[j - 1]);
+            }
+        }
+
+        if (topology.nodes.empty() && have_mask) {
+            numa_node node;
+            node.id = 0;
+            for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &allowed)) {
+                    node.cpus.push_back(cpu);
+                }
+            }
+            topology.nodes.push_back(node);
+        }
+#endif
+
+        if (topology.nodes.empty()) {
+            numa_node node;
+            node.id = 0;
+            int count = static_cast<int>(std::thread::hardware_concurrency());
+            for (int cpu = 0; cpu < (count > 0 ? count : 1); cpu++) {
+                node.cpus.push_back(cpu);
+            }
+            topology.nodes.push_back(node);
+        }
+
+        return topology;
+    }
+
+    // Topology of the host, discovered once
+    static const cpu_topology& host() {
+        static const cpu_topology topology = discover();
+        return topology;
+    }
+
+    int cpu_count() const {
+        int count = 0;
+        for (const numa_node& node : nodes) {
+            count += static_cast<int>(node.cpus.size());
+        }
+        return count;
+    }
+
+    // Spread num_threads threads over the available CPUs, node by node, so that
+    // consecutive threads share a node. Returns the CPU and node index of each thread.
+    void assign_threads(int num_threads, std::vector<int>& thread_cpu, std::vector<int>& thread_node) const {
+        std::vector<int> cpus;
+        std::vector<int> cpu_node;
+        for (size_t n = 0; n < nodes.size(); n++) {
+            for (int cpu : nodes[n].cpus) {
+                cpus.push_back(cpu);
+                cpu_node.push_back(static_cast<int>(n));
+            }
+        }
+
+        thread_cpu.resize(num_threads);
+        thread_node.resize(num_threads);
+        for (int i = 0; i < num_threads; i++) {
+            size_t slot = static_cast<size_t>(i) * cpus.size() / num_threads;
+            thread_cpu[i] = cpus[slot];
+            thread_node[i] = cpu_node[slot];
+        }
+    }
+};
+
+// Restrict the calling thread to the given CPUs. Returns false if unsupported or refused.
+inline bool pin_current_thread(const std::vector<int>& cpus) {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus) {
+        if (cpu >= 0 && cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    return false;
+#endif
+}
+
+#endif
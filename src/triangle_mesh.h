@@ -0,0 +1,541 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "rtweekend.h"
+#include "aabb.h"
+#include "alias_table.h"
+#include "hittable.h"
+#include "material.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <initializer_list>
+#include <utility>
+#include <vector>
+
+// Read only array of mesh data, either owned or a view into memory that stays alive with
+// the array, a mapped file for example, so loaders can hand out file contents uncopied
+template<typename T>
+class mesh_array {
+  private:
+    std::vector<T> owned;
+    const T* view = nullptr;
+    size_t view_size = 0;
+    shared_ptr<const void> keep_alive;
+
+  public:
+    mesh_array() {}
+    mesh_array(std::vector<T> values) : owned(std::move(values)) {}
+    mesh_array(std::initializer_list<T> values) : owned(values) {}
+
+    // The n elements at data, valid as long as owner is
+    static mesh_array view_of(const T* data, size_t n, shared_ptr<const void> owner) {
+        mesh_array array;
+        array.view = data;
+        array.view_size = n;
+        array.keep_alive = std::move(owner);
+        return array;
+    }
+
+    const T* data() const { return view ? view : owned.data(); }
+    size_t size() const { return view ? view_size : owned.size(); }
+    bool empty() const { return size() == 0; }
+    bool is_view() const { return view != nullptr; }
+    const T& operator[](size_t i) const { return data()[i]; }
+};
+
+// Indexed triangles, shareable between meshes. Positions, normals and texture coordinates
+// are per vertex; normals and texture coordinates may be left empty.
+struct mesh_buffers {
+    mesh_array<float> positions;  // x, y, z per vertex
+    mesh_array<float> normals;    // x, y, z per vertex
+    mesh_array<float> texcoords;  // u, v per vertex
+    mesh_array<uint32_t> indices; // Three per triangle
+
+    size_t triangle_count() const {
+        return indices.size() / 3;
+    }
+
+    point3d position(uint32_t vertex) const {
+        return point3d(positions[3 * vertex], positions[3 * vertex + 1], positions[3 * vertex + 2]);
+    }
+};
+
+// Triangle mesh with its own bounding volume hierarchy. Each leaf holds up to two packets of
+// Width triangles, coordinates copied side by side, so the intersection loop tests Width of
+// them at once in vector registers. The test is watertight (Woop, Benthin
+// and Wald 2013): rays through shared edges and vertices hit exactly one of the triangles.
+//
+//     auto buffers = make_shared<mesh_buffers>();  // Filled by a loader
+//     world.add(make_shared<triangle_mesh>(buffers, mat));
+template<int Width>
+class basic_triangle_mesh : public hittable {
+  public:
+    // Leaf triangles, vertex x axis x lane. Unused lanes are degenerate and never hit.
+    struct triangle_packet {
+        float v[3][3][Width];
+    };
+
+    struct mesh_node {
+        float bounds[6];   // Min x, y, z, max x, y, z
+        int32_t offset;    // Right child of an inner node, first packet of a leaf
+        int32_t count;     // Triangles of a leaf, 0 for inner nodes whose left child follows
+    };
+
+    // Packets per leaf. Coordinates take 36 bytes per triangle and the triangle number
+    // 4 more; with two packets per leaf the nodes add about 32 / Width, so a mesh takes
+    // 44 bytes per triangle at Width 8 and 48 at Width 4.
+    static const int leaf_packets = 2;
+
+    // The hierarchy in flat arrays, which can be stored with the mesh and used in place
+    // when it is loaded again, see scene_file.h
+    struct hierarchy {
+        mesh_array<mesh_node> nodes;
+        mesh_array<triangle_packet> packets;
+        mesh_array<uint32_t> order; // Triangle in each packet lane
+    };
+
+  private:
+    // Hierarchy while it is built
+    struct hierarchy_builder {
+        std::vector<mesh_node> nodes;
+        std::vector<triangle_packet> packets;
+        std::vector<uint32_t> order;
+    };
+
+    // Ray transformed so its direction is +z, shared by all triangle tests
+    struct ray_frame {
+        int kx, ky, kz;
+        double sx, sy, sz;
+        double origin[3];
+    };
+
+    shared_ptr<const mesh_buffers> buffers;
+    shared_ptr<material> mat;
+    hierarchy tree;
+    aabb bbox;
+
+    // Light sampling over the surface, by area
+    double area = 0;
+    alias_table triangle_areas;
+
+    point3d vertex(size_t triangle, int corner) const {
+        return buffers->position(buffers->indices[3 * triangle + corner]);
+    }
+
+    vector3d face_normal(size_t triangle) const {
+        point3d a = vertex(triangle, 0);
+        return cross(vertex(triangle, 1) - a, vertex(triangle, 2) - a);
+    }
+
+    // Split at the median of the centers along the widest axis, rounded to whole leaves
+    // so every leaf but one is full
+    size_t split(std::vector<uint32_t>& triangles, const std::vector<point3d>& centers, size_t begin, size_t end) const {
+        aabb extent;
+        for (size_t k = begin; k < end; k++) {
+            extent = aabb(extent, aabb(centers[triangles[k]], centers[triangles[k]]));
+        }
+        int axis = 0;
+        if (extent.y.size() > extent.axis(axis).size()) axis = 1;
+        if (extent.z.size() > extent.axis(axis).size()) axis = 2;
+
+        size_t half = (end - begin) / 2;
+        size_t leaf_size = static_cast<size_t>(leaf_packets) * Width;
+        size_t middle = begin + (half + leaf_size - 1) / leaf_size * leaf_size;
+        std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+                         [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+        return middle;
+    }
+
+    int build(hierarchy_builder& out, std::vector<uint32_t>& triangles, const std::vector<point3d>& centers, size_t begin,
+              size_t end) {
+        std::vector<mesh_node>& nodes = out.nodes;
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(mesh_node());
+
+        float lo[3] = { INFINITY, INFINITY, INFINITY };
+        float hi[3] = { -INFINITY, -INFINITY, -INFINITY };
+        for (size_t k = begin; k < end; k++) {
+            for (int corner = 0; corner < 3; corner++) {
+                const float* p = &buffers->positions[3 * buffers->indices[3 * triangles[k] + corner]];
+                for (int a = 0; a < 3; a++) {
+                    lo[a] = std::min(lo[a], p[a]);
+                    hi[a] = std::max(hi[a], p[a]);
+                }
+            }
+        }
+        for (int a = 0; a < 3; a++) {
+            nodes[index].bounds[a] = lo[a];
+            nodes[index].bounds[a + 3] = hi[a];
+        }
+
+        if (end - begin <= static_cast<size_t>(leaf_packets) * Width) {
+            nodes[index].offset = static_cast<int32_t>(out.packets.size());
+            nodes[index].count = static_cast<int32_t>(end - begin);
+
+            for (size_t first = begin; first < end; first += Width) {
+                triangle_packet packet = {};
+                for (size_t k = first; k < end && k < first + Width; k++) {
+                    int lane = static_cast<int>(k - first);
+                    for (int corner = 0; corner < 3; corner++) {
+                        const float* p = &buffers->positions[3 * buffers->indices[3 * triangles[k] + corner]];
+                        for (int a = 0; a < 3; a++) {
+                            packet.v[corner][a][lane] = p[a];
+                        }
+                    }
+                }
+                out.packets.push_back(packet);
+                for (int lane = 0; lane < Width; lane++) {
+                    out.order.push_back(first + lane < end ? triangles[first + lane] : 0);
+                }
+            }
+            return index;
+        }
+
+        size_t middle = split(triangles, centers, begin, end);
+        build(out, triangles, centers, begin, middle);
+        int right = build(out, triangles, centers, middle, end);
+        nodes[index].offset = right;
+        nodes[index].count = 0;
+        return index;
+    }
+
+    static ray_frame make_frame(const ray& r) {
+        ray_frame f;
+        vector3d d = r.direction();
+        f.kz = fabs(d.x()) > fabs(d.y()) ? (fabs(d.x()) > fabs(d.z()) ? 0 : 2) : (fabs(d.y()) > fabs(d.z()) ? 1 : 2);
+        f.kx = (f.kz + 1) % 3;
+        f.ky = (f.kx + 1) % 3;
+        if (d[f.kz] < 0) {
+            std::swap(f.kx, f.ky); // Keep the winding
+        }
+        f.sx = d[f.kx] / d[f.kz];
+        f.sy = d[f.ky] / d[f.kz];
+        f.sz = 1.0 / d[f.kz];
+        for (int a = 0; a < 3; a++) {
+            f.origin[a] = r.origin()[a];
+        }
+        return f;
+    }
+
+    // Closest triangle of a packet within (t_min, t_max), returns its lane or -1. The lane
+    // loop has no branches and runs Width tests side by side. Fused multiply-adds would
+    // round the edge functions of neighbouring triangles differently and open gaps.
+    __attribute__((optimize("fp-contract=off")))
+    int intersect(const triangle_packet& packet, const ray_frame& f, double t_min, double& t_max,
+                  double& b0, double& b1, double& b2) const {
+        double t[Width], u[Width], v[Width], w[Width];
+        for (int i = 0; i < Width; i++) {
+            double ax = packet.v[0][f.kx][i] - f.origin[f.kx];
+            double ay = packet.v[0][f.ky][i] - f.origin[f.ky];
+            double az = packet.v[0][f.kz][i] - f.origin[f.kz];
+            double bx = packet.v[1][f.kx][i] - f.origin[f.kx];
+            double by = packet.v[1][f.ky][i] - f.origin[f.ky];
+            double bz = packet.v[1][f.kz][i] - f.origin[f.kz];
+            double cx = packet.v[2][f.kx][i] - f.origin[f.kx];
+            double cy = packet.v[2][f.ky][i] - f.origin[f.ky];
+            double cz = packet.v[2][f.kz][i] - f.origin[f.kz];
+
+            // Shear so the ray runs along +z, then edge functions in 2D
+            ax -= f.sx * az;
+            ay -= f.sy * az;
+            bx -= f.sx * bz;
+            by -= f.sy * bz;
+            cx -= f.sx * cz;
+            cy -= f.sy * cz;
+            double eu = cx * by - cy * bx;
+            double ev = ax * cy - ay * cx;
+            double ew = bx * ay - by * ax;
+
+            double det = eu + ev + ew;
+            double distance = (eu * az + ev * bz + ew * cz) * f.sz;
+
+            // Inside if no edge function has a sign opposite to another's. Selects and
+            // bitwise operators instead of short-circuits keep the loop free of branches.
+            double lo = eu < ev ? eu : ev;
+            double hi = eu > ev ? eu : ev;
+            lo = lo < ew ? lo : ew;
+            hi = hi > ew ? hi : ew;
+            int inside = ((lo >= 0) | (hi <= 0)) & (det != 0);
+            double distance_t = distance / (inside ? det : 1.0);
+            t[i] = (inside & (distance_t > t_min) & (distance_t < t_max)) ? distance_t : infinity;
+            u[i] = eu;
+            v[i] = ev;
+            w[i] = ew;
+        }
+
+        int lane = -1;
+        for (int i = 0; i < Width; i++) {
+            if (t[i] < t_max) {
+                t_max = t[i];
+                lane = i;
+            }
+        }
+        if (lane >= 0) {
+            double det = u[lane] + v[lane] + w[lane];
+            b0 = u[lane] / det;
+            b1 = v[lane] / det;
+            b2 = w[lane] / det;
+        }
+        return lane;
+    }
+
+    bool node_hit(const mesh_node& node, const ray_frame& f, const double* inverse, double t_min, double t_max) const {
+        for (int a = 0; a < 3; a++) {
+            double t0 = (node.bounds[a] - f.origin[a]) * inverse[a];
+            double t1 = (node.bounds[a + 3] - f.origin[a]) * inverse[a];
+            if (inverse[a] < 0) {
+                std::swap(t0, t1);
+            }
+            t_min = t0 > t_min ? t0 : t_min;
+            t_max = t1 < t_max ? t1 : t_max;
+        }
+
+        // Slightly conservative, a triangle on the box's face must not be culled by rounding
+        return t_min <= t_max * (1 + 1e-12);
+    }
+
+    // Bounds from the root, and the areas for sampling points on a light
+    void finish() {
+        const float* b = tree.nodes[0].bounds;
+        bbox = aabb(point3d(b[0], b[1], b[2]), point3d(b[3], b[4], b[5]));
+        if (is_emissive()) {
+            std::vector<double> areas(triangle_count());
+            for (size_t k = 0; k < areas.size(); k++) {
+                areas[k] = 0.5 * face_normal(k).length();
+                area += areas[k];
+            }
+            triangle_areas = alias_table(areas);
+        }
+    }
+
+  public:
+    basic_triangle_mesh(shared_ptr<const mesh_buffers> _buffers, shared_ptr<material> _material)
+        : buffers(_buffers), mat(_material) {
+        size_t count = buffers->triangle_count();
+        if (count == 0) {
+            return;
+        }
+
+        std::vector<point3d> centers(count);
+        std::vector<uint32_t> triangles(count);
+        for (size_t k = 0; k < count; k++) {
+            centers[k] = (vertex(k, 0) + vertex(k, 1) + vertex(k, 2)) / 3;
+            triangles[k] = static_cast<uint32_t>(k);
+        }
+
+        hierarchy_builder out;
+        out.nodes.reserve(2 * (count / (leaf_packets * Width) + 1));
+        out.packets.reserve(count / Width + 1);
+        build(out, triangles, centers, 0, count);
+        tree.nodes = std::move(out.nodes);
+        tree.packets = std::move(out.packets);
+        tree.order = std::move(out.order);
+        finish();
+    }
+
+    // Mesh over a hierarchy built before, by the other constructor of a mesh with the same
+    // buffers and width. Nothing is built, so a stored mesh opens in constant time unless
+    // it is a light.
+    basic_triangle_mesh(shared_ptr<const mesh_buffers> _buffers, shared_ptr<material> _material, hierarchy _tree)
+        : buffers(_buffers), mat(_material), tree(std::move(_tree)) {
+        if (buffers->triangle_count() > 0 && !tree.nodes.empty()) {
+            finish();
+        }
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override {
+        if (tree.nodes.empty()) {
+            return false;
+        }
+
+        const mesh_node* nodes = tree.nodes.data();
+        const triangle_packet* packets = tree.packets.data();
+        ray_frame f = make_frame(r);
+        double inverse[3] = { 1 / r.direction().x(), 1 / r.direction().y(), 1 / r.direction().z() };
+
+        double closest = ray_t.max;
+        uint32_t triangle = 0;
+        double b0 = 0, b1 = 0, b2 = 0;
+        bool hit_anything = false;
+
+        int stack[64];
+        int size = 0;
+        stack[size++] = 0;
+        while (size > 0) {
+            const mesh_node& node = nodes[stack[--size]];
+            if (!node_hit(node, f, inverse, ray_t.min, closest)) {
+                continue;
+            }
+
+            if (node.count > 0) {
+                for (int packet = node.offset; packet < node.offset + (node.count + Width - 1) / Width; packet++) {
+                    int lane = intersect(packets[packet], f, ray_t.min, closest, b0, b1, b2);
+                    if (lane >= 0) {
+                        hit_anything = true;
+                        triangle = tree.order[static_cast<size_t>(packet) * Width + lane];
+                    }
+                }
+                continue;
+            }
+
+            // Visit the child nearer along the ray first
+            int left = static_cast<int>(&node - nodes) + 1;
+            int right = node.offset;
+            int axis = f.kz;
+            bool left_first = r.direction()[axis] >= 0
+                ? nodes[left].bounds[axis] <= nodes[right].bounds[axis]
+                : nodes[left].bounds[axis + 3] >= nodes[right].bounds[axis + 3];
+            stack[size++] = left_first ? right : left;
+            stack[size++] = left_first ? left : right;
+        }
+
+        if (!hit_anything) {
+            return false;
+        }
+
+        const mesh_buffers& m = *buffers;
+        const uint32_t* corner = &m.indices[3 * static_cast<size_t>(triangle)];
+        rec.t = closest;
+        rec.p = b0 * m.position(corner[0]) + b1 * m.position(corner[1]) + b2 * m.position(corner[2]);
+
+        vector3d geometric = unit_vector(face_normal(triangle));
+        vector3d shading = geometric;
+        if (!m.normals.empty()) {
+            vector3d n(0, 0, 0);
+            double weights[3] = { b0, b1, b2 };
+            for (int c = 0; c < 3; c++) {
+                const float* nc = &m.normals[3 * corner[c]];
+                n += weights[c] * vector3d(nc[0], nc[1], nc[2]);
+            }
+            // Shading normals only bend the geometric one, they never flip the side
+            if (n.length_squared() > 0 && dot(n, geometric) > 0) {
+                shading = unit_vector(n);
+            }
+        }
+
+        rec.front_face = dot(r.direction(), geometric) < 0;
+        rec.normal = rec.front_face ? shading : -shading;
+
+        double footprint = r.footprint(closest);
+        if (!m.texcoords.empty()) {
+            const float* t0 = &m.texcoords[2 * corner[0]];
+            const float* t1 = &m.texcoords[2 * corner[1]];
+            const float* t2 = &m.texcoords[2 * corner[2]];
+            rec.u = b0 * t0[0] + b1 * t1[0] + b2 * t2[0];
+            rec.v = b0 * t0[1] + b1 * t1[1] + b2 * t2[1];
+
+            // Texture space is stretched by the ratio of the triangle's areas
+            double uv_area = fabs((t1[0] - t0[0]) * (t2[1] - t0[1]) - (t2[0] - t0[0]) * (t1[1] - t0[1]));
+            double world_area = face_normal(triangle).length();
+            double scale = world_area > 0 ? sqrt(uv_area / world_area) : 0;
+            rec.u_footprint = rec.v_footprint = footprint * scale;
+        }
+        else {
+            rec.u = b1;
+            rec.v = b2;
+            rec.u_footprint = rec.v_footprint = 0;
+        }
+
+        rec.mat = mat;
+        return true;
+    }
+
+    aabb bounding_box() const override {
+        return bbox;
+    }
+
+    size_t triangle_count() const {
+        return buffers->triangle_count();
+    }
+
+    const shared_ptr<const mesh_buffers>& mesh() const {
+        return buffers;
+    }
+
+    const hierarchy& bvh() const {
+        return tree;
+    }
+
+    // Memory of the hierarchy and packets, the shared buffers not included
+    size_t memory_bytes() const {
+        return tree.nodes.size() * sizeof(mesh_node) + tree.packets.size() * sizeof(triangle_packet) +
+               tree.order.size() * sizeof(uint32_t);
+    }
+
+    bool is_emissive() const override {
+        return mat && mat->is_emissive();
+    }
+
+    // Emitting from the front faces: pi * area * luminance of the radiance
+    double emitted_power() const override {
+        if (!is_emissive()) {
+            return 0.0;
+        }
+        color radiance = mat->emission();
+        double luminance = 0.2126 * radiance.x() + 0.7152 * radiance.y() + 0.0722 * radiance.z();
+        return pi * area * luminance;
+    }
+
+    // Cone around the mean face normal holding every face normal
+    bool emission_cone(vector3d& axis, double& theta_o, double& theta_e) const override {
+        vector3d sum(0, 0, 0);
+        for (size_t k = 0; k < triangle_count(); k++) {
+            sum += face_normal(k);
+        }
+        if (sum.length_squared() <= 0) {
+            return false;
+        }
+
+        axis = unit_vector(sum);
+        double cos_o = 1;
+        for (size_t k = 0; k < triangle_count(); k++) {
+            vector3d n = face_normal(k);
+            if (n.length_squared() > 0) {
+                cos_o = fmin(cos_o, dot(axis, unit_vector(n)));
+            }
+        }
+        theta_o = std::acos(cos_o < -1 ? -1 : cos_o);
+        theta_e = pi / 2;
+        return theta_o < pi;
+    }
+
+    // Uniform by area over the surface, as a solid angle density summed over every point
+    // of the mesh on the ray
+    double pdf_value(const point3d& origin, const vector3d& direction) const override {
+        if (area <= 0) {
+            return 0.0;
+        }
+
+        double pdf = 0;
+        double t_min = 0.001;
+        hit_record rec;
+        ray r(origin, direction);
+        for (int k = 0; k < 16 && hit(r, interval(t_min, infinity), rec); k++) {
+            double distance_squared = rec.t * rec.t * direction.length_squared();
+            double cosine = fabs(dot(direction, rec.normal) / direction.length());
+            if (cosine > 0) {
+                pdf += distance_squared / (cosine * area);
+            }
+            t_min = rec.t * (1 + 1e-9) + 1e-9;
+        }
+        return pdf;
+    }
+
+    vector3d random(const point3d& origin) const override {
+        if (area <= 0) {
+            return vector3d(1, 0, 0);
+        }
+
+        size_t k = triangle_areas.sample(random_double());
+        double s = sqrt(random_double());
+        double t = random_double();
+        point3d p = (1 - s) * vertex(k, 0) + s * (1 - t) * vertex(k, 1) + s * t * vertex(k, 2);
+        return p - origin;
+    }
+};
+
+using triangle_mesh = basic_triangle_mesh<8>;
+using triangle_mesh4 = basic_triangle_mesh<4>;
+
+#endif
@@ -4,6 +4,8 @@
 #include<cmath>
 #include<iostream>
 
+#include "sampling.h"
+
 using std::sqrt;
 using std::fabs;
 
@@ -130,31 +132,32 @@ inline vector3d unit_vector(vector3d v) {
     return v / v.length();
 }
 
+// Random vector in unit disk, see sampling.h for the closed-form mappings
 inline vector3d random_in_unit_disk() {
-    while (true)
-    {
-        vector3d p = vector3d(random_double(-1, 1), random_double(-1, 1), 0);
-        if (p.length_squared() < 1) {
-            return p;
-        }
-    }    
+    double x, y;
+    sample_unit_disk(random_double(), random_double(), x, y);
+    return vector3d(x, y, 0);
 }
 
 // Random vector in unit sphere
 inline vector3d random_in_unit_sphere() {
-    while (true)
-    {
-        vector3d p = vector3d::random(-1, 1);
-        if (p.length_squared() < 1) {
-            return p;
-        }
-    }
-    
+    double x, y, z;
+    sample_unit_ball(random_double(), random_double(), random_double(), x, y, z);
+    return vector3d(x, y, z);
 }
 
 // Random unit vector
 inline vector3d random_unit_vector() {
-    return unit_vector(random_in_unit_sphere());
+    double x, y, z;
+    sample_unit_sphere(random_double(), random_double(), x, y, z);
+    return vector3d(x, y, z);
+}
+
+// Random direction around +z with density cos(theta) / pi
+inline vector3d random_cosine_direction() {
+    double x, y, z;
+    sample_cosine_hemisphere(random_double(), random_double(), x, y, z);
+    return vector3d(x, y, z);
 }
 
 // Random vector on hemisphere
@@ -0,0 +1,46 @@
+#ifndef VIEWS_H
+#define VIEWS_H
+
+#include "rtweekend.h"
+#include "camera.h"
+
+#include <vector>
+
+// Left and right eye cameras, eye_separation apart along the camera's horizontal axis,
+// both converging on the original look at point. Render them with camera::render_batch.
+inline std::vector<camera> stereo_pair(const camera& cam, double eye_separation) {
+    vector3d right = unit_vector(cross(cam.lookat - cam.lookfrom, cam.vup));
+
+    std::vector<camera> views(2, cam);
+    views[0].lookfrom = cam.lookfrom - 0.5 * eye_separation * right;
+    views[1].lookfrom = cam.lookfrom + 0.5 * eye_separation * right;
+    return views;
+}
+
+// Six square, 90 degree cameras at the camera position facing +x, -x, +y, -y, +z and -z
+inline std::vector<camera> cubemap_views(const camera& cam, int face_size) {
+    const vector3d directions[6] = {
+        vector3d( 1, 0, 0), vector3d(-1, 0, 0),
+        vector3d( 0, 1, 0), vector3d( 0,-1, 0),
+        vector3d( 0, 0, 1), vector3d( 0, 0,-1)
+    };
+    const vector3d ups[6] = {
+        vector3d(0, 1, 0), vector3d(0, 1, 0),
+        vector3d(0, 0,-1), vector3d(0, 0, 1),
+        vector3d(0, 1, 0), vector3d(0, 1, 0)
+    };
+
+    std::vector<camera> views(6, cam);
+    for (int face = 0; face < 6; face++) {
+        camera& view = views[face];
+        view.image_width = face_size;
+        view.image_height = face_size;
+        view.vfov = 90;
+        view.defocus_angle = 0;
+        view.lookat = cam.lookfrom + directions[face];
+        view.vup = ups[face];
+    }
+    return views;
+}
+
+#endif